@@ -12,6 +12,7 @@
 #include "stm32g0xx_ll_dma.h"
 #include "usart.h"
 #include <string.h>
+#include <strings.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <time.h>
@@ -19,6 +20,27 @@
 #define CWMODE_MAX_SIZE 14
 #define CIPMUX_MAX_SIZE 14
 #define CIPSERVER_MAX_SIZE 50
+#define CIPSERVERMAXCONN_MAX_SIZE 24
+#define CIPSTO_MAX_SIZE 20
+#define CIPCLOSE_MAX_SIZE 16
+#define CIPSERVER_PORT_OFFSET 13	// "+CIPSERVER:1,"
+#define CIPRECVMODE_MAX_SIZE 20
+#define CIPRECVDATA_MAX_SIZE 28		// "AT+CIPRECVDATA=x,yyyy\r\n"
+
+#define BODY_KEY_MAX_SIZE 16
+#define BODY_VALUE_MAX_SIZE 32
+#define CIPSEND_CMD_MAX_SIZE 24		// "AT+CIPSEND=x,yyyy\r\n"
+#define CONTENT_LENGTH_MAX_SIZE 11
+
+// headers of the HTTP responses, sent after "HTTP/1.1 <status>"
+#define HTTP_HEADERS_MAX_SIZE 128
+static const char HTTP_CONTENT_TYPE[] = "\r\nContent-Type: text/plain; charset=utf-8";
+static const char HTTP_KEEP_ALIVE[] = "\r\nConnection: keep-alive\r\n\r\n";
+static const char HTTP_CLOSE[] = "\r\nConnection: close\r\n\r\n";
+static const char HTTP_CHUNKED[] = "\r\nTransfer-Encoding: chunked";
+#define CHUNK_SIZE_MAX_SIZE 8		// "yyyy\r\n"
+_Static_assert(RESPONSE_MAX_SIZE + HTTP_HEADERS_MAX_SIZE <= CIPSEND_MAX_SIZE,
+		"an HTTP response must fit in a single AT+CIPSEND");
 
 #define CIPSTA_IP_OFFSET 12
 
@@ -31,8 +53,33 @@
 #define CWSTATE_CONNECTING 3
 #define CWSTATE_DISCONNECTED 4
 
-volatile char uart_buffer[UART_BUFFER_SIZE + 1];
+static volatile char uart_buffer[UART_BUFFER_SIZE];
 bool WIFI_response_sent = false;
+static WIFI_BootStats_t boot_stats;
+
+// see WIFI_Supervise
+static struct
+{
+	volatile bool		online;			// as told by the last "WIFI GOT IP" or "WIFI DISCONNECT"
+	volatile uint32_t	changed_at;		// uwTick of that line
+	bool				started;
+	bool				handled_online;	// online as last seen by WIFI_Supervise
+	bool				joining;		// AT+CWJAP queued and not done yet
+	uint32_t			offline_since;
+	uint32_t			downtime;		// of the outages already ended
+	uint32_t			backoff;
+	uint32_t			next_attempt;	// uwTick
+	uint32_t			reconnects;
+	uint32_t			attempts;
+	ESP8266_Part_t		join[5];		// AT+CWJAP="SSID","pw"
+} wifi_health;
+
+static void WIFI_SetResponseSent(void)
+{
+	WIFI_response_sent = true;
+	if (boot_stats.first_response_ms == 0)
+		boot_stats.first_response_ms = uwTick;
+}
 
 void WIFI_Init(WIFI_t* wifi)
 {
@@ -53,7 +100,8 @@ void WIFI_ResetComm(WIFI_t* wifi, Connection_t* conn)
 	ESP8266_ClearBuffer();
 	memset(wifi->buf, 0, WIFI_BUF_MAX_SIZE);
 	memset(conn->request, 0, REQUEST_MAX_SIZE);
-	memset(conn->response_buffer, 0, RESPONSE_MAX_SIZE);
+	conn->body_size = 0;
+	conn->carry_size = 0;
 }
 
 int32_t bufferToInt(char* buf, uint32_t size)
@@ -69,116 +117,872 @@ int32_t bufferToInt(char* buf, uint32_t size)
 	return n;
 }
 
-Response_t ESP8266_WaitForStringCNDTROffset(char* str, int32_t offset, uint32_t timeout)
+/**
+ * AT response parser
+ *
+ * uart_buffer is a ring: the circular DMA writes the ESP output in it without ever being stopped.
+ * HAL_UARTEx_RxEventCallback (UART idle line, DMA half and full buffer) calls ESP8266_RxEvent, which parses
+ * the bytes received since the last call one line at a time. every known line sets its event bit, the Wait
+ * functions only test these bits, so they return as soon as the line that ends the response is received.
+ * the data of "+CIPRECVDATA:m," is skipped, so the data received from a client can't be taken for a response.
+ *
+ * the bytes are numbered from the start of the reception (received), so a position stays valid across the
+ * wrap arounds: it is uart_buffer[index % UART_BUFFER_SIZE] until the DMA writes UART_BUFFER_SIZE more bytes.
+ * the lines of a response and the received data are copied out of the ring by the functions that use them,
+ * which check that the DMA didn't overwrite them in the meantime.
+ * at 2 Mbaud the DMA fills uart_buffer in ~1.3 ms, so the UART and its DMA interrupts have a higher priority
+ * than the ADC ones. if the parser falls a whole ring behind anyway, ESP8266_RxEvent notices it by counting
+ * the half and full buffer events, counts an overrun and starts again from the DMA position. the DMA flags
+ * are one bit each, so from a ring and a half behind the lap is only seen for some positions of the DMA.
+ *
+ * the server runs in passive receive mode (AT+CIPRECVMODE=1): the ESP keeps the data of the clients and only
+ * announces it with "+IPD,n,m", then WIFI_ReceiveRequest pulls it with AT+CIPRECVDATA, at most RECV_CHUNK_SIZE
+ * bytes at a time, so the ring never has to hold a whole request.
+ * every link of the server (up to WIFI_MAX_LINKS clients at once) has its state in esp_links, kept by the
+ * parser from "n,CONNECT", "n,CLOSED" and "+IPD,n,m". WIFI_ReceiveRequest serves the links with data one after
+ * the other, so a client sending many requests can't delay the others.
+ */
+#define ESP_LINE_MAX_SIZE 24		// only the beginning of longer lines is kept, they never match
+#define RESPONSE_LINE_MAX_SIZE 64	// "+CWSTATE:x,\"<32 characters SSID>\"\r\n"
+
+_Static_assert(RECV_CHUNK_SIZE + 32 <= UART_BUFFER_SIZE, "the data of AT+CIPRECVDATA must fit in uart_buffer with its "
+		"header, check RECV_CHUNK_SIZE in settings.h");
+
+typedef enum
 {
-	if (str == NULL) return NULVAL;
-	for (uint32_t i = 0; i < timeout; i++)
+	ESP_LINE_OK				= 1 << 0,
+	ESP_LINE_ERROR			= 1 << 1,
+	ESP_LINE_FAIL			= 1 << 2,	// "FAIL" and "SEND FAIL"
+	ESP_LINE_SEND_OK		= 1 << 3,
+	ESP_LINE_PROMPT			= 1 << 4,	// '>' of AT+CIPSEND, it's not followed by "\r\n"
+	ESP_LINE_READY			= 1 << 5,
+	ESP_LINE_WIFI_CONNECTED	= 1 << 6,
+	ESP_LINE_WIFI_GOT_IP	= 1 << 7,
+	ESP_LINE_WIFI_DISCONNECT	= 1 << 8,
+	ESP_LINE_TARGET			= 1 << 9,	// string passed to a Wait function which is not in esp_lines
+} ESP_Line_t;
+
+typedef struct
+{
+	const char* text;
+	ESP_Line_t	line;
+} ESP_KnownLine_t;
+
+static const ESP_KnownLine_t esp_lines[] =
+{
+	{ "OK", ESP_LINE_OK },
+	{ "ERROR", ESP_LINE_ERROR },
+	{ "FAIL", ESP_LINE_FAIL },
+	{ "SEND FAIL", ESP_LINE_FAIL },
+	{ "SEND OK", ESP_LINE_SEND_OK },
+	{ ">", ESP_LINE_PROMPT },
+	{ "ready", ESP_LINE_READY },
+	{ "WIFI CONNECTED", ESP_LINE_WIFI_CONNECTED },
+	{ "WIFI GOT IP", ESP_LINE_WIFI_GOT_IP },
+	{ "WIFI DISCONNECT", ESP_LINE_WIFI_DISCONNECT },
+};
+
+static struct
+{
+	volatile uint32_t	received;		// bytes parsed since the start of the reception
+	uint32_t			response_start;	// index of the first byte after the last ESP8266_ClearBuffer
+	uint16_t			pos;			// index of the next byte of uart_buffer to parse
+	uint16_t			line_size;		// can be larger than ESP_LINE_MAX_SIZE
+	uint16_t			data_skip;		// bytes of the +CIPRECVDATA still to be received
+	char				line[ESP_LINE_MAX_SIZE];
+	const char*			target;
+	uint8_t				target_size;
+	volatile uint16_t	events;			// ESP_Line_t received since the last ESP8266_ClearBuffer
+	uint32_t			data_start;		// index of the first byte of the data of the last +CIPRECVDATA
+	volatile uint16_t	data_size;
+	uint32_t			wraps;
+	uint32_t			overruns;		// data overwritten by the DMA before being read
+	volatile uint32_t	dma_boundaries;	// half and full buffer events of the DMA
+	uint32_t			boundaries;		// halves of uart_buffer crossed by the parser
+} esp_rx;
+
+typedef struct
+{
+	uint32_t	waiting_since;	// uwTick of the arrival of the data not read yet
+	uint16_t	available;		// bytes announced by +IPD and not read yet
+	uint8_t		open;
+	uint8_t		connects;		// tells apart the clients that had the same link
+} ESP_Link_t;
+
+static ESP_Link_t esp_links[WIFI_MAX_LINKS];
+static uint8_t esp_last_link;		// served last, the next request is taken from the links after it
+static uint32_t esp_expired;		// links closed after LINK_REQUEST_TIMEOUT_MS
+
+static ESP8266_Latency_t esp_latency;
+
+/*
+Transmission of the AT commands and of the data of AT+CIPSEND: with ENABLE_UART_TX_DMA every part is sent by
+the DMA, ESP8266_TxEvent (TX complete) starts the next one.
+*/
+static struct
+{
+	const ESP8266_Part_t*	parts;
+	uint8_t					count;
+	uint8_t					next;
+	volatile bool			busy;
+	volatile bool			error;
+	volatile uint32_t		completed;	// transmissions, to wake up the MCU
+	uint32_t				cpu_us;		// spent by the CPU transmitting the current command
+} esp_tx;
+
+static ESP8266_TxStats_t esp_tx_stats;
+
+// microseconds from SysTick, for the latency of the AT commands
+static uint32_t ESP8266_GetMicros(void)
+{
+	uint32_t ms, val;
+	do
 	{
-		HAL_Delay(1);
+		ms = uwTick;
+		val = SysTick->VAL;
+	} while (ms != uwTick);	// SysTick reloaded while reading
+	return ms * 1000 + (SysTick->LOAD - val) / (SystemCoreClock / 1000000);
+}
 
-		if (strstr((char*)uart_buffer, "ERR") != NULL)
+// a new client on the link, or the last one went away: the data of the previous one is not read anymore
+static void ESP8266_SetLink(uint8_t link, bool open)
+{
+	esp_links[link].available = 0;
+	esp_links[link].open = open;
+	if (open) esp_links[link].connects++;
+}
+
+// +IPD,n,m
+static void ESP8266_ParseIpd(void)
+{
+	uint32_t size_index = esp_rx.line_size;
+	while (esp_rx.line[size_index - 1] != ',') size_index--;
+	if (size_index <= 5) return;
+	int32_t size = bufferToInt(esp_rx.line + size_index, esp_rx.line_size - size_index);
+	int32_t link = bufferToInt(esp_rx.line + 5, size_index - 6);
+	if (size <= 0 || link < 0 || link >= WIFI_MAX_LINKS) return;
+
+	ESP_Link_t* esp_link = &esp_links[link];
+	if (esp_link->available == 0)
+		esp_link->waiting_since = uwTick;
+	// only a hint: the reads go on until the ESP has no more data
+	esp_link->available = (esp_link->available + size < 0xFFFF) ? esp_link->available + size : 0xFFFF;
+	esp_link->open = true;
+}
+
+static void ESP8266_ParseLine(void)
+{
+	if (esp_rx.line_size > ESP_LINE_MAX_SIZE) return;
+
+	for (uint32_t i = 0; i < sizeof(esp_lines) / sizeof(esp_lines[0]); i++)
+	{
+		if (strlen(esp_lines[i].text) == esp_rx.line_size
+				&& memcmp(esp_rx.line, esp_lines[i].text, esp_rx.line_size) == 0)
 		{
-			ESP8266_ClearBuffer();
-			return ERR;
+			esp_rx.events |= esp_lines[i].line;
+			// the association can change at any time, not only while a command is waiting for it
+			if (esp_lines[i].line & (ESP_LINE_WIFI_GOT_IP | ESP_LINE_WIFI_DISCONNECT))
+			{
+				wifi_health.online = (esp_lines[i].line == ESP_LINE_WIFI_GOT_IP);
+				wifi_health.changed_at = uwTick;
+			}
+			return;
 		}
+	}
 
-		if (UART_BUFFER_SIZE - UART_DMA_CHANNEL->CNDTR > (offset < 0) ? -offset : offset)
-			if (strstr((char*)uart_buffer + (UART_BUFFER_SIZE - UART_DMA_CHANNEL->CNDTR) + offset, str) == NULL)
-				continue;
+	if (esp_rx.target != NULL && esp_rx.target_size == esp_rx.line_size
+			&& memcmp(esp_rx.line, esp_rx.target, esp_rx.line_size) == 0)
+		esp_rx.events |= ESP_LINE_TARGET;
 
-		ESP8266_ClearBuffer();
-		return OK;
+	if (esp_rx.line_size > 5 && esp_rx.line_size <= ESP_LINE_MAX_SIZE && memcmp(esp_rx.line, "+IPD,", 5) == 0)
+	{
+		ESP8266_ParseIpd();
+		return;
+	}
+
+	// n,CONNECT
+	// n,CLOSED
+	if (esp_rx.line_size > 2 && esp_rx.line[1] == ',' && esp_rx.line[0] >= '0' && esp_rx.line[0] < '0' + WIFI_MAX_LINKS)
+	{
+		uint8_t link = esp_rx.line[0] - '0';
+		if (esp_rx.line_size == 9 && memcmp(esp_rx.line + 2, "CONNECT", 7) == 0)
+			ESP8266_SetLink(link, true);
+		else if (esp_rx.line_size == 8 && memcmp(esp_rx.line + 2, "CLOSED", 6) == 0)
+			ESP8266_SetLink(link, false);
 	}
+}
 
-	if (strstr((char*)uart_buffer, "ERROR")) return ERR;
+static void ESP8266_ParseByte(char c)
+{
+	if (esp_rx.data_skip > 0)
+	{
+		esp_rx.data_skip--;
+		return;
+	}
+
+	switch (c)
+	{
+	case '\0':	// cleared part of the buffer
+	case '\r':
+		return;
+	case ' ':	// i.e. after the '>' prompt
+		if (esp_rx.line_size == 0)
+			return;
+		break;
+	case '\n':
+		ESP8266_ParseLine();
+		esp_rx.line_size = 0;
+		return;
+	case '>':
+		if (esp_rx.line_size == 0)
+		{
+			esp_rx.events |= ESP_LINE_PROMPT;
+			return;
+		}
+		break;
+	case ':':
+	case ',':
+		// +CIPRECVDATA:m,<data> (or +CIPRECVDATA,m:<data> of the older firmwares) is followed by m bytes of data
+		if (esp_rx.line_size > 13 && esp_rx.line_size <= ESP_LINE_MAX_SIZE
+				&& memcmp(esp_rx.line, "+CIPRECVDATA", 12) == 0 && esp_rx.line[12] != c
+				&& (esp_rx.line[12] == ':' || esp_rx.line[12] == ','))
+		{
+			int32_t size = bufferToInt(esp_rx.line + 13, esp_rx.line_size - 13);
+			if (size < 0) break;
+			esp_rx.line_size = 0;
+			esp_rx.data_start = esp_rx.received + 1;
+			esp_rx.data_size = size;
+			esp_rx.data_skip = size;
+			return;
+		}
+		break;
+	}
 
-	return TIMEOUT;
+	if (esp_rx.line_size < ESP_LINE_MAX_SIZE)
+		esp_rx.line[esp_rx.line_size] = c;
+	if (esp_rx.line_size <= ESP_LINE_MAX_SIZE)
+		esp_rx.line_size++;
 }
 
-Response_t ESP8266_WaitForString(char* str, uint32_t timeout)
+// index of uart_buffer the DMA will write next
+static uint16_t ESP8266_GetDMAPosition(void)
 {
-	if (str == NULL) return NULVAL;
-	for (uint32_t i = 0; i < timeout; i++)
+	uint16_t dma_pos = UART_BUFFER_SIZE - UART_DMA_CHANNEL->CNDTR;
+	return (dma_pos < UART_BUFFER_SIZE) ? dma_pos : 0;		// CNDTR is 0 only before the reception starts
+}
+
+/*
+The DMA lapped the parser (it was held off for more than a ring, UART_BUFFER_SIZE bytes): the bytes between
+the two are lost, the parser starts again from the DMA. laps is how many times the DMA went around the ring,
+fewer if some events were lost
+*/
+static void ESP8266_Resync(uint16_t dma_pos, uint32_t laps, uint32_t pending)
+{
+	uint32_t size = (dma_pos + UART_BUFFER_SIZE - esp_rx.pos) % UART_BUFFER_SIZE;
+	uint32_t lost = laps * UART_BUFFER_SIZE + size;
+	esp_rx.received += lost;
+	esp_rx.wraps += laps + (dma_pos < esp_rx.pos);
+	// the events lost while their flag was still set are forgotten, the pending ones will be counted
+	esp_rx.boundaries = esp_rx.dma_boundaries + pending;
+	esp_rx.pos = dma_pos;
+	// the data of a +CIPRECVDATA is counted in bytes, the line being received is dropped as a too long one
+	esp_rx.data_skip = (esp_rx.data_skip > lost) ? esp_rx.data_skip - lost : 0;
+	esp_rx.line_size = ESP_LINE_MAX_SIZE + 1;
+	esp_rx.overruns++;
+}
+
+void ESP8266_RxEvent(bool boundary)
+{
+	// the DMA counter is used instead of the size passed by HAL, which is fixed for the half and full buffer
+	// events and could be behind the bytes already parsed after a later idle event
+	if (boundary) esp_rx.dma_boundaries++;
+	// the flags before the position: a half crossed in between is only seen as not received yet
+	uint32_t pending = UART_DMA_PENDING_EVENTS();
+	uint16_t dma_pos = ESP8266_GetDMAPosition();
+
+	/*
+	 * the DMA position alone can't tell a whole ring more. the half and full buffer events, received or
+	 * still pending, are the halves of the ring crossed by the DMA: if they are more than the ones the parser
+	 * is about to cross, the DMA went around the ring at least once
+	 */
+	uint32_t size = (dma_pos + UART_BUFFER_SIZE - esp_rx.pos) % UART_BUFFER_SIZE;
+	int32_t halves = (esp_rx.pos % (UART_BUFFER_SIZE / 2) + size) / (UART_BUFFER_SIZE / 2);
+	int32_t extra = (int32_t)(esp_rx.dma_boundaries + pending - esp_rx.boundaries) - halves;
+	if (extra > 0)
 	{
-		HAL_Delay(1);
+		ESP8266_Resync(dma_pos, (extra + 1) / 2, pending);
+		return;
+	}
+	esp_rx.boundaries += halves;
 
-		// strstr((char*)uart_buffer, "FAIL") is to handle failed WiFi connections
-		if (strstr((char*)uart_buffer, "FAIL"))
+	while (esp_rx.pos != dma_pos)
+	{
+		ESP8266_ParseByte(uart_buffer[esp_rx.pos]);
+		esp_rx.received++;
+		if (++esp_rx.pos == UART_BUFFER_SIZE)
 		{
-			ESP8266_ClearBuffer();
-			return FAIL;
+			esp_rx.pos = 0;
+			esp_rx.wraps++;
 		}
+	}
+}
+
+// bytes written by the DMA since the start of the reception, including the ones not parsed yet
+static uint32_t ESP8266_GetWritten(void)
+{
+	__disable_irq();
+	uint32_t written = esp_rx.received + (ESP8266_GetDMAPosition() + UART_BUFFER_SIZE - esp_rx.pos) % UART_BUFFER_SIZE;
+	__enable_irq();
+	return written;
+}
+
+// true if the byte at index (and so all the following ones) was not overwritten by the DMA yet
+static bool ESP8266_IsInRing(uint32_t index)
+{
+	if (ESP8266_GetWritten() - index <= UART_BUFFER_SIZE)
+		return true;
+	esp_rx.overruns++;
+	return false;
+}
+
+// copies size bytes from index, false if they were overwritten before being copied
+static bool ESP8266_ReadRing(uint32_t index, char* dst, uint32_t size)
+{
+	uint32_t pos = index % UART_BUFFER_SIZE;
+	for (uint32_t i = 0; i < size; i++)
+	{
+		dst[i] = uart_buffer[pos];
+		if (++pos == UART_BUFFER_SIZE) pos = 0;
+	}
+	return ESP8266_IsInRing(index);
+}
 
-		if (strstr((char*)uart_buffer, "ERR"))
+/*
+Copies in line (NUL terminated, with its "\r\n" if it fits in size) the first line starting with prefix
+received since the last ESP8266_ClearBuffer. Returns line or NULL if there is no such line.
+*/
+static char* ESP8266_GetResponseLine(const char* prefix, char* line, uint32_t size)
+{
+	uint32_t prefix_size = strlen(prefix);
+	uint32_t end = esp_rx.received;
+	uint32_t start = esp_rx.response_start;
+	if (!ESP8266_IsInRing(start)) return NULL;
+
+	uint32_t pos = start % UART_BUFFER_SIZE;
+	bool line_start = true;
+	for (uint32_t index = start; index + prefix_size <= end; index++)
+	{
+		if (line_start && uart_buffer[pos] == prefix[0])
 		{
-			ESP8266_ClearBuffer();
-			return ERR;
+			uint32_t line_size = 0;
+			uint32_t line_pos = pos;
+			while (line_size < size - 1 && index + line_size < end)
+			{
+				line[line_size++] = uart_buffer[line_pos];
+				if (uart_buffer[line_pos] == '\n') break;
+				if (++line_pos == UART_BUFFER_SIZE) line_pos = 0;
+			}
+			line[line_size] = '\0';
+			if (line_size >= prefix_size && memcmp(line, prefix, prefix_size) == 0)
+				return ESP8266_IsInRing(index) ? line : NULL;
 		}
+		line_start = (uart_buffer[pos] == '\n');
+		if (++pos == UART_BUFFER_SIZE) pos = 0;
+	}
+	return NULL;
+}
 
-		if (!strstr((char*)uart_buffer, str)) continue;
+// returns the event bit of str, which is compared without its final "\r\n"
+static uint16_t ESP8266_SetTarget(char* str)
+{
+	uint32_t size = strlen(str);
+	while (size > 0 && (str[size - 1] == '\n' || str[size - 1] == '\r')) size--;
 
-		ESP8266_ClearBuffer();
-		return OK;
+	for (uint32_t i = 0; i < sizeof(esp_lines) / sizeof(esp_lines[0]); i++)
+	{
+		if (strncmp(esp_lines[i].text, str, size) == 0 && esp_lines[i].text[size] == '\0')
+			return esp_lines[i].line;
+	}
+
+	if (size > ESP_LINE_MAX_SIZE) size = ESP_LINE_MAX_SIZE;
+	__disable_irq();
+	esp_rx.target = str;
+	esp_rx.target_size = size;
+	esp_rx.events &= ~ESP_LINE_TARGET;
+	__enable_irq();
+	// the line could have been received before the target was set
+	char line[RESPONSE_LINE_MAX_SIZE];
+	if (ESP8266_GetResponseLine(str, line, sizeof(line)) != NULL)
+	{
+		__disable_irq();
+		esp_rx.events |= ESP_LINE_TARGET;
+		__enable_irq();
 	}
+	return ESP_LINE_TARGET;
+}
 
-	if (strstr((char*)uart_buffer, "ERROR")) return ERR;
+// changes with every byte received and every transmission completed
+static uint32_t ESP8266_GetActivity(void)
+{
+	return esp_rx.received + esp_tx.completed;
+}
 
-	return TIMEOUT;
+/*
+Sleeps until the next interrupt if nothing happened since activity was read (see ESP8266_GetActivity).
+An interrupt raised after the check still wakes the MCU up.
+*/
+static void ESP8266_Sleep(uint32_t activity)
+{
+	__disable_irq();
+	if (ESP8266_GetActivity() == activity) __WFI();
+	__enable_irq();
 }
 
-Response_t ESP8266_WaitKeepString(char* str, uint32_t timeout)
+// sends the queued commands, sleeps when there is nothing to do
+static void ESP8266_Idle(void)
+{
+	uint32_t activity = ESP8266_GetActivity();
+	if (!ESP8266_Process())
+		ESP8266_Sleep(activity);
+}
+
+static Response_t ESP8266_CheckLine(uint16_t target, uint16_t fail_events, uint32_t start_time, uint32_t timeout)
+{
+	uint16_t events = esp_rx.events;
+	if (events & fail_events) return FAIL;
+	if (events & ESP_LINE_ERROR) return ERR;
+	if (events & target) return OK;
+	if (uwTick - start_time >= timeout) return TIMEOUT;
+	return WAITING;
+}
+
+/*
+Waits for a line equal to str, an "ERROR" line or (if fail_events is ESP_LINE_FAIL) a "FAIL" line.
+The MCU sleeps until the next interrupt while there is nothing new.
+*/
+static Response_t ESP8266_WaitLine(char* str, uint16_t fail_events, uint32_t timeout)
 {
 	if (str == NULL) return NULVAL;
-	for (uint32_t i = 0; i < timeout; i++)
+	uint16_t target = ESP8266_SetTarget(str);
+	uint32_t start_time = uwTick;
+	Response_t result;
+	while (1)
 	{
-		HAL_Delay(1);
-		char* ptr = strstr((char*)uart_buffer, str);
-		if (ptr == NULL) continue;
+		uint32_t activity = ESP8266_GetActivity();
+		result = ESP8266_CheckLine(target, fail_events, start_time, timeout);
+		if (result != WAITING) break;
+		ESP8266_Sleep(activity);
+	}
+	esp_rx.target = NULL;
+	return result;
+}
 
-		return OK;
+static void ESP8266_AddLatency(uint32_t start_us, Response_t resp)
+{
+	esp_latency.commands++;
+	if (resp == TIMEOUT)
+	{
+		esp_latency.timeouts++;
+		return;
 	}
+	esp_latency.last_us = ESP8266_GetMicros() - start_us;
+	if (esp_latency.last_us > esp_latency.max_us)
+		esp_latency.max_us = esp_latency.last_us;
+	esp_latency.total_us += esp_latency.last_us;
+}
 
-	if (strstr((char*)uart_buffer, "ERROR")) return ERR;
+void ESP8266_GetLatency(ESP8266_Latency_t* latency)
+{
+	if (latency == NULL) return;
+	*latency = esp_latency;
+}
 
-	return TIMEOUT;
+void ESP8266_GetTxStats(ESP8266_TxStats_t* stats)
+{
+	if (stats == NULL) return;
+	*stats = esp_tx_stats;
+}
+
+void ESP8266_GetRxStats(ESP8266_RxStats_t* stats)
+{
+	if (stats == NULL) return;
+	__disable_irq();
+	stats->received = esp_rx.received;
+	stats->wraps = esp_rx.wraps;
+	stats->overruns = esp_rx.overruns;
+	__enable_irq();
+}
+
+// offset is not used anymore: the parser already matches only whole lines
+Response_t ESP8266_WaitForStringCNDTROffset(char* str, int32_t offset, uint32_t timeout)
+{
+	Response_t resp = ESP8266_WaitLine(str, 0, timeout);
+	if (resp == OK || resp == ERR)
+		ESP8266_ClearBuffer();
+	return resp;
+}
+
+Response_t ESP8266_WaitForString(char* str, uint32_t timeout)
+{
+	// ESP_LINE_FAIL is to handle failed WiFi connections
+	Response_t resp = ESP8266_WaitLine(str, ESP_LINE_FAIL, timeout);
+	if (resp != TIMEOUT && resp != NULVAL)
+		ESP8266_ClearBuffer();
+	return resp;
+}
+
+Response_t ESP8266_WaitKeepString(char* str, uint32_t timeout)
+{
+	return ESP8266_WaitLine(str, ESP_LINE_FAIL, timeout);
+}
+
+/**
+ * AT command queue
+ *
+ * ESP8266_Process sends the queued commands one at a time and never blocks: it transmits the first one, then
+ * at every call it checks the events set by the parser, until the expected line (or "ERROR", "FAIL") is
+ * received or the command times out, and then it calls the callback of the command. an AT+CIPSEND is a single
+ * command that also sends the data after '>' and waits for "SEND OK", each stage with its own timeout.
+ * the blocking functions queue their command and run ESP8266_Idle until it's done: the interrupts (sampling,
+ * alarms, UART) keep running while the ESP answers, the main loop waits.
+ */
+#define CIPSEND_PROMPT_TIMEOUT 700	// "OK" and '>' of AT+CIPSEND
+
+typedef enum
+{
+	ESP_CMD_AT,
+	ESP_CMD_SEND,
+	ESP_CMD_PARTS,	// AT command written from its parts, i.e. with the strings of WIFI_t in it
+} ESP_CommandType_t;
+
+typedef enum
+{
+	ESP_STATE_IDLE,
+	ESP_STATE_TRANSMIT,		// command without expected line, done once it's transmitted
+	ESP_STATE_RESPONSE,		// waiting for the expected line of an AT command
+	ESP_STATE_PROMPT,		// waiting for '>' after AT+CIPSEND
+	ESP_STATE_SEND_OK,		// data sent, waiting for "SEND OK"
+} ESP_State_t;
+
+typedef struct
+{
+	const void*			data;		// command, or the ESP8266_Part_t of an AT+CIPSEND or ESP_CMD_PARTS
+	const char*			expected;
+	ESP8266_Callback_t	callback;
+	void*				context;
+	uint32_t			timeout;
+	uint16_t			size;		// of the command, or number of parts
+	uint8_t				type;		// ESP_CommandType_t
+	uint8_t				link;
+} ESP_Command_t;
+
+static struct
+{
+	ESP_Command_t	commands[ESP_QUEUE_SIZE];
+	uint8_t			first;
+	uint8_t			count;
+	uint8_t			state;			// ESP_State_t of the first command
+	uint16_t		target;			// ESP_Line_t that ends the current stage
+	uint32_t		start_time;		// of the current stage
+	uint32_t		start_us;		// of the command, for the latency
+	ESP8266_Part_t	command;		// AT command being transmitted
+	char			cipsend[CIPSEND_CMD_MAX_SIZE];	// the DMA reads it while it's transmitted
+} esp_queue;
+
+// skips the empty parts, the last one completes the transmission
+static void ESP8266_TransmitNext(void)
+{
+	while (esp_tx.next < esp_tx.count && esp_tx.parts[esp_tx.next].size == 0)
+		esp_tx.next++;
+	if (esp_tx.next < esp_tx.count)
+	{
+		const ESP8266_Part_t* part = &esp_tx.parts[esp_tx.next++];
+		if (HAL_UART_Transmit_DMA(&STM_UART, (uint8_t*)part->data, part->size) == HAL_OK)
+			return;
+		esp_tx.error = true;
+	}
+	esp_tx.busy = false;
+	esp_tx.completed++;
+}
+
+void ESP8266_TxEvent(void)
+{
+	uint32_t start_us = ESP8266_GetMicros();
+	ESP8266_TransmitNext();
+	esp_tx.cpu_us += ESP8266_GetMicros() - start_us;
+}
+
+/*
+Starts the transmission of the parts, which must stay valid until esp_tx.busy is false. With
+ENABLE_UART_TX_DMA the CPU only starts the DMA for every part, otherwise it sends them byte by byte.
+*/
+static void ESP8266_Transmit(const ESP8266_Part_t* parts, uint8_t count)
+{
+	uint32_t start_us = ESP8266_GetMicros();
+	esp_tx.parts = parts;
+	esp_tx.count = count;
+	esp_tx.next = 0;
+	esp_tx.error = false;
+#ifdef ENABLE_UART_TX_DMA
+	esp_tx.busy = true;
+	ESP8266_TransmitNext();
+#else
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (parts[i].size == 0) continue;
+		if (HAL_UART_Transmit(&STM_UART, (uint8_t*)parts[i].data, parts[i].size, UART_TX_TIMEOUT) != HAL_OK)
+		{
+			esp_tx.error = true;
+			break;
+		}
+	}
+	esp_tx.completed++;
+#endif
+	// ESP8266_TxEvent can add its time meanwhile
+	__disable_irq();
+	esp_tx.cpu_us += ESP8266_GetMicros() - start_us;
+	__enable_irq();
+}
+
+static void ESP8266_FinishCommand(Response_t result)
+{
+	ESP_Command_t cmd = esp_queue.commands[esp_queue.first];
+	if (cmd.type == ESP_CMD_AT && cmd.expected != NULL)
+		ESP8266_AddLatency(esp_queue.start_us, result);
+	if (cmd.type == ESP_CMD_SEND)
+	{
+		esp_tx_stats.responses++;
+		esp_tx_stats.last_cpu_us = esp_tx.cpu_us;
+		if (esp_tx.cpu_us > esp_tx_stats.max_cpu_us)
+			esp_tx_stats.max_cpu_us = esp_tx.cpu_us;
+		esp_tx_stats.total_cpu_us += esp_tx.cpu_us;
+	}
+
+	esp_rx.target = NULL;
+	esp_queue.first = (esp_queue.first + 1) % ESP_QUEUE_SIZE;
+	esp_queue.count--;
+	esp_queue.state = ESP_STATE_IDLE;
+
+	// the command is already out of the queue, so the callback can queue another one
+	if (cmd.callback != NULL)
+		cmd.callback(result, cmd.context);
+}
+
+static void ESP8266_StartCommand(ESP_Command_t* cmd)
+{
+	ESP8266_ClearBuffer();
+	esp_queue.start_time = uwTick;
+	esp_queue.start_us = ESP8266_GetMicros();
+	esp_tx.cpu_us = 0;
+
+	if (cmd->type == ESP_CMD_SEND)
+	{
+		const ESP8266_Part_t* parts = cmd->data;
+		uint32_t size = 0;
+		for (uint32_t i = 0; i < cmd->size; i++)
+			size += parts[i].size;
+
+		esp_queue.command.data = (uint8_t*)esp_queue.cipsend;
+		esp_queue.command.size = snprintf(esp_queue.cipsend, CIPSEND_CMD_MAX_SIZE, "AT+CIPSEND=%d,%" PRIu32 "\r\n",
+				cmd->link, size);
+		esp_queue.target = ESP_LINE_PROMPT;
+		esp_queue.state = ESP_STATE_PROMPT;
+	}
+	else
+	{
+		esp_queue.command.data = cmd->data;
+		esp_queue.command.size = cmd->size;
+		if (cmd->expected != NULL)
+		{
+			esp_queue.target = ESP8266_SetTarget((char*)cmd->expected);
+			esp_queue.state = ESP_STATE_RESPONSE;
+		}
+		else esp_queue.state = ESP_STATE_TRANSMIT;
+
+		if (cmd->type == ESP_CMD_PARTS)
+		{
+			ESP8266_Transmit(cmd->data, cmd->size);
+			return;
+		}
+	}
+	ESP8266_Transmit(&esp_queue.command, 1);
+}
+
+static void ESP8266_SendParts(ESP_Command_t* cmd)
+{
+	// the ESP collects the parts in one packet, so they are sent from where they are without copying
+	ESP8266_ClearBuffer();
+	esp_queue.target = ESP_LINE_SEND_OK;
+	esp_queue.state = ESP_STATE_SEND_OK;
+	esp_queue.start_time = uwTick;
+	ESP8266_Transmit(cmd->data, cmd->size);
+}
+
+bool ESP8266_Process(void)
+{
+	if (esp_queue.count == 0) return false;
+
+	ESP_Command_t* cmd = &esp_queue.commands[esp_queue.first];
+	if (esp_queue.state == ESP_STATE_IDLE)
+	{
+		ESP8266_StartCommand(cmd);
+		return true;
+	}
+
+	if (esp_tx.busy)
+	{
+		if (uwTick - esp_queue.start_time < UART_TX_TIMEOUT) return false;
+		HAL_UART_AbortTransmit(&STM_UART);
+		esp_tx.busy = false;
+		esp_tx.error = true;
+	}
+	if (esp_tx.error || esp_queue.state == ESP_STATE_TRANSMIT)
+	{
+		ESP8266_FinishCommand(esp_tx.error ? ERR : OK);
+		return true;
+	}
+
+	uint32_t timeout = (esp_queue.state == ESP_STATE_PROMPT) ? CIPSEND_PROMPT_TIMEOUT : cmd->timeout;
+	Response_t result = ESP8266_CheckLine(esp_queue.target, ESP_LINE_FAIL, esp_queue.start_time, timeout);
+	if (result == WAITING) return false;
+
+	if (esp_queue.state == ESP_STATE_PROMPT && result == OK)
+		ESP8266_SendParts(cmd);
+	else
+		ESP8266_FinishCommand(result);
+	return true;
+}
+
+bool ESP8266_IsBusy(void)
+{
+	return esp_queue.count > 0;
+}
+
+static ESP_Command_t* ESP8266_QueueAdd(void)
+{
+	if (esp_queue.count >= ESP_QUEUE_SIZE) return NULL;
+	ESP_Command_t* cmd = &esp_queue.commands[(esp_queue.first + esp_queue.count) % ESP_QUEUE_SIZE];
+	esp_queue.count++;
+	return cmd;
+}
+
+Response_t ESP8266_QueueCommand(const char* cmd, uint16_t size, const char* expected, uint32_t timeout,
+		ESP8266_Callback_t callback, void* context)
+{
+	if (cmd == NULL) return NULVAL;
+	ESP_Command_t* entry = ESP8266_QueueAdd();
+	if (entry == NULL) return ERR;
+
+	entry->data = cmd;
+	entry->expected = expected;
+	entry->callback = callback;
+	entry->context = context;
+	entry->timeout = timeout;
+	entry->size = size;
+	entry->type = ESP_CMD_AT;
+	return OK;
+}
+
+Response_t ESP8266_QueueSend(uint8_t link, const ESP8266_Part_t* parts, uint8_t count, uint32_t timeout,
+		ESP8266_Callback_t callback, void* context)
+{
+	if (parts == NULL || count == 0) return NULVAL;
+	uint32_t size = 0;
+	for (uint32_t i = 0; i < count; i++)
+		size += parts[i].size;
+	if (size == 0 || size > CIPSEND_MAX_SIZE) return ERR;
+
+	ESP_Command_t* entry = ESP8266_QueueAdd();
+	if (entry == NULL) return ERR;
+
+	entry->data = parts;
+	entry->expected = NULL;
+	entry->callback = callback;
+	entry->context = context;
+	entry->timeout = timeout;
+	entry->size = count;
+	entry->type = ESP_CMD_SEND;
+	entry->link = link;
+	return OK;
+}
+
+// like ESP8266_QueueCommand, the parts and their data must stay valid until the callback is called
+static Response_t ESP8266_QueueParts(const ESP8266_Part_t* parts, uint8_t count, const char* expected,
+		uint32_t timeout, ESP8266_Callback_t callback, void* context)
+{
+	if (parts == NULL || count == 0) return NULVAL;
+	ESP_Command_t* entry = ESP8266_QueueAdd();
+	if (entry == NULL) return ERR;
+
+	entry->data = parts;
+	entry->expected = expected;
+	entry->callback = callback;
+	entry->context = context;
+	entry->timeout = timeout;
+	entry->size = count;
+	entry->type = ESP_CMD_PARTS;
+	return OK;
+}
+
+static void ESP8266_StoreResult(Response_t result, void* context)
+{
+	*(Response_t*)context = result;
+}
+
+// queues the command after the ones already queued and waits for its result. a WiFi join in the queue can take
+// WIFI_JOIN_TIMEOUT, the caller gets BUSY instead of waiting for it
+static Response_t ESP8266_RunCommand(const char* cmd, size_t size, const char* expected, uint32_t timeout)
+{
+	if (wifi_health.joining) return BUSY;
+	Response_t result = WAITING;
+	while (ESP8266_QueueCommand(cmd, size, expected, timeout, ESP8266_StoreResult, &result) != OK)
+		ESP8266_Idle();
+	while (result == WAITING)
+		ESP8266_Idle();
+	return result;
+}
+
+static Response_t ESP8266_RunSend(uint8_t link, const ESP8266_Part_t* parts, uint8_t count, uint32_t timeout)
+{
+	if (wifi_health.joining) return BUSY;
+	Response_t result = WAITING;
+	Response_t queued;
+	while ((queued = ESP8266_QueueSend(link, parts, count, timeout, ESP8266_StoreResult, &result)) != OK)
+	{
+		if (queued == NULVAL || !ESP8266_IsBusy()) return queued;
+		ESP8266_Idle();
+	}
+	while (result == WAITING)
+		ESP8266_Idle();
+	return result;
 }
 
 HAL_StatusTypeDef ESP8266_SendATCommandNoResponse(char* cmd, size_t size, uint32_t timeout)
 {
 	if (cmd == NULL) return HAL_ERROR;
-	return HAL_UART_Transmit(&STM_UART, (uint8_t*)cmd, size, UART_TX_TIMEOUT);
+	return (ESP8266_RunCommand(cmd, size, NULL, 0) == OK) ? HAL_OK : HAL_ERROR;
 }
 
 Response_t ESP8266_SendATCommandResponse(char* cmd, size_t size, uint32_t timeout)
 {
 	if (cmd == NULL) return NULVAL;
-	ESP8266_ClearBuffer();
-	if (HAL_UART_Transmit(&STM_UART, (uint8_t*)cmd, size, UART_TX_TIMEOUT) != HAL_OK)
-		return ERR;
-	return ESP8266_WaitForString("OK", timeout);
+	Response_t resp = ESP8266_RunCommand(cmd, size, "OK", timeout);
+	if (resp != TIMEOUT)
+		ESP8266_ClearBuffer();
+	return resp;
 }
 
 Response_t ESP8266_SendATCommandKeepString(char* cmd, size_t size, uint32_t timeout)
 {
 	if (cmd == NULL) return NULVAL;
-	ESP8266_ClearBuffer();
-	if (HAL_UART_Transmit(&STM_UART, (uint8_t*)cmd, size, UART_TX_TIMEOUT) != HAL_OK)
-		return ERR;
-	Response_t resp = ESP8266_WaitKeepString("OK", timeout);
-	if (resp != ERR && resp != TIMEOUT)
-		return OK;
-	return resp;
+	return ESP8266_RunCommand(cmd, size, "OK", timeout);
 }
 
 Response_t ESP8266_SendATCommandKeepStringNoResponse(char* cmd, size_t size)
 {
 	if (cmd == NULL) return NULVAL;
-	ESP8266_ClearBuffer();
-	if (HAL_UART_Transmit(&STM_UART, (uint8_t*)cmd, size, UART_TX_TIMEOUT) != HAL_OK)
-		return ERR;
-	return OK;
+	return ESP8266_RunCommand(cmd, size, NULL, 0);
 }
-
 Response_t ESP8266_CheckAT(void)
 {
 	return ESP8266_SendATCommandResponse("AT\r\n", 4, AT_SHORT_TIMEOUT);
@@ -186,25 +990,26 @@ Response_t ESP8266_CheckAT(void)
 
 Response_t ESP8266_Init(void)
 {
-	ESP8266_ClearBuffer();
 	HAL_UARTEx_ReceiveToIdle_DMA(&STM_UART, (uint8_t*)uart_buffer, UART_BUFFER_SIZE);
-	return ESP8266_ResetWaitReady();
+	// line errors (i.e. the ESP boot messages at 74880 baud) must not abort the reception, the parser
+	// starts again from the next line
+	ATOMIC_CLEAR_BIT(STM_UART.Instance->CR3, USART_CR3_EIE);
+	// the ESP is reset by ESP8266_ResetWaitReady only if WIFI_WarmStart can't reuse it
+	return OK;
 }
 
 void ESP8266_ClearBuffer(void)
 {
-	__HAL_DMA_DISABLE(STM_UART.hdmarx);
-	memset((char*)uart_buffer, 0, UART_BUFFER_SIZE + 1 - UART_DMA_CHANNEL->CNDTR);
-	UART_DMA_CHANNEL->CNDTR = UART_BUFFER_SIZE;		// reset CNDTR so DMA starts writing from index 0
+	// the DMA keeps running: the bytes received until now are parsed and left behind, the data of a
+	// +CIPRECVDATA being received is still skipped
+	__disable_irq();
+	ESP8266_RxEvent(false);
+	esp_rx.response_start = esp_rx.received;
+	esp_rx.events = 0;
+	__enable_irq();
 	__HAL_UART_CLEAR_OREFLAG(&STM_UART);
     __HAL_UART_CLEAR_NEFLAG(&STM_UART);
     __HAL_UART_CLEAR_FEFLAG(&STM_UART);
-	__HAL_DMA_ENABLE(STM_UART.hdmarx);
-}
-
-char* ESP8266_GetBuffer(void)
-{
-	return (char*)uart_buffer;
 }
 
 void ESP8266_Reset(void)
@@ -224,10 +1029,50 @@ Response_t WIFI_StartServer(WIFI_t* wifi, uint16_t port)
 	*/
 	WIFI_SetCWMODE(1);
 	WIFI_SetCIPMUX(1);
+	// the data of the clients is pulled by WIFI_ReceiveRequest
+	WIFI_SetCIPRECVMODE(1);
+	// the maximum number of connections can only be changed while the server is off
+	WIFI_SetCIPSERVERMAXCONN(WIFI_MAX_LINKS);
 	WIFI_SetCIPSERVER(port);
+	WIFI_SetCIPSTO(LINK_IDLE_TIMEOUT_S);
+	boot_stats.network_ms = uwTick;
 	return atstatus;
 }
 
+Response_t WIFI_WarmStart(WIFI_t* wifi, uint16_t port)
+{
+	if (wifi == NULL) return NULVAL;
+
+	// an AT+CIPSEND interrupted by the reset can take the first AT as its data
+	if (ESP8266_CheckAT() != OK && ESP8266_CheckAT() != OK) return ERR;
+	if (WIFI_GetConnectionInfo(wifi) != OK) return ERR;
+
+	// +CIPSERVER:1,34677,"TCP",0
+	// the firmwares without the query answer ERROR, they are reset
+	if (ESP8266_SendATCommandKeepString("AT+CIPSERVER?\r\n", 15, AT_SHORT_TIMEOUT) != OK) return ERR;
+	char line[RESPONSE_LINE_MAX_SIZE];
+	if (ESP8266_GetResponseLine("+CIPSERVER:1,", line, sizeof(line)) == NULL) return ERR;
+	uint32_t port_size = 0;
+	while (line[CIPSERVER_PORT_OFFSET + port_size] >= '0' && line[CIPSERVER_PORT_OFFSET + port_size] <= '9')
+		port_size++;
+	if (bufferToInt(line + CIPSERVER_PORT_OFFSET, port_size) != port) return ERR;
+
+	// the data of the links opened before the reset is lost, their clients will connect again
+	ESP8266_SendATCommandResponse("AT+CIPCLOSE=5\r\n", 15, AT_SHORT_TIMEOUT);
+	WIFI_SetCIPRECVMODE(1);
+	WIFI_SetCIPSTO(LINK_IDLE_TIMEOUT_S);
+
+	boot_stats.warm = true;
+	boot_stats.network_ms = uwTick;
+	return OK;
+}
+
+void WIFI_GetBootStats(WIFI_BootStats_t* stats)
+{
+	if (stats == NULL) return;
+	*stats = boot_stats;
+}
+
 Response_t ESP8266_ResetWaitReady(void)
 {
 	uint8_t attempt_number = 0;
@@ -280,26 +1125,28 @@ Response_t WIFI_GetIP(WIFI_t* wifi)
 	Response_t atstatus = ESP8266_SendATCommandKeepString("AT+CIFSR\r\n", 10, AT_SHORT_TIMEOUT);
 	if (atstatus != OK) return atstatus;
 
-	//ptr = strstr((char*)uart_buffer, "+CIFSR:STAIP");
+	char line[RESPONSE_LINE_MAX_SIZE];
+	if (ESP8266_GetResponseLine("+CIFSR:STAIP", line, sizeof(line)) == NULL) return ERR;
+
 	//				v
 	// +CIFSR:STAIP,"nnn.nnn.nnn.nnn"\r\n
-	char* ptr = strstr((char*)uart_buffer, "\"");
+	char* ptr = strstr(line, "\"");
 	if (ptr == NULL) return ERR;
 
-	uint32_t IP_start_index = (ptr + 1) - uart_buffer;
+	uint32_t IP_start_index = (ptr + 1) - line;
 
 	//								v
 	// +CIFSR:STAIP,"nnn.nnn.nnn.nnn"\r\n
-	ptr = strstr((char*)uart_buffer, "\"\r\n");
+	ptr = strstr(line, "\"\r\n");
 	if (ptr == NULL) return ERR;
 
-	uint32_t IP_end_index = (ptr - 1) - uart_buffer;
+	uint32_t IP_end_index = (ptr - 1) - line;
 	if (IP_end_index < IP_start_index) return ERR;
 
 	uint32_t IP_size = IP_end_index - IP_start_index + 1;
-	if (IP_size > WIFI_BUF_MAX_SIZE) return ERR;
+	if (IP_size > sizeof(wifi->IP) - 1) return ERR;
 
-	memcpy(wifi->IP, (char*)uart_buffer + IP_start_index, IP_size);
+	memcpy(wifi->IP, line + IP_start_index, IP_size);
 	return OK;
 }
 
@@ -309,7 +1156,8 @@ Response_t WIFI_GetConnectionInfo(WIFI_t* wifi)
 	if (ESP8266_SendATCommandKeepString("AT+CWSTATE?\r\n", 13, AT_SHORT_TIMEOUT) != OK)
 		return ERR;
 	
-	char* ptr = strstr((char*)uart_buffer, "+CWSTATE:");
+	char line[RESPONSE_LINE_MAX_SIZE];
+	char* ptr = ESP8266_GetResponseLine("+CWSTATE:", line, sizeof(line));
 	if (ptr == NULL) return ERR;	// unknown response
 
 	if (*(ptr + CWSTATE_STATE_OFFSET) - '0' != CWSTATE_CONNECTED_WITHIP)
@@ -317,7 +1165,7 @@ Response_t WIFI_GetConnectionInfo(WIFI_t* wifi)
 
 	//			   v
 	// +CWSTATE:x,"xxxxxxxxxxxx"\r\n
-	uint32_t SSID_start_index = (ptr + CWSTATE_SSID_OFFSET) - uart_buffer;
+	uint32_t SSID_start_index = (ptr + CWSTATE_SSID_OFFSET) - line;
 
 	// get ESP SSID
 	// response structure:
@@ -325,16 +1173,16 @@ Response_t WIFI_GetConnectionInfo(WIFI_t* wifi)
 
 	//					   	   v
 	// +CWSTATE:x,"xxxxxxxxxxxx"\r\n
-	ptr = strstr((char*)uart_buffer, "\"\r\n");	// ptr -1 is the end index of the SSID
+	ptr = strstr(line, "\"\r\n");	// ptr -1 is the end index of the SSID
 	if (ptr == NULL) return ERR;
 
-	uint32_t SSID_end_index = (ptr - 1) - uart_buffer;
+	uint32_t SSID_end_index = (ptr - 1) - line;
 	if (SSID_end_index < SSID_start_index) return ERR;
 
 	uint32_t SSID_size = SSID_end_index - SSID_start_index + 1;
 	if (SSID_size > sizeof(wifi->SSID)) return ERR;
 
-	memcpy(wifi->SSID, (char*)uart_buffer + SSID_start_index, SSID_size);
+	memcpy(wifi->SSID, line + SSID_start_index, SSID_size);
 
 	if (WIFI_GetIP(wifi) != OK) return ERR;
 
@@ -350,7 +1198,8 @@ Response_t WIFI_Connect(WIFI_t* wifi)
 
 	// response: AT+CWSTATE?\r\n+CWSTATE:0,""\r\n
 
-	char *ptr = strstr((char*)uart_buffer, "+CWSTATE:");
+	char line[RESPONSE_LINE_MAX_SIZE];
+	char *ptr = ESP8266_GetResponseLine("+CWSTATE:", line, sizeof(line));
 	if (!ptr) return ERR;
 
 	int state = *(ptr + CWSTATE_IP_OFFSET) - '0';
@@ -421,6 +1270,108 @@ Response_t WIFI_Connect(WIFI_t* wifi)
 	return ERR;
 }
 
+/*
+ * WiFi supervisor
+ *
+ * the parser follows the association from the "WIFI GOT IP" and "WIFI DISCONNECT" lines, which the ESP sends
+ * at any time. while offline, WIFI_Supervise queues an AT+CWJAP and keeps going: the attempts are spaced by
+ * a backoff doubled at every failure, from WIFI_BACKOFF_MIN_MS to WIFI_BACKOFF_MAX_MS. if the ESP reconnects
+ * by itself, its "WIFI GOT IP" ends the outage as well.
+ */
+static const char CWJAP_START[] = "AT+CWJAP=\"";
+static const char CWJAP_SEPARATOR[] = "\",\"";
+static const char CWJAP_END[] = "\"\r\n";
+
+static void WIFI_JoinDone(Response_t result, void* context)
+{
+	wifi_health.joining = false;
+	if (result == OK && wifi_health.online) return;
+
+	wifi_health.backoff = (wifi_health.backoff < WIFI_BACKOFF_MAX_MS / 2) ? wifi_health.backoff * 2
+			: WIFI_BACKOFF_MAX_MS;
+	wifi_health.next_attempt = uwTick + wifi_health.backoff;
+}
+
+void WIFI_StartSupervisor(WIFI_t* wifi, bool online)
+{
+	if (wifi == NULL) return;
+
+	wifi_health.join[0] = (ESP8266_Part_t){ (const uint8_t*)CWJAP_START, sizeof(CWJAP_START) - 1 };
+	wifi_health.join[1] = (ESP8266_Part_t){ (const uint8_t*)wifi->SSID, strlen(wifi->SSID) };
+	wifi_health.join[2] = (ESP8266_Part_t){ (const uint8_t*)CWJAP_SEPARATOR, sizeof(CWJAP_SEPARATOR) - 1 };
+	wifi_health.join[3] = (ESP8266_Part_t){ (const uint8_t*)wifi->pw, strlen(wifi->pw) };
+	wifi_health.join[4] = (ESP8266_Part_t){ (const uint8_t*)CWJAP_END, sizeof(CWJAP_END) - 1 };
+
+	wifi_health.online = online;
+	wifi_health.handled_online = online;
+	wifi_health.changed_at = uwTick;
+	wifi_health.offline_since = uwTick;
+	wifi_health.backoff = WIFI_BACKOFF_MIN_MS;
+	wifi_health.next_attempt = uwTick;
+	wifi_health.started = true;
+}
+
+bool WIFI_Supervise(void)
+{
+	if (!wifi_health.started) return false;
+
+	bool reconnected = false;
+	__disable_irq();
+	bool online = wifi_health.online;
+	uint32_t changed_at = wifi_health.changed_at;
+	__enable_irq();
+
+	// "WIFI GOT IP" comes before the OK of an AT+CWJAP: the connection is back when the ESP is free again
+	if (online != wifi_health.handled_online && !(online && wifi_health.joining))
+	{
+		wifi_health.handled_online = online;
+		wifi_health.backoff = WIFI_BACKOFF_MIN_MS;
+		if (online)
+		{
+			wifi_health.downtime += changed_at - wifi_health.offline_since;
+			wifi_health.reconnects++;
+			reconnected = true;
+		}
+		else
+		{
+			// the ESP may reconnect by itself in the meantime
+			wifi_health.offline_since = changed_at;
+			wifi_health.next_attempt = uwTick + WIFI_BACKOFF_MIN_MS;
+		}
+	}
+
+	if (!online && !wifi_health.joining && (int32_t)(uwTick - wifi_health.next_attempt) >= 0)
+	{
+		if (ESP8266_QueueParts(wifi_health.join, 5, "OK", WIFI_JOIN_TIMEOUT, WIFI_JoinDone, NULL) == OK)
+		{
+			wifi_health.joining = true;
+			wifi_health.attempts++;
+		}
+	}
+
+	return reconnected;
+}
+
+bool WIFI_IsOnline(void)
+{
+	return wifi_health.online;
+}
+
+void WIFI_GetHealthStats(WIFI_HealthStats_t* stats)
+{
+	if (stats == NULL) return;
+	stats->online = wifi_health.handled_online;
+	stats->reconnects = wifi_health.reconnects;
+	stats->attempts = wifi_health.attempts;
+	stats->downtime_ms = wifi_health.downtime;
+	if (!wifi_health.handled_online)
+		stats->downtime_ms += uwTick - wifi_health.offline_since;
+	stats->next_attempt_ms = 0;
+	if (!wifi_health.handled_online && !wifi_health.joining
+			&& (int32_t)(wifi_health.next_attempt - uwTick) > 0)
+		stats->next_attempt_ms = wifi_health.next_attempt - uwTick;
+}
+
 Response_t WIFI_SetCWMODE(uint8_t mode)
 {
 	if (mode > 3) return ERR;
@@ -453,6 +1404,33 @@ Response_t WIFI_SetCIPSERVER(uint16_t server_port)
 	return ESP8266_SendATCommandResponse(cipserver, strlen(cipserver), AT_SHORT_TIMEOUT);
 }
 
+Response_t WIFI_SetCIPSERVERMAXCONN(uint8_t max_links)
+{
+	if (max_links < 1 || max_links > 5) return ERR;
+
+	char maxconn[CIPSERVERMAXCONN_MAX_SIZE];
+	int size = snprintf(maxconn, CIPSERVERMAXCONN_MAX_SIZE, "AT+CIPSERVERMAXCONN=%d\r\n", max_links);
+	return ESP8266_SendATCommandResponse(maxconn, size, AT_SHORT_TIMEOUT);
+}
+
+Response_t WIFI_SetCIPRECVMODE(uint8_t mode)
+{
+	if (mode > 1) return ERR;
+
+	char recvmode[CIPRECVMODE_MAX_SIZE];
+	int size = snprintf(recvmode, CIPRECVMODE_MAX_SIZE, "AT+CIPRECVMODE=%d\r\n", mode);
+	return ESP8266_SendATCommandResponse(recvmode, size, AT_SHORT_TIMEOUT);
+}
+
+Response_t WIFI_SetCIPSTO(uint16_t timeout_s)
+{
+	if (timeout_s > 7200) return ERR;
+
+	char cipsto[CIPSTO_MAX_SIZE];
+	int size = snprintf(cipsto, CIPSTO_MAX_SIZE, "AT+CIPSTO=%d\r\n", timeout_s);
+	return ESP8266_SendATCommandResponse(cipsto, size, AT_SHORT_TIMEOUT);
+}
+
 Response_t WIFI_SetHostname(WIFI_t* wifi, const char* hostname)
 {
 	if (wifi == NULL || hostname == NULL) return NULVAL;
@@ -478,7 +1456,8 @@ Response_t WIFI_GetHostname(WIFI_t* wifi)
 	if (atstatus != OK) return atstatus;
 
 	// +CWHOSTNAME:ESP-A0ADE6
-	char* ptr = strstr((char*)uart_buffer, "+CWHOSTNAME:");
+	char line[RESPONSE_LINE_MAX_SIZE];
+	char* ptr = ESP8266_GetResponseLine("+CWHOSTNAME:", line, sizeof(line));
 	if (ptr == NULL) return ERR;
 	//			   v
 	// +CWHOSTNAME:ESP-A0ADE6\r\n
@@ -533,143 +1512,381 @@ Response_t WIFI_SetIP(WIFI_t* wifi, char* ip)
 	return atstatus;
 }
 
-Response_t WIFI_ReceiveRequest(WIFI_t* wifi, Connection_t* conn, uint32_t timeout)
+Response_t WIFI_CloseLink(uint8_t link)
 {
-	if (wifi == NULL || conn == NULL) return NULVAL;
+	if (link >= WIFI_MAX_LINKS) return ERR;
+	char cipclose[CIPCLOSE_MAX_SIZE];
+	int size = snprintf(cipclose, CIPCLOSE_MAX_SIZE, "AT+CIPCLOSE=%d\r\n", link);
+	return ESP8266_SendATCommandResponse(cipclose, size, AT_SHORT_TIMEOUT);
+}
 
-	conn->wifi = wifi;
-	char* ptr = NULL;
-	char* ipd_ptr = NULL;
+/*
+Chooses the link to serve: the one with the rest of a request already in conn->carry, otherwise the first link
+after the one served last with data at the ESP. A link whose data waited more than LINK_REQUEST_TIMEOUT_MS is
+closed, its client already gave up. Returns -1 if no link has data.
+*/
+static int32_t ESP8266_TakeLink(Connection_t* conn)
+{
+	if (conn->carry_size > 0)
+	{
+		ESP_Link_t* link = &esp_links[conn->carry_link];
+		if (link->open && link->connects == conn->carry_connects)
+			return conn->carry_link;
+		conn->carry_size = 0;
+	}
 
-	uint32_t start_time = uwTick;
 	while (1)
 	{
-		if (uwTick - start_time > timeout) return TIMEOUT;
-
-		if (uart_buffer[0] == '\0')
+		int32_t link = -1;
+		bool expired = false;
+		__disable_irq();
+		for (uint32_t i = 1; i <= WIFI_MAX_LINKS; i++)
 		{
-			/**
-			 * the buffer could have been cleared after the first DMA read. if this happens,
-			 * the first item of the DMA buffer will be 0x00. if this is so, check for an incoming
-			 * connection from the second element
-			 */
-			if ((ipd_ptr = strstr((char*)uart_buffer + 1, "+IPD,")) != NULL) break;
+			uint8_t next = (esp_last_link + i) % WIFI_MAX_LINKS;
+			if (esp_links[next].available == 0) continue;
+			link = next;
+			expired = uwTick - esp_links[next].waiting_since > LINK_REQUEST_TIMEOUT_MS;
+			if (expired)
+			{
+				esp_expired++;
+				ESP8266_SetLink(next, false);
+			}
+			break;
 		}
-		else
+		__enable_irq();
+
+		if (!expired) return link;
+		WIFI_CloseLink(link);
+	}
+}
+
+/*
+Pulls at most size bytes (up to RECV_CHUNK_SIZE) of the data the ESP keeps for the link. Returns the bytes
+copied in dst, 0 if there is no data, -1 if the ESP doesn't answer or the data was overwritten in the ring.
+*/
+static int32_t ESP8266_ReceiveData(uint8_t link, char* dst, uint32_t size)
+{
+	if (size > RECV_CHUNK_SIZE) size = RECV_CHUNK_SIZE;
+	char cmd[CIPRECVDATA_MAX_SIZE];
+	int cmd_len = snprintf(cmd, CIPRECVDATA_MAX_SIZE, "AT+CIPRECVDATA=%d,%" PRIu32 "\r\n", link, size);
+	esp_rx.data_size = 0;
+	Response_t resp = ESP8266_SendATCommandKeepString(cmd, cmd_len, AT_SHORT_TIMEOUT);
+	if (resp == TIMEOUT) return -1;
+
+	// without data the ESP answers ERROR
+	uint32_t received = (resp == OK && esp_rx.data_size <= size) ? esp_rx.data_size : 0;
+	if (received > 0 && !ESP8266_ReadRing(esp_rx.data_start, dst, received)) return -1;
+
+	__disable_irq();
+	ESP_Link_t* esp_link = &esp_links[link];
+	esp_link->available = (received < size || esp_link->available <= received) ? 0 : esp_link->available - received;
+	esp_link->waiting_since = uwTick;
+	__enable_irq();
+	return received;
+}
+
+/*
+Size of the request line and the headers, with the empty line that ends them, 0 if they're not all received
+yet. A request line without " HTTP/" (i.e. "GET ?xxxxxxxxxx\r\n") has no headers.
+*/
+static uint32_t WIFI_GetHeadSize(const char* head, uint32_t size)
+{
+	const char* line_end = memchr(head, '\n', size);
+	if (line_end == NULL) return 0;
+
+	bool http = false;
+	for (const char* c = head; c + 6 <= line_end && !http; c++)
+		http = (memcmp(c, " HTTP/", 6) == 0);
+	if (!http) return line_end + 1 - head;
+
+	for (uint32_t i = line_end - head + 1; i < size; i++)
+	{
+		// "\r\n\r\n" or "\n\n"
+		if (head[i] == '\n' && (head[i - 1] == '\n' || (head[i - 1] == '\r' && head[i - 2] == '\n')))
+			return i + 1;
+	}
+	return 0;
+}
+
+// value of the Content-Length header, 0 if there is none
+// value of the header name ("Name:", any case) in the head of the request, NULL if it's not there
+static const char* WIFI_GetHeader(const char* head, const char* name)
+{
+	size_t name_size = strlen(name);
+	const char* line = strchr(head, '\n');
+	while (line != NULL)
+	{
+		line++;
+		if (strncasecmp(line, name, name_size) == 0)
 		{
-			/**
-			 * if the first element of the buffer is not 0x00, check for an incoming connection
-			 * from the start
-			 */
-			if ((ipd_ptr = strstr((char*)uart_buffer, "+IPD,")) != NULL) break;
+			const char* value = line + name_size;
+			while (*value == ' ') value++;
+			return value;
 		}
+		line = strchr(line, '\n');
 	}
+	return NULL;
+}
 
-	/**
-	 * wait to receive the connection number n and message size m
-	 * 		   v
-	 * +IPD,n,m:xxxxxxxxxx
-	 */
-	start_time = uwTick;
-	while ((ptr = strstr(ipd_ptr, ":")) == NULL)
+static uint32_t WIFI_GetContentLength(const char* head)
+{
+	const char* value = WIFI_GetHeader(head, "Content-Length:");
+	if (value == NULL) return 0;
+	uint32_t value_size = 0;
+	while (value[value_size] >= '0' && value[value_size] <= '9') value_size++;
+	int32_t length = bufferToInt((char*)value, value_size);
+	return (length > 0) ? length : 0;
+}
+
+int32_t WIFI_ReadBody(Connection_t* conn, char* dst, uint32_t size)
+{
+	if (conn == NULL || dst == NULL) return -1;
+	if (size > conn->body_size) size = conn->body_size;
+	if (size == 0) return 0;
+
+	uint8_t link = conn->connection_number;
+	if (conn->carry_size > 0 && conn->carry_link == link)
 	{
-		if (uwTick - start_time > timeout) return TIMEOUT;
-		__asm__("nop");
+		// received together with the headers
+		uint32_t taken = (size < conn->carry_size) ? size : conn->carry_size;
+		memcpy(dst, conn->carry, taken);
+		conn->carry_size -= taken;
+		memmove(conn->carry, conn->carry + taken, conn->carry_size);
+		conn->body_size -= taken;
+		return taken;
+	}
+
+	uint32_t start_time = uwTick;
+	while (1)
+	{
+		int32_t received = ESP8266_ReceiveData(link, dst, size);
+		if (received != 0)
+		{
+			if (received > 0) conn->body_size -= received;
+			return received;
+		}
+
+		// the client didn't send the rest yet
+		while (esp_links[link].available == 0)
+		{
+			if (!esp_links[link].open || uwTick - start_time > LINK_REQUEST_TIMEOUT_MS) return -1;
+			ESP8266_Idle();
+		}
 	}
+}
 
-	uint32_t expected_size = 0;
-	//		  v-->v
-	// +IPD,n,xxxxx:xxxxxxxxxx
-	char* expected_size_end_p = ptr;
-	uint8_t num_size = expected_size_end_p - (ipd_ptr + 7);
-	expected_size = bufferToInt(ipd_ptr + 7, num_size);
+Response_t WIFI_ParseBody(Connection_t* conn, WIFI_BodyCallback_t callback, void* context)
+{
+	if (conn == NULL || conn->wifi == NULL || callback == NULL) return NULVAL;
 
-	start_time = uwTick;
-	uint32_t string_len = 0;
-	while (string_len < expected_size)
+	char key[BODY_KEY_MAX_SIZE + 1];
+	char value[BODY_VALUE_MAX_SIZE + 1];
+	uint32_t key_size = 0;
+	uint32_t value_size = 0;
+	bool in_value = false;
+	char* chunk = conn->wifi->buf;
+
+	while (1)
 	{
-		// wait until the expected number of bytes m is received
-		if (uwTick - start_time > timeout) return TIMEOUT;
-		string_len = strlen(ptr + 1);
-		if (/*string_len > expected_size || */ptr + 1 - uart_buffer + string_len >= UART_BUFFER_SIZE - 1)
+		int32_t chunk_size = (conn->body_size > 0) ? WIFI_ReadBody(conn, chunk, RECV_CHUNK_SIZE) : 0;
+		if (chunk_size < 0) return TIMEOUT;
+
+		// a pair can continue in the next chunk, the end of the body ends the last one
+		for (int32_t i = 0; i < chunk_size || (chunk_size == 0 && i == 0); i++)
 		{
-			/**
-			 * if more bytes are received than the expected or the buffer is full,
-			 * clear the buffer and return an error
-			 */
-			ESP8266_ClearBuffer();
-			return ERR;
+			char c = (chunk_size > 0) ? chunk[i] : '&';
+			if (c == '&' || c == '\n' || c == '\r')
+			{
+				if (key_size > 0)
+				{
+					key[key_size] = '\0';
+					value[value_size] = '\0';
+					Response_t status = callback(key, value, context);
+					if (status != OK) return status;
+				}
+				key_size = 0;
+				value_size = 0;
+				in_value = false;
+			}
+			else if (c == '=' && !in_value)
+				in_value = true;
+			else if (in_value)
+			{
+				if (value_size == BODY_VALUE_MAX_SIZE) return ERR;
+				value[value_size++] = c;
+			}
+			else
+			{
+				if (key_size == BODY_KEY_MAX_SIZE) return ERR;
+				key[key_size++] = c;
+			}
 		}
+		if (chunk_size == 0) return OK;
 	}
+}
 
-	//		v
-	// +IPD,n,m:xxxxxxxxxx
-	conn->connection_number = *(ipd_ptr + 5) - '0';
+// the body the handler didn't read is dropped, so that the next request starts after it
+static void WIFI_SkipBody(Connection_t* conn)
+{
+	while (conn->body_size > 0)
+	{
+		if (WIFI_ReadBody(conn, conn->wifi->buf, RECV_CHUNK_SIZE) <= 0)
+		{
+			conn->body_size = 0;
+			conn->carry_size = 0;
+		}
+	}
+}
 
-	//		   v
-	// +IPD,n,m:xxxxxxxxxx
-	ptr = strstr((char*)uart_buffer, ":");
-	if (ptr == NULL) return ERR;
+void WIFI_GetLinkStats(WIFI_LinkStats_t* stats)
+{
+	if (stats == NULL) return;
+	stats->open = 0;
+	stats->waiting = 0;
+	__disable_irq();
+	for (uint32_t i = 0; i < WIFI_MAX_LINKS; i++)
+	{
+		if (esp_links[i].open) stats->open |= 1 << i;
+		if (esp_links[i].available > 0) stats->waiting++;
+	}
+	stats->expired = esp_expired;
+	__enable_irq();
+}
 
-	//			v
-	// +IPD,n,m:GET ?xxxxxxxxxx
-	// +IPD,n,m:POST ?xxxxxxxxxx
-	conn->request_type = *(ptr + 1);
+Response_t WIFI_ReceiveRequest(WIFI_t* wifi, Connection_t* conn, uint32_t timeout)
+{
+	if (wifi == NULL || conn == NULL) return NULVAL;
 
-	//				v
-	// +IPD,n,m:GET ?xxxxxxxxxx
-	ptr = strstr((char*)uart_buffer, "?");
-	if (ptr == NULL)
+	if (conn->wifi != NULL)
+		WIFI_SkipBody(conn);
+	conn->wifi = wifi;
+
+	// the queued AT commands keep being sent while waiting
+	uint32_t start_time = uwTick;
+	int32_t link;
+	while (1)
 	{
-		//				v
-		// +IPD,n,m:GET /xxxxxxxxxx
-		ptr = strstr((char*)uart_buffer, "/");
-		if (ptr == NULL) return ERR;
+		uint32_t activity = ESP8266_GetActivity();
+		// the links are read with AT+CIPRECVDATA, which would be BUSY during a WiFi join
+		if (!wifi_health.joining && (link = ESP8266_TakeLink(conn)) >= 0) break;
+		if (uwTick - start_time > timeout) return TIMEOUT;
+		if (!ESP8266_Process())
+			ESP8266_Sleep(activity);
 	}
 
-	//				 v
-	// +IPD,n,m:GET ?xxxxxxxxxx
-	uint32_t request_body_start_index = (ptr + 1) - uart_buffer;
+	esp_last_link = link;
+	conn->connection_number = link;
+	conn->body_size = 0;
+	conn->framing = FRAMING_LEGACY;
+	conn->keep_alive = true;
+
+	// the request line and the headers are read in wifi->buf, starting with what was left by the last request
+	// of the link. what follows them (the body or the next request) is kept in conn->carry
+	// GET ?xxxxxxxxxx HTTP/1.1\r\n
+	char* payload = wifi->buf;
+	uint32_t payload_size = 0;
+	if (conn->carry_size > 0)
+	{
+		memcpy(payload, conn->carry, conn->carry_size);
+		payload_size = conn->carry_size;
+		conn->carry_size = 0;
+	}
 
-	// get the request size
-	uint32_t request_size;
-	ptr = strstr((char*)uart_buffer, " HTTP");
-	if (ptr == NULL)
+	uint32_t head_size;
+	while ((head_size = WIFI_GetHeadSize(payload, payload_size)) == 0)
 	{
-		// if there is no HTTP/x.x use the message size m (at ptr + 7)
-		// +IPD,n,m:GET ?xxxxxxxxxx
-		request_size = expected_size;
-		uint32_t request_start_index;
-		if ((ptr = strstr((char*)uart_buffer, ":")) == NULL) return ERR;
-		// this removes the "POST " (or "GET ") part
-		// get the size of the message received until "POST ", then remove
-		// the size of "+IPD,n,m:" to get the size of "POST "
-		request_start_index = ptr - uart_buffer;
-		request_size = request_size - (request_body_start_index - request_start_index) + 1 - 2; // the -2 removes \r\n
+		if (payload_size == WIFI_BUF_MAX_SIZE) return ERR;
+		int32_t received = ESP8266_ReceiveData(link, payload + payload_size, WIFI_BUF_MAX_SIZE - payload_size);
+		if (received < 0) return ERR;
+		if (received == 0)
+		{
+			// the request is all the client sent
+			head_size = payload_size;
+			break;
+		}
+		payload_size += received;
 	}
-	else
+	if (payload_size == 0) return TIMEOUT;
+
+	// at most one chunk (or the carry itself) is left after the headers
+	if (payload_size - head_size > RECV_CHUNK_SIZE) return ERR;
+	conn->carry_size = payload_size - head_size;
+	conn->carry_link = link;
+	conn->carry_connects = esp_links[link].connects;
+	memcpy(conn->carry, payload + head_size, conn->carry_size);
+	payload[head_size] = '\0';
+
+	conn->body_size = WIFI_GetContentLength(payload);
+
+	char* line_end = strstr(payload, "\r\n");
+	if (line_end == NULL) line_end = strchr(payload, '\n');
+	if (line_end == NULL) line_end = payload + head_size;
+
+#ifdef ENABLE_HTTP_RESPONSES
+	// GET ?xxxxxxxxxx HTTP/1.1
+	// HTTP/1.1 keeps the link alive unless the client closes it, HTTP/1.0 only if the client asks for it
+	char* version = strstr(payload, " HTTP/1.");
+	if (version != NULL && version < line_end)
+	{
+		conn->framing = (version[8] == '0') ? FRAMING_HTTP10 : FRAMING_HTTP11;
+		const char* connection = WIFI_GetHeader(payload, "Connection:");
+		if (conn->framing == FRAMING_HTTP10)
+			conn->keep_alive = connection != NULL && strncasecmp(connection, "keep-alive", 10) == 0;
+		else
+			conn->keep_alive = connection == NULL || strncasecmp(connection, "close", 5) != 0;
+	}
+#endif
+	*line_end = '\0';
+
+	//	v
+	// GET ?xxxxxxxxxx
+	// POST ?xxxxxxxxxx
+	conn->request_type = payload[0];
+
+	//	   v
+	// GET ?xxxxxxxxxx
+	char* ptr = strstr(payload, "?");
+	if (ptr == NULL)
 	{
-		// otherwise get this length
-		// 				 v -----> v
-		// +IPD,n,m:GET ?xxxxxxxxxx HTTP....
-		uint32_t request_end_index = (ptr - 1) - uart_buffer;
-		if (request_end_index < request_body_start_index) return ERR;
-		request_size = request_end_index - request_body_start_index + 1;
+		//	   v
+		// GET /xxxxxxxxxx
+		ptr = strstr(payload, "/");
+		if (ptr == NULL) return ERR;
 	}
+
+	//		v
+	// GET ?xxxxxxxxxx HTTP....
+	char* request_start_p = ptr + 1;
+
+	// if there is no HTTP/x.x the request ends with the line
+	//		v ----> v
+	// GET ?xxxxxxxxxx HTTP....
+	char* request_end_p = strstr(request_start_p, " HTTP");
+	if (request_end_p == NULL) request_end_p = line_end;
+
+	uint32_t request_size = request_end_p - request_start_p;
 	if (request_size > REQUEST_MAX_SIZE) return ERR;
 	conn->request_size = request_size;
 
 	memset(conn->request, 0, REQUEST_MAX_SIZE);
-	memcpy(conn->request, (char*)uart_buffer + request_body_start_index, request_size);
-	ESP8266_ClearBuffer();
+	memcpy(conn->request, request_start_p, request_size);
 	return OK;
 }
 
+// the client closed the link with the request (Connection: close), what it sent after it is dropped
+static Response_t WIFI_FinishResponse(Connection_t* conn, Response_t status)
+{
+	if (conn->keep_alive) return status;
+	conn->body_size = 0;
+	conn->carry_size = 0;
+	WIFI_CloseLink(conn->connection_number);
+	return status;
+}
+
 Response_t WIFI_SendResponse(Connection_t* conn, char* status_code, char* body, uint32_t body_length)
 {
     if (conn == NULL || status_code == NULL) return NULVAL;
 
-    // Formato stimato: "STATUS\nBODY\r\n"
     size_t status_len = strlen(status_code);
     
     // total length
@@ -678,40 +1895,128 @@ Response_t WIFI_SendResponse(Connection_t* conn, char* status_code, char* body,
 
     if (total_packet_len > RESPONSE_MAX_SIZE) return ERR;
 
-    int cmd_len = snprintf(conn->response_buffer, RESPONSE_MAX_SIZE, 
-                           "AT+CIPSEND=%d,%" PRIu32 "\r\n", 
-                           conn->connection_number, total_packet_len);
-                           
-    ESP8266_SendATCommandKeepString(conn->response_buffer, cmd_len, 500);
-
-    if (ESP8266_WaitForString(">", 200) == TIMEOUT) 
+    Response_t status;
+    if (conn->framing != FRAMING_LEGACY)
+    {
+        // "HTTP/1.1 STATUS\r\nheaders\r\n\r\nBODY"
+        char content_length[CONTENT_LENGTH_MAX_SIZE];
+        int content_length_len = snprintf(content_length, CONTENT_LENGTH_MAX_SIZE, "%" PRIu32,
+                (body != NULL) ? body_length : 0);
+        const char* connection = conn->keep_alive ? HTTP_KEEP_ALIVE : HTTP_CLOSE;
+        ESP8266_Part_t parts[] =
+        {
+            { (uint8_t*)"HTTP/1.1 ", 9 },
+            { (uint8_t*)status_code, status_len },
+            { (uint8_t*)HTTP_CONTENT_TYPE, sizeof(HTTP_CONTENT_TYPE) - 1 },
+            { (uint8_t*)"\r\nContent-Length: ", 18 },
+            { (uint8_t*)content_length, content_length_len },
+            { (uint8_t*)connection, strlen(connection) },
+            { (uint8_t*)body, (body != NULL) ? body_length : 0 },
+        };
+        status = ESP8266_RunSend(conn->connection_number, parts, 7, AT_LONG_TIMEOUT);
+    }
+    else
     {
-        // if no '>' is received, maybe there is no connection or the ESP is busy
-		// cannot send data
-        return TIMEOUT;
+        // "STATUS\nBODY\r\n"
+        ESP8266_Part_t parts[] =
+        {
+            { (uint8_t*)status_code, status_len },
+            { (uint8_t*)"\n", 1 },
+            { (uint8_t*)body, (body != NULL) ? body_length : 0 },
+            { (uint8_t*)"\r\n", 2 },
+        };
+        status = ESP8266_RunSend(conn->connection_number, parts, 4, AT_LONG_TIMEOUT);
     }
+    if (status != OK) return status;
+    WIFI_SetResponseSent();
+    return WIFI_FinishResponse(conn, status);
+}
 
-    // copy status code + \n
-    memcpy(conn->response_buffer, status_code, status_len);
-    conn->response_buffer[status_len] = '\n';
-    
-    // copy body if it exists
-    if (body != NULL && body_length > 0)
-        memcpy(conn->response_buffer + status_len + 1, body, body_length);
-    
-    // add \r\n to the end
-    // start + status + \n + body
-    uint32_t crlf_pos = status_len + 1 + body_length;
-    conn->response_buffer[crlf_pos] = '\r';
-    conn->response_buffer[crlf_pos + 1] = '\n';
+Response_t WIFI_SendStream(Connection_t* conn, char* status_code, WIFI_Generator_t generator, void* context)
+{
+	if (conn == NULL || conn->wifi == NULL || status_code == NULL || generator == NULL) return NULVAL;
 
-    HAL_UART_Transmit(&STM_UART, (uint8_t*)conn->response_buffer, total_packet_len, UART_TX_TIMEOUT);
+	// HTTP/1.0 has no chunked encoding, the end of the body is the end of the link
+	bool chunked = conn->framing == FRAMING_HTTP11;
+	if (conn->framing == FRAMING_HTTP10)
+		conn->keep_alive = false;
 
-    if (ESP8266_WaitForString("SEND OK", AT_LONG_TIMEOUT) == TIMEOUT)
-        return ERR;
+	// the status and the headers are sent with the first segment
+	ESP8266_Part_t parts[8];
+	uint8_t count = 0;
+	if (conn->framing != FRAMING_LEGACY)
+	{
+		parts[count++] = (ESP8266_Part_t){ (uint8_t*)"HTTP/1.1 ", 9 };
+		parts[count++] = (ESP8266_Part_t){ (uint8_t*)status_code, strlen(status_code) };
+		parts[count++] = (ESP8266_Part_t){ (uint8_t*)HTTP_CONTENT_TYPE, sizeof(HTTP_CONTENT_TYPE) - 1 };
+		if (chunked)
+			parts[count++] = (ESP8266_Part_t){ (uint8_t*)HTTP_CHUNKED, sizeof(HTTP_CHUNKED) - 1 };
+		const char* connection = conn->keep_alive ? HTTP_KEEP_ALIVE : HTTP_CLOSE;
+		parts[count++] = (ESP8266_Part_t){ (uint8_t*)connection, strlen(connection) };
+	}
+	else
+	{
+		parts[count++] = (ESP8266_Part_t){ (uint8_t*)status_code, strlen(status_code) };
+		parts[count++] = (ESP8266_Part_t){ (uint8_t*)"\n", 1 };
+	}
+
+	char* segment = conn->wifi->buf;
+	char chunk_size[CHUNK_SIZE_MAX_SIZE];
+	bool sent = false;
+	Response_t status = OK;
+	while (status == OK)
+	{
+		int32_t size = generator(segment, WIFI_BUF_MAX_SIZE, context);
+		if (size < 0 || size > WIFI_BUF_MAX_SIZE)
+		{
+			status = ERR;
+			break;
+		}
+
+		if (size > 0)
+		{
+			// <size in hex>\r\n<data>\r\n
+			if (chunked)
+			{
+				int chunk_size_len = snprintf(chunk_size, CHUNK_SIZE_MAX_SIZE, "%" PRIx32 "\r\n", (uint32_t)size);
+				parts[count++] = (ESP8266_Part_t){ (uint8_t*)chunk_size, chunk_size_len };
+			}
+			parts[count++] = (ESP8266_Part_t){ (uint8_t*)segment, size };
+			if (chunked)
+				parts[count++] = (ESP8266_Part_t){ (uint8_t*)"\r\n", 2 };
+		}
+		else if (chunked)
+			parts[count++] = (ESP8266_Part_t){ (uint8_t*)"0\r\n\r\n", 5 };
+		else if (conn->framing == FRAMING_LEGACY)
+			parts[count++] = (ESP8266_Part_t){ (uint8_t*)"\r\n", 2 };
 
-    WIFI_response_sent = true;
-    return OK;
+		if (count > 0)
+		{
+			status = ESP8266_RunSend(conn->connection_number, parts, count, AT_LONG_TIMEOUT);
+			sent = true;
+			count = 0;
+		}
+		if (size == 0) break;
+	}
+
+	if (sent)
+		WIFI_SetResponseSent();
+	if (status != OK && sent)
+		conn->keep_alive = false;
+	return WIFI_FinishResponse(conn, status);
+}
+
+Response_t WIFI_SendData(Connection_t* conn, const uint8_t* data, uint32_t size)
+{
+	if (conn == NULL || data == NULL) return NULVAL;
+	if (size == 0 || size > CIPSEND_MAX_SIZE) return ERR;
+
+	// the data is sent from where it is, the caller must not change it until this returns
+	ESP8266_Part_t part = { data, size };
+	Response_t status = ESP8266_RunSend(conn->connection_number, &part, 1, AT_LONG_TIMEOUT);
+	if (status == OK)
+		WIFI_SetResponseSent();
+	return status;
 }
 
 void WIFI_ResetConnectionIfError(WIFI_t* wifi, Connection_t* conn, Response_t wifistatus)
@@ -763,7 +2068,8 @@ Response_t WIFI_GetTime(WIFI_t* wifi)
     if (ESP8266_WaitKeepString("OK\r\n", AT_MEDIUM_TIMEOUT) != OK)
         return ERR;
 
-    char* tag_ptr = strstr((char*)uart_buffer, "+CIPSNTPTIME:");
+    char line[RESPONSE_LINE_MAX_SIZE];
+    char* tag_ptr = ESP8266_GetResponseLine("+CIPSNTPTIME:", line, sizeof(line));
     if (tag_ptr)
     {
         char* colon = strstr(tag_ptr + 13, ":");
@@ -819,8 +2125,9 @@ Response_t WIFI_EnableNTPServer(WIFI_t* wifi, int8_t time_offset)
 	Response_t atstatus = ERR;
 	if ((atstatus = ESP8266_SendATCommandKeepString("AT+CIPSNTPCFG?\r\n", 16, AT_SHORT_TIMEOUT)) != OK) return atstatus;
 
+	char line[RESPONSE_LINE_MAX_SIZE];
 	char* ptr = NULL;
-	if ((ptr = strstr((char*)uart_buffer, "+CIPSNTPCFG:")) != NULL)
+	if ((ptr = ESP8266_GetResponseLine("+CIPSNTPCFG:", line, sizeof(line))) != NULL)
 	{
 		uint8_t ntp_enabled = *(ptr + 12) - '0';
 		if (ntp_enabled)
@@ -20,6 +20,13 @@ typedef enum
 	POST 		= 'P'
 } Request_t;
 
+typedef enum
+{
+	FRAMING_LEGACY	= 0,	// "STATUS\nBODY\r\n", parsed by the Android app
+	FRAMING_HTTP10	= 1,	// HTTP/1.1 status line, headers and Content-Length to an HTTP/1.0 client
+	FRAMING_HTTP11	= 2,	// same, streamed bodies can use the chunked transfer encoding
+} Framing_t;
+
 typedef enum
 {
 	ERR 		= 0,
@@ -28,6 +35,7 @@ typedef enum
 	NULVAL		= 3,
 	WAITING		= 4,
 	FAIL		= 5,
+	BUSY		= 6,	// not sent, an AT+CWJAP of WIFI_Supervise holds the ESP
 } Response_t;
 
 typedef struct
@@ -49,23 +57,143 @@ typedef struct
  	Request_t	request_type;
 	char		request[REQUEST_MAX_SIZE + 1];
 	uint32_t	request_size;
-	char		response_buffer[RESPONSE_MAX_SIZE + 1];
+	uint32_t	body_size;		// bytes of the body (Content-Length) not read yet, see WIFI_ReadBody
+	char		carry[RECV_CHUNK_SIZE];		// received after the headers: the body or the next request
+	uint16_t	carry_size;
+	uint8_t		carry_link;
+	uint8_t		carry_connects;
+	Framing_t	framing;		// of the responses to the request
+	bool		keep_alive;		// false: the link is closed after the response (Connection: close)
 } Connection_t;
 
+// called by WIFI_ParseBody for every key=value pair, any result but OK stops the parsing
+typedef Response_t (*WIFI_BodyCallback_t)(const char* key, const char* value, void* context);
+
+// called by WIFI_SendStream to write the next part of the body in buf (at most size bytes). returns the bytes
+// written, 0 at the end of the body, -1 if the body can't be completed
+typedef int32_t (*WIFI_Generator_t)(char* buf, uint32_t size, void* context);
+
+typedef struct
+{
+	uint32_t	commands;		// AT commands sent waiting for a response
+	uint32_t	timeouts;
+	uint32_t	last_us;		// from the start of the transmission to the end of the response
+	uint32_t	max_us;
+	uint64_t	total_us;		// of the commands which didn't time out
+} ESP8266_Latency_t;
+
+typedef struct
+{
+	uint32_t	received;		// bytes received from the ESP
+	uint32_t	wraps;			// of the DMA around uart_buffer
+	uint32_t	overruns;		// data overwritten before being read or parsed, or +IPD dropped
+} ESP8266_RxStats_t;
+
+typedef struct
+{
+	uint32_t	responses;		// AT+CIPSEND sent
+	uint32_t	last_cpu_us;	// CPU time spent transmitting the AT+CIPSEND and its data
+	uint32_t	max_cpu_us;
+	uint64_t	total_cpu_us;
+} ESP8266_TxStats_t;
+
+typedef struct
+{
+	uint8_t		open;			// bit n is set if link n has a client
+	uint8_t		waiting;		// links with data at the ESP not read yet
+	uint32_t	expired;		// links closed because their data waited more than LINK_REQUEST_TIMEOUT_MS
+} WIFI_LinkStats_t;
+
+typedef struct
+{
+	bool		warm;				// the ESP was already connected and serving, it wasn't reset
+	uint32_t	network_ms;			// from the boot to the server ready
+	uint32_t	first_response_ms;	// from the boot to the first response sent, 0 until then
+} WIFI_BootStats_t;
+
+typedef struct
+{
+	bool		online;				// associated with an IP
+	uint32_t	reconnects;			// outages ended since the boot
+	uint32_t	attempts;			// AT+CWJAP sent by WIFI_Supervise
+	uint32_t	downtime_ms;		// offline since the boot, the current outage included
+	uint32_t	next_attempt_ms;	// until the next AT+CWJAP, 0 if online or if one is running
+} WIFI_HealthStats_t;
+
+// called with the result of a queued command, from ESP8266_Process
+typedef void (*ESP8266_Callback_t)(Response_t result, void* context);
+
+typedef struct
+{
+	const uint8_t*	data;
+	uint32_t		size;
+} ESP8266_Part_t;
+
 int32_t bufferToInt(char* buf, uint32_t size);
 
 Response_t ESP8266_Init(void);
 void ESP8266_ClearBuffer(void);
-char* ESP8266_GetBuffer(void);
 void ESP8266_HardwareReset(void);
 Response_t ESP8266_ATReset(void);
 Response_t ESP8266_CheckAT(void);
 Response_t ESP8266_Restore(void);
 
+/*
+Parses the bytes received by the DMA since the last call. Must be called from HAL_UARTEx_RxEventCallback,
+boundary is true for the half and full buffer events (not for the idle line): they tell when the DMA
+went around uart_buffer before the parser could read it (see ESP8266_RxStats_t.overruns).
+*/
+void ESP8266_RxEvent(bool boundary);
+
+/*
+Starts the DMA transmission of the next part. Must be called from HAL_UART_TxCpltCallback.
+*/
+void ESP8266_TxEvent(void);
+void ESP8266_GetLatency(ESP8266_Latency_t* latency);
+void ESP8266_GetRxStats(ESP8266_RxStats_t* stats);
+void ESP8266_GetTxStats(ESP8266_TxStats_t* stats);
+
+/*
+The Wait functions return as soon as a whole line equal to str is received (a trailing "\r\n" in str is
+ignored, '>' is matched without it). An "ERROR" line returns ERR, a "FAIL" line returns FAIL
+(except for ESP8266_WaitForStringCNDTROffset). ESP8266_WaitKeepString doesn't clear the buffer.
+ESP8266_ClearBuffer doesn't stop the reception: it only drops the lines received until now, so that the
+next response starts after them.
+They must be used only while no command is queued (i.e. at startup).
+*/
 Response_t ESP8266_WaitForStringCNDTROffset(char* str, int32_t offset, uint32_t timeout);
 Response_t ESP8266_WaitForString(char* str, uint32_t timeout);
 Response_t ESP8266_WaitKeepString(char* str, uint32_t timeout);
 
+/*
+Queues an AT command. It's sent when the commands queued before it are done, then the command is done when
+a line equal to expected (see the Wait functions), "ERROR" or "FAIL" is received, or after timeout ms.
+If expected is NULL, it's done as soon as it's transmitted. The callback (can be NULL) gets OK, ERR, FAIL or
+TIMEOUT; its response can be read until the next command starts. cmd must stay valid until then.
+Returns ERR if the queue is full (ESP_QUEUE_SIZE).
+*/
+Response_t ESP8266_QueueCommand(const char* cmd, uint16_t size, const char* expected, uint32_t timeout,
+		ESP8266_Callback_t callback, void* context);
+
+/*
+Queues an AT+CIPSEND of all the parts (at most CIPSEND_MAX_SIZE bytes in total) to the link: the parts are
+sent one after the other after '>', then "SEND OK" is waited for timeout ms. The parts and their data must
+stay valid until the callback is called.
+*/
+Response_t ESP8266_QueueSend(uint8_t link, const ESP8266_Part_t* parts, uint8_t count, uint32_t timeout,
+		ESP8266_Callback_t callback, void* context);
+
+/*
+Moves the queued commands forward without blocking, must be called from the main loop. Returns true if
+something was done (a command was sent or finished).
+*/
+bool ESP8266_Process(void);
+bool ESP8266_IsBusy(void);
+
+/*
+The blocking functions queue their command and wait for it to be done, the main loop stops meanwhile (the
+interrupts keep running). They must not be called from a callback.
+*/
 HAL_StatusTypeDef ESP8266_SendATCommandNoResponse(char* cmd, size_t size, uint32_t timeout);
 Response_t ESP8266_SendATCommandResponse(char* cmd, size_t size, uint32_t timeout);
 Response_t ESP8266_SendATCommandKeepString(char* cmd, size_t size, uint32_t timeout);
@@ -79,9 +207,35 @@ Note that this is a blocking function: if not connected to WiFi, it blocks until
 */
 Response_t WIFI_Connect(WIFI_t* wifi);
 Response_t WIFI_GetConnectionInfo(WIFI_t* wifi);
+
+/*
+Keeps the WiFi connection up without blocking: WIFI_Supervise must be called from the main loop, it follows
+the association from the lines of the ESP and, while offline, queues an AT+CWJAP with the SSID and password
+of wifi (which must stay valid) with a backoff from WIFI_BACKOFF_MIN_MS to WIFI_BACKOFF_MAX_MS. online is the
+state left by the boot. WIFI_Supervise returns true when the connection has just come back and the AT+CWJAP
+is done. while it runs (up to WIFI_JOIN_TIMEOUT) the blocking functions above return BUSY at once instead of
+waiting behind it, and WIFI_ReceiveRequest doesn't take requests.
+*/
+void WIFI_StartSupervisor(WIFI_t* wifi, bool online);
+bool WIFI_Supervise(void);
+bool WIFI_IsOnline(void);
+void WIFI_GetHealthStats(WIFI_HealthStats_t* stats);
 Response_t WIFI_SetCWMODE(uint8_t mode);
 Response_t WIFI_SetCIPMUX(uint8_t mux);
 Response_t WIFI_SetCIPSERVER(uint16_t server_port);
+Response_t WIFI_SetCIPSERVERMAXCONN(uint8_t max_links);
+Response_t WIFI_SetCIPRECVMODE(uint8_t mode);
+Response_t WIFI_SetCIPSTO(uint16_t timeout_s);
+Response_t WIFI_CloseLink(uint8_t link);
+void WIFI_GetLinkStats(WIFI_LinkStats_t* stats);
+
+/*
+Reuses the ESP as it was left before a reset of the STM32 alone (brownout, watchdog): if it answers, is
+connected with an IP and its server is running on port, the connection info is read in wifi and the links
+opened before the reset are closed. Returns OK if the ESP can be used without resetting and configuring it.
+*/
+Response_t WIFI_WarmStart(WIFI_t* wifi, uint16_t port);
+void WIFI_GetBootStats(WIFI_BootStats_t* stats);
 Response_t WIFI_SetHostname(WIFI_t* wifi, const char* hostname);
 Response_t WIFI_GetHostname(WIFI_t* wifi);
 Response_t WIFI_SetName(WIFI_t* wifi, char* name);
@@ -93,8 +247,48 @@ int32_t WIFI_GetTimeHour(WIFI_t* wifi);
 int32_t WIFI_GetTimeMinutes(WIFI_t* wifi);
 int32_t WIFI_GetTimeSeconds(WIFI_t* wifi);
 
+/*
+Waits at most timeout ms for a request and parses it in conn, which then holds the link to answer to. The
+requests of different links are taken in turn (see esp_links in esp8266.c).
+*/
 Response_t WIFI_ReceiveRequest(WIFI_t* wifi, Connection_t* conn, uint32_t timeout);
+
+/*
+Reads at most size bytes of the body of the request in conn. Returns the bytes read, 0 at the end of the body,
+-1 if the client doesn't send it within LINK_REQUEST_TIMEOUT_MS. The body not read by the handler is dropped
+by the next WIFI_ReceiveRequest.
+*/
+int32_t WIFI_ReadBody(Connection_t* conn, char* dst, uint32_t size);
+
+/*
+Reads the body as key=value pairs, separated by '&' or new lines (not URL-decoded), and calls callback with
+every pair. The body is read RECV_CHUNK_SIZE bytes at a time in wifi->buf, so it can be larger than any buffer.
+Returns ERR if a key or a value is too long, TIMEOUT if the body is not received, the result of the callback
+if it's not OK.
+*/
+Response_t WIFI_ParseBody(Connection_t* conn, WIFI_BodyCallback_t callback, void* context);
+
+/*
+Sends the response with the framing of the request: "HTTP/1.1 status_code", the headers and body_length bytes
+of body to the HTTP/1.x requests (if ENABLE_HTTP_RESPONSES), "status_code\nbody\r\n" to the others. The link
+is closed after it if the client doesn't keep it alive.
+*/
 Response_t WIFI_SendResponse(Connection_t* conn, char* status_code, char* body, uint32_t body_length);
+
+/*
+Sends a response of any length, larger than RESPONSE_MAX_SIZE: generator fills wifi->buf one segment
+(WIFI_BUF_MAX_SIZE bytes) at a time and every segment is sent with its own AT+CIPSEND as soon as it's written.
+HTTP/1.1 bodies use the chunked transfer encoding, so the link is kept alive; HTTP/1.0 bodies end with the link,
+the legacy frame with "\r\n". If the generator fails after the first segment the link is closed, so that the
+client doesn't take the truncated body for a whole one.
+*/
+Response_t WIFI_SendStream(Connection_t* conn, char* status_code, WIFI_Generator_t generator, void* context);
+
+/*
+Sends size bytes (at most CIPSEND_MAX_SIZE) to the connection with a single AT+CIPSEND, straight from
+data, without any framing.
+*/
+Response_t WIFI_SendData(Connection_t* conn, const uint8_t* data, uint32_t size);
 Response_t WIFI_EnableNTPServer(WIFI_t* wifi, int8_t time_offset);
 void WIFI_ResetComm(WIFI_t* wifi, Connection_t* conn);
 char* WIFI_RequestHasKey(Connection_t* conn, char* desired_key);
@@ -6,8 +6,14 @@
  */
 
 #include "flash.h"
+#include "../Sensor/sensor.h"
+#include "../Sensor/calibration.h"
+#include "../Sensor/alarm.h"
 #include <string.h>
 
+// the calibration tables follow SaveData_t in the last page
+#define CALDATA_OFFSET ((sizeof(SaveData_t) + FLASH_DATASIZE - 1) / FLASH_DATASIZE * FLASH_DATASIZE)
+
 SaveData_t savedata;
 
 void FLASH_EraseLastPage()
@@ -21,7 +27,7 @@ void FLASH_EraseLastPage()
 	HAL_FLASHEx_Erase(&erase_structure, &page_error);
 }
 
-void FLASH_WriteBuffer(uint8_t* buf, uint32_t size)
+void FLASH_WriteBuffer(uint32_t offset, uint8_t* buf, uint32_t size)
 {
 	uint32_t total_flash_data_blocks = size / FLASH_DATASIZE;
 	if (size % FLASH_DATASIZE != 0)
@@ -31,19 +37,25 @@ void FLASH_WriteBuffer(uint8_t* buf, uint32_t size)
 
 	for (uint32_t flash_data_i = 0; flash_data_i < total_flash_data_blocks; flash_data_i++)
 	{
-		for (uint8_t byte_i = flash_data_i * FLASH_DATASIZE; byte_i < flash_data_i * FLASH_DATASIZE + FLASH_DATASIZE; byte_i++)
+		for (uint32_t byte_i = flash_data_i * FLASH_DATASIZE; byte_i < flash_data_i * FLASH_DATASIZE + FLASH_DATASIZE; byte_i++)
 			flash_data[byte_i % FLASH_DATASIZE] = (byte_i < size) ? *(buf + byte_i) : 0x00;
 
 		FLASH_DATATYPE serialized_flash_data = *((FLASH_DATATYPE*)flash_data);
-		HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, LAST_PAGE_ADDRESS + flash_data_i * FLASH_DATASIZE, serialized_flash_data);
+		HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, LAST_PAGE_ADDRESS + offset + flash_data_i * FLASH_DATASIZE,
+				serialized_flash_data);
 	}
 }
 
 void FLASH_WriteSaveData()
 {
+	savedata.energy = SENS_GetEnergy();	// the energy register keeps running, always save the latest value
+	savedata.alarm_magic = ALARMDATA_MAGIC;
+	savedata.alarm_current = ALARM_GetThreshold(ALARM_CURRENT);
+	savedata.alarm_voltage = ALARM_GetThreshold(ALARM_VOLTAGE);
 	HAL_FLASH_Unlock();
 	FLASH_EraseLastPage();
-	FLASH_WriteBuffer((uint8_t*)&savedata, sizeof(SaveData_t));
+	FLASH_WriteBuffer(0, (uint8_t*)&savedata, sizeof(SaveData_t));
+	FLASH_WriteBuffer(CALDATA_OFFSET, (uint8_t*)CAL_GetData(), sizeof(CAL_Data_t));
 	HAL_FLASH_Lock();
 }
 
@@ -51,5 +63,6 @@ void FLASH_ReadSaveData()
 {
 	uint32_t read_addr = LAST_PAGE_ADDRESS;
 	memcpy(&savedata, ((SaveData_t*)read_addr), sizeof(SaveData_t));
+	CAL_Load((CAL_Data_t*)(read_addr + CALDATA_OFFSET));
 }
 
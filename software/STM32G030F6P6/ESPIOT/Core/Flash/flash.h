@@ -12,7 +12,7 @@
 #include "../settings.h"
 
 void FLASH_EraseLastPage();
-void FLASH_WriteBuffer(uint8_t* buf, uint32_t size);
+void FLASH_WriteBuffer(uint32_t offset, uint8_t* buf, uint32_t size);	// offset from LAST_PAGE_ADDRESS
 void FLASH_WriteSaveData();
 void FLASH_ReadSaveData();
 
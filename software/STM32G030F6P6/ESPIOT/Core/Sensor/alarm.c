@@ -0,0 +1,275 @@
+/*
+ * alarm.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#include "alarm.h"
+#include "sensor.h"
+#include "fixedpoint.h"
+#include "adc.h"
+#include "tim.h"
+#include <string.h>
+
+typedef struct
+{
+	uint32_t		threshold;		// mA or V (RMS)
+	uint32_t		counts;			// peak of the threshold, ADC counts from offset
+	uint32_t		gain;			// uA or mV per ADC count (Q16)
+	uint32_t		offset;			// ADC counts, the watchdog window is centered here
+	uint32_t		peak;			// ADC counts from offset
+	uint32_t		last_over;		// uwTick of the last DMA callback with a sample over the threshold
+	ALARM_Alarm_t	alarm;			// peak is only filled by ALARM_Get
+} ALARM_Channel_t;
+
+static ALARM_Channel_t channels[ALARM_TYPES] =
+{
+	{ ALARM_CURRENT_DEFAULT },
+	{ ALARM_VOLTAGE_DEFAULT },
+};
+
+static volatile bool any_active = false;
+static volatile uint32_t started = 0;	// (1 << type) of the alarms not yet returned by ALARM_Update
+static bool changed = false;
+static uint32_t offset_tick = 0;	// uwTick of the last update for an offset drift
+
+static uint32_t ALARM_GetShift(void)
+{
+	// with oversampling the watchdogs compare bits [15:4] of the data register, the result is 12 bit
+	return (hadc1.Init.OversamplingMode == ENABLE) ? 4 : 0;
+}
+
+// gain and counts of the threshold, the calibration and the current offset can change over time
+static void ALARM_Compute(uint32_t type)
+{
+	ALARM_Channel_t* c = &channels[type];
+
+	if (type == ALARM_CURRENT)
+	{
+		c->gain = SENS_GetCurrentSampleGain(c->threshold);
+		c->offset = SENS_GetCurrentOffset();
+	}
+	else
+	{
+		c->gain = SENS_GetVoltageSampleGain(c->threshold);
+		c->offset = 0;
+	}
+
+	// peak of a sine with the threshold as RMS value, in uA (mV)
+	uint64_t peak = ((uint64_t)c->threshold * 1000 * FIX_Q(1.41421356, 16)) >> 16;
+	c->counts = (c->gain > 0) ? (peak << 16) / c->gain : 0;
+}
+
+static void ALARM_GetRegisters(uint32_t type, uint32_t* low, uint32_t* high)
+{
+	ALARM_Channel_t* c = &channels[type];
+	uint32_t shift = ALARM_GetShift();
+
+	*low = 0;
+	*high = 0xFFF;
+	if (c->threshold == 0) return;
+
+	// the register values are compared with the result >> shift: round both outwards
+	if (c->offset + c->counts < 4096)
+		*high = (c->offset + c->counts) >> shift;
+	if (type == ALARM_CURRENT && c->offset > c->counts)
+		*low = (c->offset - c->counts + (1 << shift) - 1) >> shift;
+}
+
+static uint32_t ALARM_GetDeviation(uint32_t type, uint32_t sample)
+{
+	uint32_t offset = channels[type].offset;
+	if (type == ALARM_VOLTAGE) return sample;
+	return (sample > offset) ? sample - offset : offset - sample;
+}
+
+// must be called with the interrupts disabled
+static void ALARM_EnableInterrupt(uint32_t type, bool enable)
+{
+	if (type == ALARM_CURRENT)
+	{
+		LL_ADC_ClearFlag_AWD1(hadc1.Instance);
+		if (enable) LL_ADC_EnableIT_AWD1(hadc1.Instance);
+		else LL_ADC_DisableIT_AWD1(hadc1.Instance);
+	}
+	else
+	{
+		LL_ADC_ClearFlag_AWD2(hadc1.Instance);
+		if (enable) LL_ADC_EnableIT_AWD2(hadc1.Instance);
+		else LL_ADC_DisableIT_AWD2(hadc1.Instance);
+	}
+}
+
+void ALARM_SetThreshold(uint32_t type, uint32_t threshold)
+{
+	if (type >= ALARM_TYPES) return;
+	channels[type].threshold = threshold;
+	changed = true;
+}
+
+uint32_t ALARM_GetThreshold(uint32_t type)
+{
+	if (type >= ALARM_TYPES) return 0;
+	return channels[type].threshold;
+}
+
+void ALARM_Configure(void)
+{
+	ADC_AnalogWDGConfTypeDef config = {0};
+	config.WatchdogMode = ADC_ANALOGWATCHDOG_SINGLE_REG;
+
+	for (uint32_t type = 0; type < ALARM_TYPES; type++)
+	{
+		ALARM_Compute(type);
+		config.WatchdogNumber = (type == ALARM_CURRENT) ? ADC_ANALOGWATCHDOG_1 : ADC_ANALOGWATCHDOG_2;
+		config.Channel = (type == ALARM_CURRENT) ? ADC_CHANNEL_4 : ADC_CHANNEL_5;
+		config.ITMode = (channels[type].threshold > 0 && !channels[type].alarm.active) ? ENABLE : DISABLE;
+		ALARM_GetRegisters(type, &config.LowThreshold, &config.HighThreshold);
+		HAL_ADC_AnalogWDGConfig(&hadc1, &config);
+	}
+	changed = false;
+}
+
+// the thresholds changed and the offset drift, see ALARM_Update
+static void ALARM_UpdateWatchdogs(void)
+{
+	// not started yet: SAMPLING_Configure will write everything
+	if (!LL_ADC_REG_IsConversionOngoing(hadc1.Instance)) return;
+
+	/*
+	 * the window is already rounded outwards by up to a step. the dead band of two steps and the interval
+	 * keep an offset that wanders around a step boundary from stopping the ADC over and over
+	 */
+	int32_t drift = (int32_t)SENS_GetCurrentOffset() - (int32_t)channels[ALARM_CURRENT].offset;
+	int32_t limit = 2 << ALARM_GetShift();
+	bool drifted = channels[ALARM_CURRENT].threshold > 0 && (drift >= limit || drift <= -limit)
+			&& uwTick - offset_tick >= ALARM_OFFSET_INTERVAL_MS;
+	if (!changed && !drifted)
+		return;
+
+	/*
+	 * the thresholds can only be written with no conversion ongoing. TIM3 is stopped and the ADC is
+	 * stopped between two scans, so the DMA keeps its position in adc_buf and the pairs stay aligned.
+	 * the measurements only lose about 1 ms of samples
+	 */
+	HAL_TIM_Base_Stop(&htim3);
+	HAL_Delay(1);		// the longest scan (precision profile) takes 864 us
+	LL_ADC_REG_StopConversion(hadc1.Instance);
+	while (LL_ADC_REG_IsStopConversionOngoing(hadc1.Instance));
+
+	for (uint32_t type = 0; type < ALARM_TYPES; type++)
+	{
+		uint32_t low, high;
+		ALARM_Compute(type);
+		ALARM_GetRegisters(type, &low, &high);
+		LL_ADC_ConfigAnalogWDThresholds(hadc1.Instance, (type == ALARM_CURRENT) ? LL_ADC_AWD1 : LL_ADC_AWD2,
+				high, low);
+		__disable_irq();
+		ALARM_EnableInterrupt(type, channels[type].threshold > 0 && !channels[type].alarm.active);
+		__enable_irq();
+	}
+	changed = false;
+	offset_tick = uwTick;
+
+	LL_ADC_REG_StartConversion(hadc1.Instance);
+	HAL_TIM_Base_Start(&htim3);
+}
+
+uint32_t ALARM_Update(void)
+{
+	__disable_irq();
+	uint32_t alarms = started;
+	started = 0;
+	__enable_irq();
+
+	ALARM_UpdateWatchdogs();
+	return alarms;
+}
+
+void ALARM_Trigger(uint32_t type)
+{
+	if (type >= ALARM_TYPES) return;
+	ALARM_Channel_t* c = &channels[type];
+
+	// masked until the alarm ends, the watchdog fires on every sample over the threshold
+	ALARM_EnableInterrupt(type, false);
+
+	// the watchdog interrupt preempts the DMA callbacks, so the data register still holds the sample
+	c->peak = ALARM_GetDeviation(type, LL_ADC_REG_ReadConversionData12(hadc1.Instance));
+	c->alarm.tick = uwTick;
+	c->alarm.duration = 0;
+	c->alarm.count++;
+	c->alarm.active = true;
+	c->last_over = uwTick;
+	any_active = true;
+	started |= 1 << type;
+}
+
+void ALARM_ProcessSamples(const uint16_t* buf, uint32_t len)
+{
+	if (!any_active) return;
+
+	for (uint32_t type = 0; type < ALARM_TYPES; type++)
+	{
+		ALARM_Channel_t* c = &channels[type];
+		// the interrupt of this channel is masked while the alarm is active, nothing else writes it
+		if (!c->alarm.active) continue;
+
+		bool over = false;
+		uint32_t index = (type == ALARM_CURRENT) ? SENS_CURRENT_OFFSET : SENS_VOLTAGE_OFFSET;
+		for (uint32_t i = index; i < len; i += 2)
+		{
+			uint32_t deviation = ALARM_GetDeviation(type, buf[i]);
+			if (deviation > c->peak)
+				c->peak = deviation;
+			if (deviation > c->counts)
+				over = true;
+		}
+
+		if (over)
+			c->last_over = uwTick;
+		else if (uwTick - c->last_over >= ALARM_REARM_MS)
+		{
+			c->alarm.duration = c->last_over - c->alarm.tick;
+			c->alarm.active = false;
+			ALARM_EnableInterrupt(type, c->threshold > 0);
+		}
+	}
+
+	__disable_irq();
+	any_active = channels[ALARM_CURRENT].alarm.active || channels[ALARM_VOLTAGE].alarm.active;
+	__enable_irq();
+}
+
+bool ALARM_Get(uint32_t type, ALARM_Alarm_t* alarm)
+{
+	if (type >= ALARM_TYPES || alarm == NULL) return false;
+	ALARM_Channel_t* c = &channels[type];
+
+	__disable_irq();
+	*alarm = c->alarm;
+	uint32_t peak = c->peak;
+	__enable_irq();
+
+	// uA (mV) -> mA (V)
+	alarm->peak = (((uint64_t)peak * c->gain) >> 16) / 1000;
+	return alarm->count > 0;
+}
+
+void ALARM_Clear(void)
+{
+	__disable_irq();
+	for (uint32_t type = 0; type < ALARM_TYPES; type++)
+	{
+		// an active alarm is kept, it's still going on
+		if (channels[type].alarm.active)
+			channels[type].alarm.count = 1;
+		else
+		{
+			memset(&channels[type].alarm, 0, sizeof(ALARM_Alarm_t));
+			channels[type].peak = 0;
+		}
+	}
+	__enable_irq();
+}
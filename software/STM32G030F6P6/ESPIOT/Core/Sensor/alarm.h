@@ -0,0 +1,59 @@
+/*
+ * alarm.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#ifndef SENSOR_ALARM_H_
+#define SENSOR_ALARM_H_
+
+#include "stm32g0xx_hal.h"
+#include "../settings.h"
+
+/**
+ * Overcurrent and overvoltage alarms from the analog watchdogs of the ADC: AWD1 watches the
+ * current channel (a window around the offset), AWD2 the voltage channel. The hardware compares every
+ * sample, so nothing runs until a threshold is crossed. The interrupt latches the alarm and masks
+ * itself; the peak is then tracked on the DMA buffers and the watchdog is armed again after
+ * ALARM_REARM_MS below the threshold.
+ *
+ * The thresholds are the RMS values of a sine (the watchdogs compare its peak). With oversampling the
+ * watchdogs only compare the 8 most significant bits of the 12 bit result, so a threshold is rounded
+ * up to 16 ADC counts (~100 mA, ~13 V of peak).
+ */
+#define ALARM_CURRENT 0
+#define ALARM_VOLTAGE 1
+#define ALARM_TYPES 2
+
+typedef struct
+{
+	uint32_t	tick;		// uwTick of the first sample over the threshold
+	uint32_t	duration;	// ms over the threshold, set when the alarm ends
+	uint32_t	peak;		// highest sample, mA or V
+	uint32_t	count;		// alarms since the last ALARM_Clear
+	bool		active;
+} ALARM_Alarm_t;
+
+void ALARM_SetThreshold(uint32_t type, uint32_t threshold);		// mA or V, 0 disables the alarm
+uint32_t ALARM_GetThreshold(uint32_t type);
+
+// programs the watchdogs, called by SAMPLING_Configure with the ADC not converting
+void ALARM_Configure(void);
+
+/*
+Called from the top of the main loop, never while waiting for the ESP: it stops the ADC for about 1 ms.
+Writes the thresholds changed by ALARM_SetThreshold right away. The current window follows the offset
+when it has moved by two steps of the watchdog, at most every ALARM_OFFSET_INTERVAL_MS.
+Returns the alarms started since the last call ((1 << ALARM_CURRENT), (1 << ALARM_VOLTAGE)), to be notified
+from the main loop.
+*/
+uint32_t ALARM_Update(void);
+
+void ALARM_Trigger(uint32_t type);		// from the analog watchdog interrupts, only latches the alarm
+void ALARM_ProcessSamples(const uint16_t* buf, uint32_t len);		// from the ADC DMA callbacks
+
+bool ALARM_Get(uint32_t type, ALARM_Alarm_t* alarm);	// false if there has been no alarm
+void ALARM_Clear(void);
+
+#endif /* SENSOR_ALARM_H_ */
@@ -0,0 +1,141 @@
+/*
+ * calibration.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#include "calibration.h"
+#include "fixedpoint.h"
+#include <string.h>
+
+/*
+ * default tables, from CURRENT_CALIB_VALUE and VOLTAGE_CALIB_VALUE.
+ * the nominal current gain is the linear one of the ACS712 (adjust == 1.37 * 1.9145 = 2.62286).
+ * this particular sensor reads 2.09 / 2.62286 less under 0.6 A (amplitude under 0.25 V, that is
+ * 0.25 * 2.62286 A RMS with the nominal gain)
+ */
+#define CAL_CURRENT_LINEAR_UA ((uint32_t)(0.25 * 2.62286 * 1000000))
+#define CAL_CURRENT_SCALE_LOW FIX_Q(2.09 / 2.62286 * CURRENT_CALIB_VALUE, 16)
+#define CAL_CURRENT_SCALE_LINEAR FIX_Q(CURRENT_CALIB_VALUE, 16)
+
+#define CAL_DEFAULT_CURRENT { 3, 0, { { 0, CAL_CURRENT_SCALE_LOW }, { CAL_CURRENT_LINEAR_UA - 1, CAL_CURRENT_SCALE_LOW }, \
+		{ CAL_CURRENT_LINEAR_UA, CAL_CURRENT_SCALE_LINEAR } } }
+#define CAL_DEFAULT_VOLTAGE { 1, 0, { { 0, FIX_Q(VOLTAGE_CALIB_VALUE, 16) } } }
+
+static const CAL_Table_t default_tables[CAL_CHANNELS] = { CAL_DEFAULT_CURRENT, CAL_DEFAULT_VOLTAGE };
+static CAL_Data_t data = { CALDATA_MAGIC, 0, { CAL_DEFAULT_CURRENT, CAL_DEFAULT_VOLTAGE } };
+
+uint32_t CAL_Evaluate(uint32_t channel, uint32_t raw)
+{
+	if (channel >= CAL_CHANNELS) return 1 << 16;
+	const CAL_Table_t* table = &data.tables[channel];
+
+	if (table->count == 0) return 1 << 16;
+	if (raw <= table->points[0].raw) return table->points[0].scale;
+	if (raw >= table->points[table->count - 1].raw) return table->points[table->count - 1].scale;
+
+	// last point with points[low].raw <= raw, raw is between points[low] and points[low + 1]
+	uint32_t low = 0;
+	uint32_t high = table->count - 1;
+	while (high - low > 1)
+	{
+		uint32_t middle = (low + high) / 2;
+		if (table->points[middle].raw <= raw)
+			low = middle;
+		else
+			high = middle;
+	}
+
+	const CAL_Point_t* a = &table->points[low];
+	const CAL_Point_t* b = &table->points[high];
+	int64_t delta = (int64_t)b->scale - (int64_t)a->scale;
+	return a->scale + delta * (raw - a->raw) / (b->raw - a->raw);
+}
+
+bool CAL_AddPoint(uint32_t channel, uint32_t raw, uint32_t reference)
+{
+	if (channel >= CAL_CHANNELS || raw == 0) return false;
+
+	CAL_Table_t table = data.tables[channel];
+	CAL_Point_t point = { raw, ((uint64_t)reference << 16) / raw };
+
+	if (!table.recorded)
+	{
+		table.count = 0;
+		table.recorded = 1;
+	}
+
+	// replace a point close to this one, or the nearest one if the table is full
+	uint32_t nearest = table.count;
+	uint32_t nearest_distance = 0xFFFFFFFF;
+	for (uint32_t i = 0; i < table.count; i++)
+	{
+		uint32_t distance = (table.points[i].raw > raw) ? table.points[i].raw - raw : raw - table.points[i].raw;
+		if (distance < nearest_distance)
+		{
+			nearest = i;
+			nearest_distance = distance;
+		}
+	}
+	if (nearest < table.count && ((uint64_t)nearest_distance * 100 <= (uint64_t)raw * CAL_MERGE_PERCENT
+			|| table.count == CAL_MAX_POINTS))
+	{
+		// remove it, the new point is inserted below
+		memmove(&table.points[nearest], &table.points[nearest + 1], (table.count - nearest - 1) * sizeof(CAL_Point_t));
+		table.count--;
+	}
+
+	uint32_t i = table.count;
+	while (i > 0 && table.points[i - 1].raw > raw)
+	{
+		table.points[i] = table.points[i - 1];
+		i--;
+	}
+	table.points[i] = point;
+	table.count++;
+
+	// the table is read by the ADC DMA callbacks
+	__disable_irq();
+	data.tables[channel] = table;
+	__enable_irq();
+	return true;
+}
+
+void CAL_Reset(uint32_t channel)
+{
+	if (channel >= CAL_CHANNELS) return;
+	__disable_irq();
+	data.tables[channel] = default_tables[channel];
+	__enable_irq();
+}
+
+const CAL_Table_t* CAL_GetTable(uint32_t channel)
+{
+	if (channel >= CAL_CHANNELS) return NULL;
+	return &data.tables[channel];
+}
+
+void CAL_Load(const CAL_Data_t* saved)
+{
+	if (saved == NULL || saved->magic != CALDATA_MAGIC) return;
+
+	for (uint32_t channel = 0; channel < CAL_CHANNELS; channel++)
+	{
+		const CAL_Table_t* table = &saved->tables[channel];
+		if (table->count == 0 || table->count > CAL_MAX_POINTS) return;
+		for (uint32_t i = 1; i < table->count; i++)
+		{
+			if (table->points[i].raw <= table->points[i - 1].raw) return;
+		}
+	}
+
+	__disable_irq();
+	memcpy(data.tables, saved->tables, sizeof(data.tables));
+	__enable_irq();
+}
+
+const CAL_Data_t* CAL_GetData(void)
+{
+	return &data;
+}
@@ -0,0 +1,66 @@
+/*
+ * calibration.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#ifndef SENSOR_CALIBRATION_H_
+#define SENSOR_CALIBRATION_H_
+
+#include "stm32g0xx_hal.h"
+#include "../settings.h"
+
+/**
+ * Piecewise-linear calibration of the readings.
+ * Every channel has a table of points (raw reading, scale), sorted by raw reading: a reading is
+ * multiplied by the scale interpolated between the two points around it, or by the scale of the
+ * first/last point outside the table. Raw readings are computed with the nominal gains (see
+ * sensor.c): uA RMS for the current, mV for the voltage.
+ * The tables are saved in the FLASH page after SaveData_t, so every sensor can be calibrated with
+ * the same firmware (see the calibration command in wifihandler.c).
+ */
+#define CAL_MAX_POINTS 8
+#define CAL_CURRENT 0
+#define CAL_VOLTAGE 1
+#define CAL_CHANNELS 2
+#define CAL_MERGE_PERCENT 5			// a new point this close to an existing one replaces it
+
+typedef struct
+{
+	uint32_t	raw;
+	uint32_t	scale;				// Q16
+} CAL_Point_t;
+
+typedef struct
+{
+	uint32_t	count;
+	uint32_t	recorded;			// 0 while the table holds the defaults
+	CAL_Point_t	points[CAL_MAX_POINTS];
+} CAL_Table_t;
+
+typedef struct
+{
+	uint32_t	magic;				// CALDATA_MAGIC if the tables are valid
+	uint32_t	reserved;			// keeps the tables 8 byte aligned
+	CAL_Table_t	tables[CAL_CHANNELS];
+} CAL_Data_t;
+
+#define CALDATA_MAGIC 0x43414C31
+
+// scale for the raw reading (Q16). called from the ADC DMA callbacks too
+uint32_t CAL_Evaluate(uint32_t channel, uint32_t raw);
+
+/*
+Records that the raw reading corresponds to the reference value (same unit). The first point
+replaces the default table; if the table is full, the nearest point is replaced.
+*/
+bool CAL_AddPoint(uint32_t channel, uint32_t raw, uint32_t reference);
+void CAL_Reset(uint32_t channel);
+const CAL_Table_t* CAL_GetTable(uint32_t channel);
+
+// loads the tables saved in FLASH, the defaults are kept if data is not valid
+void CAL_Load(const CAL_Data_t* data);
+const CAL_Data_t* CAL_GetData(void);
+
+#endif /* SENSOR_CALIBRATION_H_ */
@@ -0,0 +1,142 @@
+/*
+ * events.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#include "events.h"
+#include "sensor.h"
+#include <string.h>
+
+static EVT_Event_t ring[EVT_RING_SIZE];
+static volatile uint32_t next_sequence = 0;		// event n is in ring[n % EVT_RING_SIZE]
+
+static bool has_level = false;
+static uint32_t level;				// mA, current between two transients
+static bool transient = false;
+static uint32_t transient_tick;
+static uint32_t peak;
+static uint32_t last_current;
+static uint32_t settle_cycles;
+static uint32_t settle_tick;
+
+static uint32_t EVT_Threshold(uint32_t current)
+{
+	uint32_t threshold = current * EVT_STEP_PERCENT / 100;
+	return (threshold < EVT_STEP_MIN_MA) ? EVT_STEP_MIN_MA : threshold;
+}
+
+static uint32_t EVT_Difference(uint32_t a, uint32_t b)
+{
+	return (a > b) ? a - b : b - a;
+}
+
+static void EVT_Push(uint32_t type, uint32_t tick, uint32_t duration, uint32_t value, uint32_t previous)
+{
+	EVT_Event_t* event = &ring[next_sequence % EVT_RING_SIZE];
+	event->tick = tick;
+	event->type = type;
+	event->reserved = 0;
+	event->duration = (duration > 0xFFFF) ? 0xFFFF : duration;
+	event->value = (value > 0xFFFF) ? 0xFFFF : value;
+	event->previous = (previous > 0xFFFF) ? 0xFFFF : previous;
+	next_sequence++;
+}
+
+void EVT_Reset(void)
+{
+	has_level = false;
+	transient = false;
+}
+
+void EVT_ProcessCycle(uint32_t current)
+{
+	if (!has_level)
+	{
+		level = current;
+		has_level = true;
+		return;
+	}
+
+	if (!transient)
+	{
+		if (EVT_Difference(current, level) <= EVT_Threshold(level))
+		{
+			// slow drift of the load, not an event
+			level = (level * 7 + current + 4) / 8;
+			return;
+		}
+		transient = true;
+		transient_tick = uwTick;
+		peak = current;
+		last_current = current;
+		settle_cycles = 0;
+		return;
+	}
+
+	if (current > peak)
+		peak = current;
+
+	// the transient ends when the current stops changing, inrush currents decay over many cycles
+	if (EVT_Difference(current, last_current) <= EVT_Threshold(current) / 4)
+	{
+		if (settle_cycles++ == 0)
+			settle_tick = uwTick;
+	}
+	else settle_cycles = 0;
+	last_current = current;
+
+	bool timeout = uwTick - transient_tick > EVT_MAX_TRANSIENT_MS;
+	if (settle_cycles < EVT_SETTLE_CYCLES && !timeout)
+		return;
+
+	uint32_t duration = (timeout ? uwTick : settle_tick) - transient_tick;
+	if (peak > current + EVT_Threshold(current) && peak > level)
+		EVT_Push(EVT_INRUSH, transient_tick, duration, peak, current);
+
+	if (EVT_Difference(current, level) > EVT_Threshold(level))
+	{
+		uint32_t type = EVT_STEP;
+		if (level < SENS_CURRENT_THRESHOLD_MA && current >= SENS_CURRENT_THRESHOLD_MA)
+			type = EVT_ON;
+		else if (level >= SENS_CURRENT_THRESHOLD_MA && current < SENS_CURRENT_THRESHOLD_MA)
+			type = EVT_OFF;
+		EVT_Push(type, transient_tick, duration, current, level);
+	}
+
+	level = current;
+	transient = false;
+}
+
+uint32_t EVT_Read(uint32_t sequence, EVT_Event_t* event)
+{
+	if (event == NULL) return EVT_READ_EMPTY;
+
+	uint32_t next = next_sequence;
+	if ((int32_t)(sequence - next) >= 0) return EVT_READ_EMPTY;
+	if (next - sequence > EVT_RING_SIZE) return EVT_READ_LOST;
+
+	*event = ring[sequence % EVT_RING_SIZE];
+
+	// the ADC DMA callbacks could have overwritten it while copying
+	if (next_sequence - sequence > EVT_RING_SIZE) return EVT_READ_LOST;
+	return EVT_READ_OK;
+}
+
+uint32_t EVT_GetNextSequence(void)
+{
+	return next_sequence;
+}
+
+const char* EVT_GetTypeName(uint32_t type)
+{
+	switch (type)
+	{
+	case EVT_ON: return "on";
+	case EVT_OFF: return "off";
+	case EVT_STEP: return "step";
+	case EVT_INRUSH: return "inrush";
+	default: return "?";
+	}
+}
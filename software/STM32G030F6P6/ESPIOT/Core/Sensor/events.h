@@ -0,0 +1,57 @@
+/*
+ * events.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#ifndef SENSOR_EVENTS_H_
+#define SENSOR_EVENTS_H_
+
+#include "stm32g0xx_hal.h"
+#include "../settings.h"
+
+/**
+ * Appliance event detector.
+ * It's fed with the RMS current of every mains cycle (see SENS_ProcessSamples): a change larger than
+ * EVT_STEP_PERCENT (at least EVT_STEP_MIN_MA) starts a transient, which ends when the current is
+ * stable for EVT_SETTLE_CYCLES cycles. Then an event is recorded:
+ * - EVT_ON / EVT_OFF when the current crosses CURRENT_THRESHOLD
+ * - EVT_STEP for the other changes
+ * - EVT_INRUSH before them, if the transient peaked above the new current (compressor and motor starts)
+ * The events are kept in a ring of EVT_RING_SIZE, with a sequence number that always increases, so
+ * a client only asks for the events after the last one it has read.
+ */
+#define EVT_ON 1
+#define EVT_OFF 2
+#define EVT_STEP 3
+#define EVT_INRUSH 4
+
+typedef struct
+{
+	uint32_t	tick;				// uwTick at the start of the transient
+	uint8_t		type;
+	uint8_t		reserved;
+	uint16_t	duration;			// ms, length of the transient (max 65535)
+	uint16_t	value;				// mA, new current (EVT_INRUSH: peak current)
+	uint16_t	previous;			// mA, current before the event (EVT_INRUSH: current after the peak)
+} EVT_Event_t;
+
+#define EVT_READ_OK 0
+#define EVT_READ_LOST 1				// the event has been overwritten
+#define EVT_READ_EMPTY 2			// the event hasn't happened yet
+
+void EVT_Reset(void);
+
+// called from the ADC DMA callbacks at the end of every mains cycle
+void EVT_ProcessCycle(uint32_t current);
+
+/*
+Copies the event with the given sequence number. Events older than
+EVT_GetNextSequence() - EVT_RING_SIZE are lost.
+*/
+uint32_t EVT_Read(uint32_t sequence, EVT_Event_t* event);
+uint32_t EVT_GetNextSequence(void);
+const char* EVT_GetTypeName(uint32_t type);
+
+#endif /* SENSOR_EVENTS_H_ */
@@ -0,0 +1,32 @@
+/*
+ * fixedpoint.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#include "fixedpoint.h"
+
+uint32_t FIX_Sqrt64(uint64_t x)
+{
+	// digit by digit method: one result bit per iteration, shifts and subtractions only
+	uint64_t result = 0;
+	uint64_t bit = 1ULL << 62;
+
+	while (bit > x)
+		bit >>= 2;
+
+	while (bit != 0)
+	{
+		if (x >= result + bit)
+		{
+			x -= result + bit;
+			result = (result >> 1) + bit;
+		}
+		else
+			result >>= 1;
+		bit >>= 2;
+	}
+
+	return result;
+}
@@ -0,0 +1,42 @@
+/*
+ * fixedpoint.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#ifndef SENSOR_FIXEDPOINT_H_
+#define SENSOR_FIXEDPOINT_H_
+
+#include <stdint.h>
+
+/**
+ * The STM32G030 has no FPU: every float operation is a call to the soft-float library.
+ * The measurement math uses integers and fixed-point numbers instead:
+ * Qn = value * 2^n, e.g. Q15 = 1.0 is 32768, Q16 gains are 65536 per unit
+ */
+typedef int16_t q15_t;
+typedef int32_t q31_t;
+
+#define FIX_Q15_ONE 32768
+#define FIX_Q31_ONE 2147483648LL
+#define FIX_PI_Q30 3373259426LL
+#define FIX_TWO_PI_Q30 6746518852LL
+
+// converts a constant expression to a fixed-point value at compile time
+#define FIX_Q(value, bits) ((int32_t)((value) * (1LL << (bits)) + ((value) < 0 ? -0.5 : 0.5)))
+
+static inline q31_t FIX_MulQ31(q31_t a, q31_t b)
+{
+	return ((int64_t)a * b) >> 31;
+}
+
+static inline q15_t FIX_MulQ15(q15_t a, q15_t b)
+{
+	return ((int32_t)a * b) >> 15;
+}
+
+// floor(sqrt(x))
+uint32_t FIX_Sqrt64(uint64_t x);
+
+#endif /* SENSOR_FIXEDPOINT_H_ */
@@ -0,0 +1,96 @@
+/*
+ * harmonics.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#include "harmonics.h"
+#include "fixedpoint.h"
+#include <string.h>
+
+static int32_t coefficient[HARM_COUNT];		// 2cos(ω) of every filter (Q29)
+static uint8_t enabled[HARM_COUNT];			// below half of the sample rate
+
+static int32_t current_s1[HARM_COUNT];		// last two outputs of the filters
+static int32_t current_s2[HARM_COUNT];
+static int32_t voltage_s1[HARM_COUNT];
+static int32_t voltage_s2[HARM_COUNT];
+
+void HARM_SetFundamental(uint32_t omega)
+{
+	/*
+	 * 2cos(ω) from its Taylor series, with ω < 1 rad 5 terms are below 1e-9 (Q30 resolution).
+	 * the harmonics use the Chebyshev recurrence 2cos((n + 1)ω) = 2cos(ω) * 2cos(nω) - 2cos((n - 1)ω)
+	 */
+	int64_t x2 = ((int64_t)omega * omega) >> 30;
+	int64_t term = 1LL << 30;
+	int64_t cos = term;
+	for (uint32_t k = 1; k <= 5; k++)
+	{
+		term = -((term * x2) >> 30) / (int64_t)((2 * k - 1) * (2 * k));
+		cos += term;
+	}
+
+	int64_t c1 = cos;								// 2cos(ω), Q29
+	int64_t previous = 1LL << 30;					// 2cos(0)
+	int64_t current = c1;
+	uint32_t harmonic = 0;
+	for (uint32_t n = 1; n <= HARM_ORDER[HARM_COUNT - 1]; n++)
+	{
+		if (n == HARM_ORDER[harmonic])
+		{
+			coefficient[harmonic] = current;
+			enabled[harmonic] = (uint64_t)omega * n < FIX_PI_Q30;
+			harmonic++;
+		}
+		int64_t next = ((c1 * current) >> 29) - previous;
+		previous = current;
+		current = next;
+	}
+}
+
+void HARM_Reset(void)
+{
+	memset(current_s1, 0, sizeof(current_s1));
+	memset(current_s2, 0, sizeof(current_s2));
+	memset(voltage_s1, 0, sizeof(voltage_s1));
+	memset(voltage_s2, 0, sizeof(voltage_s2));
+}
+
+void HARM_AddPair(int32_t current, int32_t voltage)
+{
+	// s[n] = x[n] + 2cos(ω) * s[n - 1] - s[n - 2]
+	for (uint32_t i = 0; i < HARM_COUNT; i++)
+	{
+		int32_t s = current + (int32_t)(((int64_t)coefficient[i] * current_s1[i]) >> 29) - current_s2[i];
+		current_s2[i] = current_s1[i];
+		current_s1[i] = s;
+
+		s = voltage + (int32_t)(((int64_t)coefficient[i] * voltage_s1[i]) >> 29) - voltage_s2[i];
+		voltage_s2[i] = voltage_s1[i];
+		voltage_s1[i] = s;
+	}
+}
+
+static uint32_t HARM_GetAmplitude(uint32_t i, int32_t s1, int32_t s2, uint32_t length)
+{
+	if (!enabled[i] || length == 0) return 0;
+
+	// |X|^2 = s1^2 + s2^2 - 2cos(ω) * s1 * s2, the amplitude is 2|X| / samples
+	int64_t power = (int64_t)s1 * s1 + (int64_t)s2 * s2
+			- (((int64_t)coefficient[i] * s1) >> 29) * s2;
+	if (power <= 0) return 0;
+
+	// length is x256, the result is Q8 and the samples had HARM_INPUT_SHIFT fractional bits
+	return ((uint64_t)FIX_Sqrt64(power) << (1 + 16 - HARM_INPUT_SHIFT)) / length;
+}
+
+void HARM_GetAmplitudes(uint32_t length, uint32_t* current, uint32_t* voltage)
+{
+	for (uint32_t i = 0; i < HARM_COUNT; i++)
+	{
+		current[i] = HARM_GetAmplitude(i, current_s1[i], current_s2[i], length);
+		voltage[i] = HARM_GetAmplitude(i, voltage_s1[i], voltage_s2[i], length);
+	}
+}
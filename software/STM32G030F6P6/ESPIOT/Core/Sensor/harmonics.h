@@ -0,0 +1,47 @@
+/*
+ * harmonics.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#ifndef SENSOR_HARMONICS_H_
+#define SENSOR_HARMONICS_H_
+
+#include <stdint.h>
+
+/**
+ * Goertzel filters for the fundamental and the odd harmonics of both channels.
+ * They are updated for every V/I pair, so no FFT buffer is needed: each filter only keeps its last
+ * two outputs. The filters are restarted with every measurement window and tuned on the frequency
+ * measured in the previous one.
+ *
+ * channel 5 is half-wave rectified: since the mains voltage has no even harmonics, its odd
+ * harmonics are exactly half of the ones of the mains voltage (the rectified part, |v| / 2, only
+ * contains even harmonics). The ratios, and so the THD, are not affected.
+ */
+#define HARM_COUNT 5				// fundamental, 3rd, 5th, 7th and 9th harmonic
+#define HARM_INPUT_SHIFT 4			// fractional bits of the samples fed to the filters
+
+// harmonic order of HARM_AddPair outputs, index 0 is the fundamental
+static const uint8_t HARM_ORDER[HARM_COUNT] = { 1, 3, 5, 7, 9 };
+
+/*
+Sets the frequency of the fundamental as radians per V/I pair (Q30). Harmonics above half of the
+sample rate are not measured.
+*/
+void HARM_SetFundamental(uint32_t omega);
+
+// clears the filters, called at the start of every window
+void HARM_Reset(void);
+
+// current and voltage without DC offset, with HARM_INPUT_SHIFT fractional bits
+void HARM_AddPair(int32_t current, int32_t voltage);
+
+/*
+Peak amplitude of every harmonic in ADC counts (Q8) over the pairs added since HARM_Reset.
+length is the number of pairs (x256).
+*/
+void HARM_GetAmplitudes(uint32_t length, uint32_t* current, uint32_t* voltage);
+
+#endif /* SENSOR_HARMONICS_H_ */
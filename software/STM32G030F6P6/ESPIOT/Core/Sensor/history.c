@@ -0,0 +1,190 @@
+/*
+ * history.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#include "history.h"
+#include <string.h>
+
+// running min/max/sum of the record being built
+typedef struct
+{
+	uint32_t	current_min;
+	uint32_t	current_max;
+	uint32_t	current_sum;
+	uint32_t	power_min;
+	uint32_t	power_max;
+	uint32_t	power_sum;
+	uint32_t	voltage_min;
+	uint32_t	voltage_max;
+	uint32_t	voltage_sum;
+	uint32_t	samples;
+} HIST_Accumulator_t;
+
+typedef struct
+{
+	HIST_Record_t*		records;
+	uint32_t			size;
+	uint32_t			period;			// ms
+	uint32_t			children;		// records of the previous resolution in a period
+	uint32_t			head;			// next record written
+	uint32_t			count;
+	uint32_t			end_tick;		// end of the newest record
+	HIST_Accumulator_t	accumulator;
+	uint32_t			closed;			// children added to the accumulator
+} HIST_Ring_t;
+
+static HIST_Record_t seconds[HIST_SECONDS];
+static HIST_Record_t minutes[HIST_MINUTES];
+static HIST_Record_t quarters[HIST_QUARTERS];
+
+static HIST_Ring_t rings[HIST_RESOLUTIONS] =
+{
+	{ seconds, HIST_SECONDS, 1000, 0 },
+	{ minutes, HIST_MINUTES, 60000, 60 },
+	{ quarters, HIST_QUARTERS, 900000, 15 },
+};
+
+static uint32_t second_start;
+static bool started = false;
+
+static uint32_t HIST_Saturate(uint32_t value, uint32_t max)
+{
+	return (value > max) ? max : value;
+}
+
+static void HIST_Accumulate(HIST_Accumulator_t* a, uint32_t voltage, uint32_t current, uint32_t power)
+{
+	if (a->samples == 0)
+	{
+		a->current_min = a->current_max = current;
+		a->power_min = a->power_max = power;
+		a->voltage_min = a->voltage_max = voltage;
+	}
+	if (current < a->current_min) a->current_min = current;
+	if (current > a->current_max) a->current_max = current;
+	if (power < a->power_min) a->power_min = power;
+	if (power > a->power_max) a->power_max = power;
+	if (voltage < a->voltage_min) a->voltage_min = voltage;
+	if (voltage > a->voltage_max) a->voltage_max = voltage;
+	a->current_sum += current;
+	a->power_sum += power;
+	a->voltage_sum += voltage;
+	a->samples++;
+}
+
+// adds a record with the min/max of its children, their mean and their number
+static void HIST_AccumulateRecord(HIST_Accumulator_t* a, const HIST_Record_t* record)
+{
+	if (record->samples == 0) return;
+
+	if (a->samples == 0)
+	{
+		a->current_min = record->current_min;
+		a->current_max = record->current_max;
+		a->power_min = record->power_min;
+		a->power_max = record->power_max;
+		a->voltage_min = record->voltage_min;
+		a->voltage_max = record->voltage_max;
+	}
+	if (record->current_min < a->current_min) a->current_min = record->current_min;
+	if (record->current_max > a->current_max) a->current_max = record->current_max;
+	if (record->power_min < a->power_min) a->power_min = record->power_min;
+	if (record->power_max > a->power_max) a->power_max = record->power_max;
+	if (record->voltage_min < a->voltage_min) a->voltage_min = record->voltage_min;
+	if (record->voltage_max > a->voltage_max) a->voltage_max = record->voltage_max;
+	a->current_sum += record->current_avg;
+	a->power_sum += record->power_avg;
+	a->voltage_sum += record->voltage_avg;
+	a->samples++;
+}
+
+static void HIST_Close(uint32_t resolution, uint32_t end_tick)
+{
+	HIST_Ring_t* ring = &rings[resolution];
+	HIST_Accumulator_t* a = &ring->accumulator;
+	HIST_Record_t* record = &ring->records[ring->head];
+
+	memset(record, 0, sizeof(HIST_Record_t));
+	if (a->samples > 0)
+	{
+		record->current_min = HIST_Saturate(a->current_min, 0xFFFF);
+		record->current_max = HIST_Saturate(a->current_max, 0xFFFF);
+		record->current_avg = HIST_Saturate((a->current_sum + a->samples / 2) / a->samples, 0xFFFF);
+		record->power_min = HIST_Saturate(a->power_min, 0xFFFF);
+		record->power_max = HIST_Saturate(a->power_max, 0xFFFF);
+		record->power_avg = HIST_Saturate((a->power_sum + a->samples / 2) / a->samples, 0xFFFF);
+		record->voltage_min = HIST_Saturate(a->voltage_min, 0xFF);
+		record->voltage_max = HIST_Saturate(a->voltage_max, 0xFF);
+		record->voltage_avg = HIST_Saturate((a->voltage_sum + a->samples / 2) / a->samples, 0xFF);
+		record->samples = HIST_Saturate(a->samples, 0xFF);
+	}
+	memset(a, 0, sizeof(HIST_Accumulator_t));
+
+	ring->head = (ring->head + 1) % ring->size;
+	if (ring->count < ring->size)
+		ring->count++;
+	ring->end_tick = end_tick;
+
+	// roll up in the next resolution
+	if (resolution + 1 < HIST_RESOLUTIONS)
+	{
+		HIST_Ring_t* next = &rings[resolution + 1];
+		HIST_AccumulateRecord(&next->accumulator, record);
+		if (++next->closed >= next->children)
+		{
+			next->closed = 0;
+			HIST_Close(resolution + 1, end_tick);
+		}
+	}
+}
+
+void HIST_AddReading(uint32_t voltage, uint32_t current, uint32_t power)
+{
+	if (!started)
+	{
+		started = true;
+		second_start = uwTick;
+	}
+
+	// seconds without readings are closed empty. the ADC only stops for a few ms to change profile
+	while (uwTick - second_start >= 1000)
+	{
+		second_start += 1000;
+		HIST_Close(HIST_SECOND, second_start);
+	}
+
+	HIST_Accumulate(&rings[HIST_SECOND].accumulator, (voltage + 500) / 1000, current, (power + 50) / 100);
+}
+
+uint32_t HIST_GetPeriod(uint32_t resolution)
+{
+	if (resolution >= HIST_RESOLUTIONS) return 0;
+	return rings[resolution].period;
+}
+
+uint32_t HIST_GetCount(uint32_t resolution)
+{
+	if (resolution >= HIST_RESOLUTIONS) return 0;
+	return rings[resolution].count;
+}
+
+uint32_t HIST_Read(uint32_t resolution, uint32_t age, HIST_Record_t* record)
+{
+	if (resolution >= HIST_RESOLUTIONS || record == NULL) return 0;
+	HIST_Ring_t* ring = &rings[resolution];
+
+	// the ADC DMA callbacks could close a record while copying
+	__disable_irq();
+	uint32_t end_tick = 0;
+	if (age < ring->count)
+	{
+		*record = ring->records[(ring->head + ring->size - 1 - age) % ring->size];
+		end_tick = ring->end_tick - age * ring->period;
+	}
+	__enable_irq();
+
+	return end_tick;
+}
@@ -0,0 +1,53 @@
+/*
+ * history.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#ifndef SENSOR_HISTORY_H_
+#define SENSOR_HISTORY_H_
+
+#include "stm32g0xx_hal.h"
+#include "../settings.h"
+
+/**
+ * History of the readings in RAM, so the app can sync rarely and a WiFi outage leaves no gap.
+ * Every published window is added to the current second; closed seconds are rolled up in minutes,
+ * and minutes in 15 minute periods. Every resolution has its own ring, the oldest records are
+ * overwritten. The periods follow uwTick, not the NTP time.
+ */
+#define HIST_SECOND 0
+#define HIST_MINUTE 1
+#define HIST_QUARTER 2
+#define HIST_RESOLUTIONS 3
+
+typedef struct
+{
+	uint16_t	current_min;		// mA
+	uint16_t	current_max;
+	uint16_t	current_avg;
+	uint16_t	power_min;			// tenths of W
+	uint16_t	power_max;
+	uint16_t	power_avg;
+	uint8_t		voltage_min;		// V
+	uint8_t		voltage_max;
+	uint8_t		voltage_avg;
+	uint8_t		samples;			// readings in the record (windows, seconds or minutes), 0 if no data
+} HIST_Record_t;
+
+#define HIST_SIZE ((HIST_SECONDS + HIST_MINUTES + HIST_QUARTERS) * sizeof(HIST_Record_t))
+
+// called from the ADC DMA callbacks for every published window
+void HIST_AddReading(uint32_t voltage, uint32_t current, uint32_t power);	// mV, mA, mW
+
+uint32_t HIST_GetPeriod(uint32_t resolution);		// ms
+uint32_t HIST_GetCount(uint32_t resolution);		// records available
+
+/*
+Copies a record: age 0 is the newest one. Returns the uwTick at the end of its period, 0 if the
+record doesn't exist.
+*/
+uint32_t HIST_Read(uint32_t resolution, uint32_t age, HIST_Record_t* record);
+
+#endif /* SENSOR_HISTORY_H_ */
@@ -0,0 +1,144 @@
+/*
+ * quality.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#include "quality.h"
+#include <string.h>
+
+#define PQ_DAY_MS 86400000
+#define PQ_THRESHOLD(percent) ((uint32_t)PQ_NOMINAL_VOLTAGE * (percent) * 10)		// mV
+
+static PQ_Event_t records[PQ_LOG_SIZE];
+static uint32_t log_count = 0;			// events ever recorded, the newest is at (log_count - 1) % PQ_LOG_SIZE
+
+static uint16_t counts[PQ_DAYS][PQ_TYPES];
+static uint32_t day = 0;				// row of counts for day 0
+static uint32_t day_start;
+static bool started = false;
+
+static bool ongoing = false;
+static PQ_Event_t event;				// ongoing event, type is PQ_SAG or PQ_SWELL until it ends
+
+static const char* type_names[PQ_TYPES] = { "buco", "sovratensione", "interruzione" };
+
+static void PQ_UpdateDay(void)
+{
+	if (!started)
+	{
+		started = true;
+		day_start = uwTick;
+	}
+
+	while (uwTick - day_start >= PQ_DAY_MS)
+	{
+		day_start += PQ_DAY_MS;
+		day = (day + 1) % PQ_DAYS;
+		memset(counts[day], 0, sizeof(counts[day]));
+	}
+}
+
+static void PQ_EndEvent(void)
+{
+	event.duration = uwTick - event.tick;
+	if (event.type == PQ_SAG && event.extreme < PQ_THRESHOLD(PQ_INTERRUPTION_PERCENT))
+		event.type = PQ_INTERRUPTION;
+
+	records[log_count % PQ_LOG_SIZE] = event;
+	log_count++;
+	if (counts[day][event.type] < UINT16_MAX)
+		counts[day][event.type]++;
+	ongoing = false;
+}
+
+void PQ_ProcessHalfCycle(uint32_t voltage)
+{
+	PQ_UpdateDay();
+
+	if (ongoing)
+	{
+		if (event.type == PQ_SAG)
+		{
+			if (voltage < event.extreme)
+				event.extreme = voltage;
+			if (voltage > PQ_THRESHOLD(PQ_SAG_PERCENT + PQ_HYSTERESIS_PERCENT))
+				PQ_EndEvent();
+		}
+		else
+		{
+			if (voltage > event.extreme)
+				event.extreme = voltage;
+			if (voltage < PQ_THRESHOLD(PQ_SWELL_PERCENT - PQ_HYSTERESIS_PERCENT))
+				PQ_EndEvent();
+		}
+		// a swell can follow a sag straight away (and the other way round), it's checked below
+		if (ongoing) return;
+	}
+
+	if (voltage < PQ_THRESHOLD(PQ_SAG_PERCENT))
+		event.type = PQ_SAG;
+	else if (voltage > PQ_THRESHOLD(PQ_SWELL_PERCENT))
+		event.type = PQ_SWELL;
+	else return;
+
+	event.tick = uwTick;
+	event.duration = 0;
+	event.extreme = voltage;
+	ongoing = true;
+}
+
+bool PQ_GetEvent(uint32_t age, PQ_Event_t* dest)
+{
+	if (dest == NULL) return false;
+
+	// the events are written by the ADC DMA callbacks
+	__disable_irq();
+	bool exists = age < log_count && age < PQ_LOG_SIZE;
+	if (exists)
+		*dest = records[(log_count - 1 - age) % PQ_LOG_SIZE];
+	__enable_irq();
+
+	return exists;
+}
+
+bool PQ_GetOngoing(PQ_Event_t* dest)
+{
+	if (dest == NULL) return false;
+
+	__disable_irq();
+	bool exists = ongoing;
+	if (exists)
+	{
+		*dest = event;
+		dest->duration = uwTick - event.tick;
+		if (dest->type == PQ_SAG && dest->extreme < PQ_THRESHOLD(PQ_INTERRUPTION_PERCENT))
+			dest->type = PQ_INTERRUPTION;
+	}
+	__enable_irq();
+
+	return exists;
+}
+
+uint32_t PQ_GetCount(uint32_t age, uint32_t type)
+{
+	if (age >= PQ_DAYS || type >= PQ_TYPES) return 0;
+
+	__disable_irq();
+	uint32_t count = counts[(day + PQ_DAYS - age) % PQ_DAYS][type];
+	__enable_irq();
+
+	return count;
+}
+
+uint32_t PQ_GetDayStart(void)
+{
+	return day_start;
+}
+
+const char* PQ_GetTypeName(uint32_t type)
+{
+	if (type >= PQ_TYPES) return "";
+	return type_names[type];
+}
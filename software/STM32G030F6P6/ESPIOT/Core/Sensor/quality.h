@@ -0,0 +1,43 @@
+/*
+ * quality.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#ifndef SENSOR_QUALITY_H_
+#define SENSOR_QUALITY_H_
+
+#include "stm32g0xx_hal.h"
+#include "../settings.h"
+
+/**
+ * Power quality monitor: sags, swells and interruptions of the mains voltage, with the thresholds
+ * of settings.h (EN 50160 by default). The voltage channel is clipped at 0 in the negative
+ * half-cycle, so the input is the RMS value of every positive half-cycle (10 ms), one per cycle.
+ * A sag deeper than PQ_INTERRUPTION_PERCENT is recorded as an interruption.
+ * The counters are kept for PQ_DAYS periods of 24 hours of uwTick, day 0 is the current one.
+ */
+#define PQ_SAG 0
+#define PQ_SWELL 1
+#define PQ_INTERRUPTION 2
+#define PQ_TYPES 3
+
+typedef struct
+{
+	uint32_t	tick;		// uwTick at the start
+	uint32_t	duration;	// ms
+	uint32_t	extreme;	// mV, lowest voltage of a sag or an interruption, highest of a swell
+	uint32_t	type;
+} PQ_Event_t;
+
+void PQ_ProcessHalfCycle(uint32_t voltage);		// mV, called by the sensor for every cycle
+
+// the last events: age 0 is the newest one. false if it doesn't exist
+bool PQ_GetEvent(uint32_t age, PQ_Event_t* event);
+bool PQ_GetOngoing(PQ_Event_t* event);			// false if the voltage is within the thresholds
+uint32_t PQ_GetCount(uint32_t age, uint32_t type);		// age in days, 0 is the current one
+uint32_t PQ_GetDayStart(void);					// uwTick at the start of day 0
+const char* PQ_GetTypeName(uint32_t type);
+
+#endif /* SENSOR_QUALITY_H_ */
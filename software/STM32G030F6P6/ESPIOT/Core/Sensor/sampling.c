@@ -0,0 +1,124 @@
+/*
+ * sampling.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#include "sampling.h"
+#include "sensor.h"
+#include "alarm.h"
+#include "fixedpoint.h"
+#include "adc.h"
+#include "tim.h"
+#include <string.h>
+
+/*
+ * interpolating between two samples with weights (1 - a) and a scales a sine wave by
+ * |(1 - a) + a * e^(jωT)| = sqrt(1 - x), x = 2a(1 - a)(1 - cos(ωT)). the compiler folds these into
+ * the profiles: 1 - cos(ωT) is replaced by its Taylor series and 1 / sqrt(1 - x) by
+ * 1 + x/2 + 3x^2/8 (error < 1e-5 for x < 0.05)
+ */
+#define SAMPLING_SKEW_Q6(pair_ns, skew_ns) (((skew_ns) * 64 + (pair_ns) / 2) / (pair_ns))
+#define SAMPLING_WT(pair_ns) (2 * 3.14159265358979 * MAINS_FREQUENCY_HZ * (pair_ns) / 1e9)
+#define SAMPLING_ONE_MINUS_COS(wt) ((wt) * (wt) / 2 - (wt) * (wt) * (wt) * (wt) / 24 \
+		+ (wt) * (wt) * (wt) * (wt) * (wt) * (wt) / 720)
+#define SAMPLING_INTERPOLATION_X(a, wt) (2 * (a) * (1 - (a)) * SAMPLING_ONE_MINUS_COS(wt))
+#define SAMPLING_INVERSE_SQRT(x) (1 + (x) / 2 + 3 * (x) * (x) / 8)
+#define SAMPLING_INTERPOLATION_CORRECTION(pair_ns, skew_ns) FIX_Q(SAMPLING_INVERSE_SQRT(SAMPLING_INTERPOLATION_X( \
+		SAMPLING_SKEW_Q6(pair_ns, skew_ns) / 64.0, SAMPLING_WT(pair_ns))), 16)
+
+/*
+ * an oversampled conversion is the mean of the signal over its duration, which scales a harmonic by
+ * sin(x) / x, x = π * order * f * duration (17% for the 9th harmonic of the voltage at 256x). the
+ * attenuation of the fundamental is part of the calibration, so the harmonics are corrected
+ * relative to it. x / sin(x) is replaced by its series, error < 1e-5 for x < 1.2
+ */
+#define SAMPLING_APERTURE_X(order, ns) (3.14159265358979 * (order) * MAINS_FREQUENCY_HZ * (ns) / 1e9)
+#define SAMPLING_X_OVER_SIN(x) (1 + (x) * (x) / 6 + 7 * (x) * (x) * (x) * (x) / 360 \
+		+ 31 * (x) * (x) * (x) * (x) * (x) * (x) / 15120 + 127 * (x) * (x) * (x) * (x) * (x) * (x) * (x) * (x) / 604800)
+#define SAMPLING_APERTURE(order, ns) FIX_Q(SAMPLING_X_OVER_SIN(SAMPLING_APERTURE_X(order, ns)) \
+		/ SAMPLING_X_OVER_SIN(SAMPLING_APERTURE_X(1, ns)), 16)
+#define SAMPLING_APERTURES(ns) { SAMPLING_APERTURE(1, ns), SAMPLING_APERTURE(3, ns), SAMPLING_APERTURE(5, ns), \
+		SAMPLING_APERTURE(7, ns), SAMPLING_APERTURE(9, ns) }
+
+/*
+ * the oversampled voltage value is centered current_ns / 2 + voltage_ns / 2 after the current one
+ */
+#define SAMPLING_PROFILE(name, period, ratio, shift, pair_ns, current_ns, voltage_ns, dead_zone) \
+	{ name, period, ratio, shift, pair_ns, SAMPLING_SKEW_Q6(pair_ns, (current_ns + voltage_ns) / 2), \
+	SAMPLING_INTERPOLATION_CORRECTION(pair_ns, (current_ns + voltage_ns) / 2), \
+	SAMPLING_APERTURES(current_ns), SAMPLING_APERTURES(voltage_ns), (uint32_t)((dead_zone) * 1000000) }
+
+/**
+ * ADC clock = 64 MHz / 2 = 32 MHz, TIM3 clock = 64 MHz / 4 = 16 MHz
+ * current conversion: (3.5 + 12.5) * ratio cycles, voltage conversion: (79.5 + 12.5) * ratio cycles
+ *
+ * fast, 16x: 8 + 46 = 54 us per scan, a pair every TIM3 period (1600 / 16 MHz = 100 us)
+ * balanced, 64x: 32 + 184 = 216 us per scan, a pair every TIM3 period (4000 / 16 MHz = 250 us)
+ * precision, 256x: 128 + 736 = 864 us per scan. TIM3 triggers arriving while converting are ignored,
+ * so a new pair starts every 12 TIM3 periods (12 * 1201 / 16 MHz = 900.75 us)
+ */
+const SamplingProfile_t sampling_profiles[SAMPLING_PROFILES] =
+{
+	SAMPLING_PROFILE("fast", 1599, ADC_OVERSAMPLING_RATIO_16, ADC_RIGHTBITSHIFT_4, 100000, 8000, 46000, CURRENT_DEAD_ZONE_16X),
+	SAMPLING_PROFILE("balanced", 3999, ADC_OVERSAMPLING_RATIO_64, ADC_RIGHTBITSHIFT_6, 250000, 32000, 184000, CURRENT_DEAD_ZONE_64X),
+	SAMPLING_PROFILE("precision", 1200, ADC_OVERSAMPLING_RATIO_256, ADC_RIGHTBITSHIFT_8, 900750, 128000, 736000, CURRENT_DEAD_ZONE),
+};
+
+static uint32_t profile_index = SAMPLING_DEFAULT_PROFILE;
+static uint16_t* adc_buffer;
+static uint32_t adc_buffer_len;
+
+static void SAMPLING_Configure(void)
+{
+	const SamplingProfile_t* profile = &sampling_profiles[profile_index];
+
+	// the ADC is disabled, so HAL_ADC_Init can change the oversampler (the channels are kept)
+	hadc1.Init.Oversampling.Ratio = profile->oversampling_ratio;
+	hadc1.Init.Oversampling.RightBitShift = profile->oversampling_shift;
+	if (HAL_ADC_Init(&hadc1) != HAL_OK)
+		Error_Handler();
+
+	__HAL_TIM_SET_AUTORELOAD(&htim3, profile->timer_period);
+	__HAL_TIM_SET_COUNTER(&htim3, 0);
+
+	SENS_Init(profile);
+	HAL_ADCEx_Calibration_Start(&hadc1);
+	ALARM_Configure();
+	HAL_ADC_Start_DMA(&hadc1, (uint32_t*)adc_buffer, adc_buffer_len);
+	HAL_TIM_Base_Start(&htim3);
+}
+
+void SAMPLING_Start(uint16_t* buf, uint32_t len)
+{
+	adc_buffer = buf;
+	adc_buffer_len = len;
+	SAMPLING_Configure();
+}
+
+bool SAMPLING_SetProfile(uint32_t profile)
+{
+	if (profile >= SAMPLING_PROFILES || adc_buffer == NULL) return false;
+
+	HAL_TIM_Base_Stop(&htim3);
+	HAL_ADC_Stop_DMA(&hadc1);
+	profile_index = profile;
+	SAMPLING_Configure();
+	return true;
+}
+
+uint32_t SAMPLING_GetProfile(void)
+{
+	return profile_index;
+}
+
+uint32_t SAMPLING_FindProfile(char* name, uint32_t size)
+{
+	for (uint32_t i = 0; i < SAMPLING_PROFILES; i++)
+	{
+		if (strlen(sampling_profiles[i].name) == size && strncmp(sampling_profiles[i].name, name, size) == 0)
+			return i;
+	}
+	return SAMPLING_PROFILES;
+}
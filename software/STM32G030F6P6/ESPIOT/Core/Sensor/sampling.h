@@ -0,0 +1,54 @@
+/*
+ * sampling.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#ifndef SENSOR_SAMPLING_H_
+#define SENSOR_SAMPLING_H_
+
+#include <stdint.h>
+#include "../settings.h"
+#include "harmonics.h"
+
+/**
+ * Sampling profiles: TIM3 period and ADC oversampling, with the constants the measurements derive
+ * from them. More oversampling means less noise but fewer V/I pairs per second.
+ * The oversampling shift always keeps 12-bit results, so the gains don't change between profiles.
+ */
+typedef struct
+{
+	const char*	name;
+	uint32_t	timer_period;				// TIM3 auto-reload value
+	uint32_t	oversampling_ratio;			// ADC_OVERSAMPLING_RATIO_x
+	uint32_t	oversampling_shift;			// ADC_RIGHTBITSHIFT_x
+	uint32_t	pair_period_ns;				// time between two V/I pairs
+	uint32_t	skew_q6;					// current sampled before the voltage, fraction of pair_period_ns (x64)
+	uint32_t	interpolation_correction;	// inverse of the attenuation caused by the skew compensation (Q16)
+	uint32_t	current_aperture[HARM_COUNT];	// harmonics correction for the conversion duration (Q16)
+	uint32_t	voltage_aperture[HARM_COUNT];
+	uint32_t	dead_zone;					// uA, currents below this are noise
+} SamplingProfile_t;
+
+#define SAMPLING_FAST 0
+#define SAMPLING_BALANCED 1
+#define SAMPLING_PRECISION 2				// MX_ADC1_Init and MX_TIM3_Init configuration
+#define SAMPLING_PROFILES 3
+
+extern const SamplingProfile_t sampling_profiles[SAMPLING_PROFILES];
+
+// configures ADC and TIM3 for the selected profile and starts filling buf
+void SAMPLING_Start(uint16_t* buf, uint32_t len);
+
+/*
+Stops the ADC, applies the profile and restarts the measurements. The readings are 0 until the first
+window of the new profile is published (~100 ms).
+*/
+bool SAMPLING_SetProfile(uint32_t profile);
+uint32_t SAMPLING_GetProfile(void);
+
+// returns the index of the profile with the given name, SAMPLING_PROFILES if there isn't one
+uint32_t SAMPLING_FindProfile(char* name, uint32_t size);
+
+#endif /* SENSOR_SAMPLING_H_ */
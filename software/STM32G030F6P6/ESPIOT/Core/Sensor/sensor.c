@@ -0,0 +1,607 @@
+/*
+ * sensor.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#include "sensor.h"
+#include "fixedpoint.h"
+#include "harmonics.h"
+#include "sampling.h"
+#include "calibration.h"
+#include "events.h"
+#include "history.h"
+#include "quality.h"
+#include "timing.h"
+#include <string.h>
+
+/*
+ * mains volts per ADC count of channel 5 (peak value), derived from the mean calibration used by
+ * SENS_GetVoltage: the mean of a half-wave rectified sine is peak / π, so 1.772544 * √2 / π
+ * 1.772544 ~= 3.3 / 4096 * 2200, 2200 being the gain of the operational amplifier stage, measured on
+ * the mains. the mean is scaled by the voltage calibration table (see calibration.h)
+ */
+#define SENS_VOLTAGE_GAIN 0.797934
+
+/*
+ * nominal Q16 gains, all computed at compile time. the readings are then scaled by the calibration
+ * tables (see calibration.h), which also hold the nonlinearity of the ACS712 at low currents
+ * Irms = measured_amplitude * divider_ratio / 2 / ACS712_sensitivity / √2
+ * where
+ * masured_amplitude = peak to peak amplitude of a sine wave with the measured RMS value (rms * 2√2)
+ * divider_ratio = 1.37 (voltage divider ratio)
+ * division by two is used to get only one side of the sine wave
+ * ACS712_sensitivity = 0.185 mV/A
+ * division by √2 is used to get RMS value
+ * adjust == 1.37 * 1.9145 = 2.62286
+ */
+#define SENS_CURRENT_GAIN FIX_Q(3.3 / 4096.0 * 2.828427 * 2.62286 * 1000000, 16)	// uA per count
+#define SENS_VOLTAGE_GAIN_MV FIX_Q(SENS_VOLTAGE_GAIN * 1000, 16)		// mV per count
+// channel 5 is zero in the negative half-cycles: the means only cover half of the cycle (x2)
+#define SENS_POWER_VOLTAGE_GAIN FIX_Q(2 * SENS_VOLTAGE_GAIN, 16)
+#define SENS_VOLTAGE_MEAN_GAIN_MV FIX_Q(1772.544, 16)
+
+#define SENS_FULL_WEIGHT 256
+
+#if SENS_WINDOW_SAMPLES > 1024
+#error "the 32 bit sums of a window can hold 1024 pairs at most"
+#endif
+
+/*
+ * sampling profile in use. power_voltage_gain is SENS_POWER_VOLTAGE_GAIN with the correction of the
+ * skew interpolation of this profile
+ */
+static const SamplingProfile_t* profile = &sampling_profiles[SAMPLING_DEFAULT_PROFILE];
+static uint32_t power_voltage_gain;
+
+static SENS_Window_t window;			// being filled by the DMA callbacks
+static SENS_Window_t snapshot[2];		// double buffer: readers only look at snapshot[snapshot_index]
+static volatile uint32_t snapshot_index = 0;
+static volatile uint32_t snapshot_count = 0;
+
+/*
+ * a pair is processed when the next one arrives: the current at the voltage sampling time lies
+ * between the current of the pair and the next one
+ */
+static uint32_t last_current_sample = 0;
+static uint32_t last_voltage_sample = 0;
+static uint32_t previous_voltage_sample = 0;	// voltage of the pair before the last one
+static bool has_last_sample = false;
+
+/*
+ * the voltage channel is clipped at 0 in the negative half-cycle, so the sample before a zero
+ * crossing can't be used to interpolate its position. windows are synchronized on the rising edge
+ * crossing half of the last peak instead, where both samples lie on the sine wave
+ */
+static bool window_synced = false;		// the current window started on a rising edge
+static bool crossing_armed = false;		// the voltage went back near 0 since the last rising edge
+static uint32_t crossing_level = SENS_ZERO_CROSSING_THRESHOLD;
+static uint32_t window_peak;
+
+/*
+ * the window mean of the current is still biased by the ADC noise and by distorted waveforms, and
+ * it would leak into the real power through the large DC component of the voltage channel.
+ * the ACS712 offset only drifts slowly, so a long term average is used instead (x256)
+ */
+static uint32_t current_offset = 2048 << 8;
+static uint32_t voltage_mean = 0;		// mean of the voltage channel in the last window (x256)
+
+// RMS current and voltage of every mains cycle, for the event detector and the power quality monitor
+static bool cycle_started = false;
+static uint64_t cycle_sum_sq;			// squared current without offset (Q8)
+static uint64_t cycle_voltage_sum_sq;
+static uint32_t cycle_pairs;
+static uint32_t cycle_timeout_pairs;	// 2 mains periods: without a rising edge the voltage is too low
+
+static bool rate_started = false;
+static uint32_t rate_tick;
+static uint32_t rate_pairs;
+static uint32_t total_pairs;
+static uint32_t sample_rate;				// set by SENS_Init until the first measurement
+static uint32_t filtered_voltage;			// mV (Q8), kept across SENS_Init: the mains don't change
+static bool voltage_filter_started = false;
+static uint32_t first_samples_tick = 0;		// uwTick when the first samples were processed, 0 before
+
+/*
+ * energy measured since the last reset (microjoules). it's integrated every time a window is
+ * published, so nothing is lost between two requests
+ */
+static uint64_t energy = 0;
+
+static void SENS_ComputePower(SENS_Window_t* w, SENS_Power_t* power);
+static uint32_t SENS_GetCurrentGain(uint32_t rms);
+static uint32_t SENS_GetWindowCurrent(SENS_Window_t* w);
+static uint32_t SENS_GetWindowVoltage(SENS_Window_t* w);
+static void SENS_FilterVoltage(uint32_t voltage);
+
+// RMS voltage of the positive half-cycle, the negative one is clipped at 0: sqrt(2 * mean(v^2))
+static uint32_t SENS_GetCycleVoltage(void)
+{
+	uint32_t rms = FIX_Sqrt64((cycle_voltage_sum_sq << 17) / cycle_pairs);		// Q8
+	uint32_t voltage = ((uint64_t)rms * SENS_VOLTAGE_GAIN_MV) >> 24;		// mV
+	return ((uint64_t)voltage * CAL_Evaluate(CAL_VOLTAGE, voltage)) >> 16;
+}
+
+static void SENS_CloseCycle(void)
+{
+	if (cycle_started && cycle_pairs > 0)
+	{
+		uint32_t rms = FIX_Sqrt64(cycle_sum_sq / cycle_pairs) << 4;		// Q8
+		uint32_t Irms = ((uint64_t)rms * SENS_GetCurrentGain(rms)) >> 24;		// uA
+		EVT_ProcessCycle((Irms <= profile->dead_zone) ? 0 : (Irms + 500) / 1000);
+		PQ_ProcessHalfCycle(SENS_GetCycleVoltage());
+	}
+	cycle_started = true;
+	cycle_sum_sq = 0;
+	cycle_voltage_sum_sq = 0;
+	cycle_pairs = 0;
+}
+
+static void SENS_PublishWindow(void)
+{
+	uint32_t next_index = snapshot_index ^ 1;
+
+	if (window.length > 0)
+	{
+		int32_t mean = ((uint64_t)window.current_sum << 8) / window.length;
+		current_offset += (mean - (int32_t)current_offset) / SENS_OFFSET_AVERAGE_WINDOWS;
+	}
+	window.current_offset = current_offset;
+	window.sample_rate = sample_rate;
+	window.timestamp = uwTick;
+
+	/*
+	 * duration of the window = length / 256 / (sample_rate / 1000) seconds
+	 * uJ = mW * length * 1000000 / (256 * sample_rate)
+	 */
+	SENS_Power_t power;
+	SENS_ComputePower(&window, &power);
+	if (sample_rate > 0)
+		energy += (uint64_t)power.real_power * window.length * 15625 / (4 * (uint64_t)sample_rate);
+	if (window.length > 0)
+	{
+		uint32_t voltage = SENS_GetWindowVoltage(&window);
+		SENS_FilterVoltage(voltage);
+		HIST_AddReading(voltage, SENS_GetWindowCurrent(&window), power.real_power);
+	}
+	window.filtered_voltage = (filtered_voltage + 128) >> 8;
+
+	// the harmonic filters of the next window are tuned on the frequency measured in this one
+	uint32_t omega;
+	if (window.cycles > 0)
+	{
+		HARM_GetAmplitudes(window.length, window.current_harmonics, window.voltage_harmonics);
+		omega = (uint64_t)FIX_TWO_PI_Q30 * window.cycles * 256 / window.length;
+	}
+	else
+		omega = (uint64_t)FIX_TWO_PI_Q30 * MAINS_FREQUENCY_HZ * 1000 / sample_rate;
+	HARM_SetFundamental(omega);
+	HARM_Reset();
+	if (window.length > 0)
+		voltage_mean = ((uint64_t)window.voltage_sum << 8) / window.length;
+
+	crossing_level = window_peak / 2;
+	if (crossing_level < SENS_ZERO_CROSSING_THRESHOLD)
+		crossing_level = SENS_ZERO_CROSSING_THRESHOLD;
+	window_peak = 0;
+
+	snapshot[next_index] = window;
+	snapshot_index = next_index;
+	snapshot_count++;
+
+	memset(&window, 0, sizeof(SENS_Window_t));
+}
+
+// adds weight / 256 of a pair to the window
+static void SENS_AddPair(uint32_t current, uint32_t voltage, uint32_t aligned_current, uint32_t weight)
+{
+	window.samples++;
+	window.length += weight;
+
+	if (weight == SENS_FULL_WEIGHT)
+	{
+		window.current_sum += current << 8;
+		window.current_sum_sq += (uint64_t)(current * current) << 8;
+		window.voltage_sum += voltage << 8;
+		window.voltage_sum_sq += (uint64_t)(voltage * voltage) << 8;
+		window.power_sum += (uint64_t)(voltage * aligned_current) << 8;
+	}
+	else
+	{
+		window.current_sum += current * weight;
+		window.current_sum_sq += (uint64_t)(current * current) * weight;
+		window.voltage_sum += voltage * weight;
+		window.voltage_sum_sq += (uint64_t)(voltage * voltage) * weight;
+		window.power_sum += (uint64_t)(voltage * aligned_current) * weight;
+	}
+
+	// DC offset removed (x256) and weighted (x256), HARM_INPUT_SHIFT fractional bits are kept
+	TIMING_START();
+	HARM_AddPair((((int32_t)(current << 8) - (int32_t)current_offset) * (int32_t)weight) >> (16 - HARM_INPUT_SHIFT),
+			(((int32_t)(voltage << 8) - (int32_t)voltage_mean) * (int32_t)weight) >> (16 - HARM_INPUT_SHIFT));
+	TIMING_END(TIMING_HARM_PAIR);
+}
+
+static void SENS_ProcessPair(uint32_t current, uint32_t voltage, uint32_t aligned_current)
+{
+	uint32_t weight = SENS_FULL_WEIGHT;
+
+	if (voltage <= SENS_ZERO_CROSSING_THRESHOLD)
+		crossing_armed = true;
+	else if (crossing_armed && voltage > crossing_level && previous_voltage_sample <= crossing_level)
+	{
+		/*
+		 * rising edge between the previous and this pair, at fraction / 256 of the sample period.
+		 * the part of this pair before the edge belongs to the window being closed, so the window
+		 * spans exactly SENS_WINDOW_CYCLES cycles
+		 */
+		crossing_armed = false;
+		SENS_CloseCycle();
+		uint32_t fraction = ((crossing_level - previous_voltage_sample) << 8)
+				/ (voltage - previous_voltage_sample);
+
+		if (!window_synced)
+		{
+			// drop the samples taken before the first edge
+			memset(&window, 0, sizeof(SENS_Window_t));
+			HARM_Reset();
+			window_synced = true;
+			weight = SENS_FULL_WEIGHT - fraction;
+		}
+		else if (++window.cycles >= SENS_WINDOW_CYCLES)
+		{
+			SENS_AddPair(current, voltage, aligned_current, fraction);
+			SENS_PublishWindow();
+			weight = SENS_FULL_WEIGHT - fraction;
+		}
+	}
+
+	SENS_AddPair(current, voltage, aligned_current, weight);
+	int32_t cycle_current = (int32_t)(current << 4) - (int32_t)(current_offset >> 4);	// Q4
+	cycle_sum_sq += (uint32_t)(cycle_current * cycle_current);
+	cycle_voltage_sum_sq += voltage * voltage;
+	cycle_pairs++;
+	if (cycle_pairs >= cycle_timeout_pairs)
+	{
+		// no rising edge (interruption or deep sag): the power quality monitor still gets a reading
+		PQ_ProcessHalfCycle(SENS_GetCycleVoltage());
+		cycle_started = false;
+		cycle_sum_sq = 0;
+		cycle_voltage_sum_sq = 0;
+		cycle_pairs = 0;
+	}
+	if (voltage > window_peak)
+		window_peak = voltage;
+
+	if (window.samples >= SENS_WINDOW_SAMPLES)
+	{
+		// no mains voltage: publish what has been measured
+		window_synced = false;
+		cycle_started = false;
+		window.cycles = 0;
+		SENS_PublishWindow();
+	}
+}
+
+void SENS_Init(const SamplingProfile_t* sampling)
+{
+	profile = sampling;
+	power_voltage_gain = ((uint64_t)SENS_POWER_VOLTAGE_GAIN * profile->interpolation_correction) >> 16;
+
+	memset(&window, 0, sizeof(SENS_Window_t));
+	memset(snapshot, 0, sizeof(snapshot));
+	snapshot_index = 0;
+	snapshot_count = 0;
+	has_last_sample = false;
+	window_synced = false;
+	crossing_armed = false;
+	crossing_level = SENS_ZERO_CROSSING_THRESHOLD;
+	window_peak = 0;
+	current_offset = 2048 << 8;
+	voltage_mean = 0;
+	cycle_started = false;
+	cycle_sum_sq = 0;
+	cycle_voltage_sum_sq = 0;
+	cycle_pairs = 0;
+	cycle_timeout_pairs = 2000000000ULL / (MAINS_FREQUENCY_HZ * profile->pair_period_ns);
+	EVT_Reset();
+	rate_started = false;
+	total_pairs = 0;
+	rate_pairs = 0;
+	sample_rate = 1000000000000ULL / profile->pair_period_ns;
+	HARM_SetFundamental((uint64_t)FIX_TWO_PI_Q30 * MAINS_FREQUENCY_HZ * profile->pair_period_ns / 1000000000);
+	HARM_Reset();
+}
+
+void SENS_ProcessSamples(const uint16_t* buf, uint32_t len)
+{
+	if (first_samples_tick == 0)
+		first_samples_tick = uwTick;
+
+	// 12-bit ADC must be used: 4095^2 * 256 must fit 32 bits
+	for (uint32_t i = 0; i + 1 < len; i += 2)
+	{
+		uint32_t current = buf[i + SENS_CURRENT_OFFSET];
+		uint32_t voltage = buf[i + SENS_VOLTAGE_OFFSET];
+
+		if (has_last_sample)
+		{
+			/*
+			 * the voltage of the last pair was converted skew_q6 / 64 pairs after its current,
+			 * so the current at that moment lies between the last and this current sample (x64)
+			 */
+			uint32_t skew = profile->skew_q6;
+			uint32_t aligned_current = last_current_sample * (64 - skew) + current * skew;
+			SENS_ProcessPair(last_current_sample, last_voltage_sample, aligned_current);
+			previous_voltage_sample = last_voltage_sample;
+		}
+		last_current_sample = current;
+		last_voltage_sample = voltage;
+		has_last_sample = true;
+	}
+
+	/*
+	 * the pairs delivered by the DMA are counted against uwTick to get the real sample rate,
+	 * used to convert the length of the mains cycles to a frequency
+	 */
+	total_pairs += len / 2;
+	if (!rate_started)
+	{
+		rate_started = true;
+		rate_tick = uwTick;
+		rate_pairs = total_pairs;
+	}
+	uint32_t elapsed = uwTick - rate_tick;
+	if (elapsed >= SENS_RATE_PERIOD_MS)
+	{
+		sample_rate = (uint64_t)(total_pairs - rate_pairs) * 1000000 / elapsed;
+		rate_tick = uwTick;
+		rate_pairs = total_pairs;
+	}
+}
+
+uint32_t SENS_GetFirstSampleTick(void)
+{
+	return first_samples_tick;
+}
+
+uint32_t SENS_GetSnapshot(SENS_Window_t* dest)
+{
+	uint32_t count;
+	do
+	{
+		// if a new window is published while copying, copy it again
+		count = snapshot_count;
+		*dest = snapshot[snapshot_index];
+	} while (count != snapshot_count);
+
+	return count;
+}
+
+// RMS value of the current channel in ADC counts (Q8), without the DC offset
+static uint32_t SENS_GetCurrentRMS(SENS_Window_t* w)
+{
+	/*
+	 * the DC offset of the ACS712 output is removed by using the variance of the samples:
+	 * length^2 * variance = length * sum(x^2) - sum(x)^2
+	 * this is computed with integers, so there is no cancellation error
+	 */
+	uint64_t sum_sq_scaled = (uint64_t)w->length * w->current_sum_sq;
+	uint64_t sum_squared = (uint64_t)w->current_sum * w->current_sum;
+	if (sum_sq_scaled <= sum_squared) return 0;
+
+	return ((uint64_t)FIX_Sqrt64(sum_sq_scaled - sum_squared) << 8) / w->length;
+}
+
+// uA per ADC count of the current channel (Q16), for a current with the given RMS value (Q8)
+static uint32_t SENS_GetCurrentGain(uint32_t rms)
+{
+	uint32_t raw = ((uint64_t)rms * SENS_CURRENT_GAIN) >> 24;		// uA
+	return ((uint64_t)SENS_CURRENT_GAIN * CAL_Evaluate(CAL_CURRENT, raw)) >> 16;
+}
+
+// mV from the mean of the voltage channel with the nominal gain, the key of the voltage calibration
+static uint32_t SENS_GetRawVoltageMV(SENS_Window_t* w)
+{
+	return ((uint64_t)w->voltage_sum * SENS_VOLTAGE_MEAN_GAIN_MV / w->length) >> 16;
+}
+
+// mA, 0 in the dead zone
+static uint32_t SENS_GetWindowCurrent(SENS_Window_t* w)
+{
+	uint32_t rms = SENS_GetCurrentRMS(w);
+	uint32_t Irms = ((uint64_t)rms * SENS_GetCurrentGain(rms)) >> 24;		// uA
+
+	if (Irms <= profile->dead_zone) return 0;
+	else return (Irms + 500) / 1000;
+}
+
+// calibrated mV
+static uint32_t SENS_GetWindowVoltage(SENS_Window_t* w)
+{
+	uint32_t raw = SENS_GetRawVoltageMV(w);
+	return ((uint64_t)raw * CAL_Evaluate(CAL_VOLTAGE, raw)) >> 16;
+}
+
+/*
+ * exponential average with a fixed time constant: every window weighs dt / (tau + dt), where dt
+ * is the duration of the window (see the energy in SENS_PublishWindow)
+ */
+static void SENS_FilterVoltage(uint32_t voltage)
+{
+	if (!voltage_filter_started || sample_rate == 0)
+	{
+		voltage_filter_started = true;
+		filtered_voltage = voltage << 8;
+		return;
+	}
+
+	uint64_t dt = (uint64_t)window.length * 15625000 / (4 * (uint64_t)sample_rate);		// us
+	uint32_t weight = (dt << 16) / (dt + SENS_VOLTAGE_TIME_CONSTANT_MS * 1000ULL);		// Q16
+	int64_t error = ((int64_t)voltage << 8) - filtered_voltage;
+	filtered_voltage += (error * weight) >> 16;
+}
+
+uint32_t SENS_GetCurrent()
+{
+	SENS_Window_t w;
+	if (SENS_GetSnapshot(&w) == 0 || w.length == 0) return 0;
+
+	return SENS_GetWindowCurrent(&w);
+}
+
+static void SENS_ComputePower(SENS_Window_t* w, SENS_Power_t* power)
+{
+	memset(power, 0, sizeof(SENS_Power_t));
+	if (w->length == 0) return;
+
+	uint32_t current_rms = SENS_GetCurrentRMS(w);
+	uint32_t current_gain = SENS_GetCurrentGain(current_rms);
+	uint32_t Irms = ((uint64_t)current_rms * current_gain) >> 24;		// uA
+	if (Irms <= profile->dead_zone || Irms < SENS_CURRENT_THRESHOLD_MA * 1000) return;
+
+	/*
+	 * real power = mean(v * (i - offset)) = (sum(v * i) - offset * sum(v)) / samples
+	 * power_sum is x64 because of the interpolation weights, current_offset is x256.
+	 * the sums are x256 and length too, so the mean is in counts^2 (Q8)
+	 */
+	int64_t power_sum = (int64_t)w->power_sum * 4 - (int64_t)w->current_offset * w->voltage_sum;
+	int64_t real_power = power_sum / w->length;
+	uint32_t voltage_scale = CAL_Evaluate(CAL_VOLTAGE, SENS_GetRawVoltageMV(w));
+	real_power = (real_power * power_voltage_gain) >> 16;		// volts * counts (Q8)
+	real_power = (real_power * voltage_scale) >> 16;
+	real_power = ((real_power * (int64_t)current_gain) >> 24) / 1000;	// mW
+
+	uint32_t Vrms = FIX_Sqrt64(((uint64_t)w->voltage_sum_sq << 17) / w->length);	// Q8, sqrt(2 * mean(v^2))
+	Vrms = ((((uint64_t)Vrms * SENS_VOLTAGE_GAIN_MV) >> 24) * voltage_scale) >> 16;	// mV
+
+	// the orientation of the ACS712 is not known, this device only measures loads
+	power->apparent_power = (uint64_t)Vrms * Irms / 1000000;
+	power->real_power = (real_power < 0) ? -real_power : real_power;
+	if (power->real_power > power->apparent_power)
+		power->real_power = power->apparent_power;
+
+	power->reactive_power = FIX_Sqrt64((uint64_t)power->apparent_power * power->apparent_power
+			- (uint64_t)power->real_power * power->real_power);
+	if (power->apparent_power > 0)
+		power->power_factor = ((uint64_t)power->real_power << 15) / power->apparent_power;
+}
+
+void SENS_GetPower(SENS_Power_t* power)
+{
+	if (power == NULL) return;
+	memset(power, 0, sizeof(SENS_Power_t));
+
+	SENS_Window_t w;
+	if (SENS_GetSnapshot(&w) == 0) return;
+
+	SENS_ComputePower(&w, power);
+}
+
+void SENS_GetHarmonics(SENS_Harmonics_t* harmonics)
+{
+	if (harmonics == NULL) return;
+	memset(harmonics, 0, sizeof(SENS_Harmonics_t));
+
+	SENS_Window_t w;
+	if (SENS_GetSnapshot(&w) == 0 || w.cycles == 0) return;
+
+	uint32_t current_rms = SENS_GetCurrentRMS(&w);
+	uint32_t current_gain = SENS_GetCurrentGain(current_rms);
+	bool has_current = (((uint64_t)current_rms * current_gain) >> 24) >= SENS_CURRENT_THRESHOLD_MA * 1000;
+	uint32_t voltage_gain = ((uint64_t)SENS_VOLTAGE_GAIN_MV * CAL_Evaluate(CAL_VOLTAGE, SENS_GetRawVoltageMV(&w))) >> 16;
+
+	uint64_t current_distortion = 0;
+	uint64_t voltage_distortion = 0;
+	for (uint32_t i = 0; i < HARM_COUNT; i++)
+	{
+		uint32_t current = ((uint64_t)w.current_harmonics[i] * profile->current_aperture[i]) >> 16;
+		uint32_t voltage = ((uint64_t)w.voltage_harmonics[i] * profile->voltage_aperture[i]) >> 16;
+
+		// RMS = peak / √2, the odd harmonics of channel 5 are half of the mains ones (see harmonics.h)
+		if (has_current)
+			harmonics->current[i] = (((((uint64_t)current * current_gain) >> 24)
+					* FIX_Q(0.70710678, 16)) >> 16) / 1000;
+		harmonics->voltage[i] = (((uint64_t)voltage * FIX_Q(1.41421356, 16) >> 16)
+				* voltage_gain) >> 24;
+
+		if (i > 0)
+		{
+			current_distortion += (uint64_t)current * current;
+			voltage_distortion += (uint64_t)voltage * voltage;
+		}
+	}
+
+	// THD = sqrt(sum of the harmonics^2) / fundamental
+	if (has_current && w.current_harmonics[0] > 0)
+		harmonics->current_thd = (uint64_t)FIX_Sqrt64(current_distortion) * 10000 / w.current_harmonics[0];
+	if (w.voltage_harmonics[0] > 0)
+		harmonics->voltage_thd = (uint64_t)FIX_Sqrt64(voltage_distortion) * 10000 / w.voltage_harmonics[0];
+}
+
+uint32_t SENS_GetCurrentSampleGain(uint32_t current)
+{
+	return ((uint64_t)SENS_CURRENT_GAIN * CAL_Evaluate(CAL_CURRENT, current * 1000)) >> 16;
+}
+
+uint32_t SENS_GetVoltageSampleGain(uint32_t voltage)
+{
+	// SENS_VOLTAGE_GAIN_MV is for the peak value, which is a single sample
+	return ((uint64_t)SENS_VOLTAGE_GAIN_MV * CAL_Evaluate(CAL_VOLTAGE, voltage * 1000)) >> 16;
+}
+
+uint32_t SENS_GetCurrentOffset()
+{
+	return (current_offset + 128) >> 8;
+}
+
+uint64_t SENS_GetEnergy()
+{
+	// 64 bit accesses are not atomic on the Cortex-M0+
+	__disable_irq();
+	uint64_t value = energy;
+	__enable_irq();
+	return value;
+}
+
+void SENS_SetEnergy(uint64_t value)
+{
+	__disable_irq();
+	energy = value;
+	__enable_irq();
+}
+
+uint32_t SENS_GetRawCurrent()
+{
+	SENS_Window_t w;
+	if (SENS_GetSnapshot(&w) == 0 || w.length == 0) return 0;
+
+	return ((uint64_t)SENS_GetCurrentRMS(&w) * SENS_CURRENT_GAIN) >> 24;
+}
+
+uint32_t SENS_GetRawVoltage()
+{
+	SENS_Window_t w;
+	if (SENS_GetSnapshot(&w) == 0 || w.length == 0) return 0;
+
+	return SENS_GetRawVoltageMV(&w);
+}
+
+uint32_t SENS_GetFrequency()
+{
+	SENS_Window_t w;
+	if (SENS_GetSnapshot(&w) == 0 || w.cycles == 0 || w.length == 0) return 0;
+
+	// cycles / (length / sample_rate), sample_rate is x1000 so this is in mHz
+	return (uint64_t)w.cycles * w.sample_rate * 256 / w.length;
+}
+
+uint32_t SENS_GetVoltage()
+{
+	SENS_Window_t w;
+	if (SENS_GetSnapshot(&w) == 0 || w.length == 0) return 0;
+
+	// filtered in SENS_PublishWindow, so the reading doesn't depend on how often it's requested
+	return (w.filtered_voltage + 500) / 1000;
+}
@@ -0,0 +1,130 @@
+/*
+ * sensor.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#ifndef SENSOR_SENSOR_H_
+#define SENSOR_SENSOR_H_
+
+#include "stm32g0xx_hal.h"
+#include "../settings.h"
+#include "harmonics.h"
+#include "sampling.h"
+
+/**
+ * adc_buf layout (ADC scan sequence, 2 conversions per TIM3 trigger):
+ * adc_buf[2n]     = channel 4, current (ACS712 output, biased at half supply)
+ * adc_buf[2n + 1] = channel 5, voltage (operational amplifier output)
+ *
+ * the operational amplifier runs from a single supply, so channel 5 only follows the positive
+ * half-cycles of the mains voltage and sits at 0 during the negative ones. mains voltage and load
+ * current are symmetric between the two half-cycles, so every mean taken over the positive half
+ * is doubled to get the full cycle value (see SENS_GetPower)
+ */
+#define SENS_CURRENT_OFFSET 0
+#define SENS_VOLTAGE_OFFSET 1
+
+/**
+ * Running sums of one measurement window.
+ * The window is filled from the ADC DMA callbacks and published as a whole, so every reading
+ * taken from a snapshot comes from samples of the same window.
+ * A window starts and ends on a rising edge of the voltage channel and spans exactly
+ * SENS_WINDOW_CYCLES mains cycles, so there is no truncation error from partial cycles.
+ * If there is no mains voltage, it's closed after SENS_WINDOW_SAMPLES pairs with cycles = 0.
+ */
+typedef struct
+{
+	uint32_t	samples;			// V/I pairs accumulated
+	uint32_t	length;				// length of the window in pairs, the pairs at the edges are weighted
+	/*
+	 * every sum, and length, is x256: a pair split by the edge of the window only adds the
+	 * fraction of its sample period that falls inside the window
+	 */
+	uint32_t	current_sum;		// sum of raw current samples (DC offset * length)
+	uint64_t	current_sum_sq;		// sum of squared raw current samples
+	uint32_t	voltage_sum;
+	uint64_t	voltage_sum_sq;
+	uint64_t	power_sum;			// sum of voltage * current, current realigned to the voltage sample (x64)
+	uint32_t	current_offset;		// long term mean of the current samples (x256)
+	uint32_t	cycles;				// whole mains cycles in the window
+	uint32_t	sample_rate;		// measured V/I pairs per second (x1000)
+	uint32_t	timestamp;			// uwTick at publish time
+	uint32_t	filtered_voltage;	// mV, SENS_VOLTAGE_TIME_CONSTANT_MS exponential average up to this window
+	uint32_t	current_harmonics[HARM_COUNT];	// peak amplitudes in counts (Q8), 0 if cycles == 0
+	uint32_t	voltage_harmonics[HARM_COUNT];
+} SENS_Window_t;
+
+/*
+Resets the measurements (not the energy) for the given sampling profile, called by SAMPLING_Start and
+SAMPLING_SetProfile with the ADC stopped.
+*/
+void SENS_Init(const SamplingProfile_t* sampling);
+
+/*
+Consumes a stable part of adc_buf (interleaved current/voltage samples, len must be even).
+Called from the ADC DMA half/full transfer callbacks: it only does integer additions and
+multiplications, apart from the energy integrated once per window. The conversion to physical units
+is left to the readers.
+*/
+void SENS_ProcessSamples(const uint16_t* buf, uint32_t len);
+
+/*
+Copies the last published window in window. Returns the number of windows published since boot,
+0 if there is no valid reading yet.
+*/
+uint32_t SENS_GetSnapshot(SENS_Window_t* window);
+
+// uwTick when the first half of adc_buf was processed (time from boot to the first samples), 0 before
+uint32_t SENS_GetFirstSampleTick(void);
+
+/*
+ * the readings are fixed-point: the STM32G030 has no FPU (see fixedpoint.h)
+ */
+#define SENS_CURRENT_THRESHOLD_MA ((uint32_t)(CURRENT_THRESHOLD * 1000))
+
+typedef struct
+{
+	uint32_t	real_power;			// mW
+	uint32_t	apparent_power;		// mVA
+	uint32_t	reactive_power;		// mvar, everything that is not real power (includes distortion)
+	uint32_t	power_factor;		// Q15, 32768 = 1
+} SENS_Power_t;
+
+void SENS_GetPower(SENS_Power_t* power);
+
+typedef struct
+{
+	uint32_t	current[HARM_COUNT];	// mA RMS, harmonic orders in HARM_ORDER
+	uint32_t	voltage[HARM_COUNT];	// mV RMS of the mains voltage
+	uint32_t	current_thd;			// hundredths of percent
+	uint32_t	voltage_thd;
+} SENS_Harmonics_t;
+
+void SENS_GetHarmonics(SENS_Harmonics_t* harmonics);
+
+/*
+Real energy measured since the last reset, in microjoules. Not cleared by SENS_Init: it's restored
+from FLASH at startup with SENS_SetEnergy and reset by the wifi=resetenergy command.
+*/
+uint64_t SENS_GetEnergy(void);
+void SENS_SetEnergy(uint64_t value);
+uint32_t SENS_GetFrequency(void);		// mHz
+uint32_t SENS_GetCurrent(void);			// mA
+uint32_t SENS_GetVoltage(void);			// V, averaged over SENS_VOLTAGE_TIME_CONSTANT_MS
+
+// readings with the nominal gains, before the calibration tables (see calibration.h)
+uint32_t SENS_GetRawCurrent(void);		// uA
+uint32_t SENS_GetRawVoltage(void);		// mV
+
+/*
+Gains of a single sample, for the analog watchdog thresholds (see alarm.h): uA (mV) per ADC count of
+the current (voltage) channel, Q16, calibrated for a reading of current mA (voltage V). The current
+samples are measured from SENS_GetCurrentOffset, the voltage ones from 0.
+*/
+uint32_t SENS_GetCurrentSampleGain(uint32_t current);
+uint32_t SENS_GetVoltageSampleGain(uint32_t voltage);
+uint32_t SENS_GetCurrentOffset(void);	// ADC counts
+
+#endif /* SENSOR_SENSOR_H_ */
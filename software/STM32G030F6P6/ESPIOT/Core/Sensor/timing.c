@@ -0,0 +1,43 @@
+/*
+ * timing.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#include "timing.h"
+#include <string.h>
+
+static TIMING_Stats_t stats[TIMING_POINTS];
+
+uint32_t TIMING_GetCycles(void)
+{
+	uint32_t tick, value;
+	do
+	{
+		// if SysTick reloads between the two reads, uwTick changes and they are taken again
+		tick = uwTick;
+		value = SysTick->VAL;
+	} while (tick != uwTick);
+
+	return tick * (SysTick->LOAD + 1) + (SysTick->LOAD - value);
+}
+
+void TIMING_Add(uint32_t point, uint32_t start)
+{
+	uint32_t cycles = TIMING_GetCycles() - start;
+	TIMING_Stats_t* s = &stats[point];
+
+	s->count++;
+	s->total += cycles;
+	if (cycles > s->max)
+		s->max = cycles;
+}
+
+void TIMING_GetStats(uint32_t point, TIMING_Stats_t* dest)
+{
+	// updated from the interrupts, 64 bit accesses are not atomic on the Cortex-M0+
+	__disable_irq();
+	*dest = stats[point];
+	__enable_irq();
+}
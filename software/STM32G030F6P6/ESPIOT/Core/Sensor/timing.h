@@ -0,0 +1,45 @@
+/*
+ * timing.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#ifndef SENSOR_TIMING_H_
+#define SENSOR_TIMING_H_
+
+#include "stm32g0xx_hal.h"
+#include "../settings.h"
+
+/**
+ * CPU cycles spent in the measurement code, for profiling on the target (see ENABLE_CYCLE_TIMING).
+ * The Cortex-M0+ has no DWT cycle counter, so SysTick is used: it counts down HCLK cycles from
+ * SysTick->LOAD and uwTick counts its reloads. SysTick has the highest priority (TICK_INT_PRIORITY),
+ * so uwTick is up to date inside every other interrupt. The interrupts of higher priority than the
+ * measured code are counted in its time.
+ */
+#define TIMING_ADC_CALLBACK 0		// HAL_ADC_ConvHalfCpltCallback and HAL_ADC_ConvCpltCallback
+#define TIMING_HARM_PAIR 1			// HARM_AddPair, a V/I pair (its measurement is part of the callback time)
+#define TIMING_POINTS 2
+
+typedef struct
+{
+	uint32_t	count;				// measurements
+	uint32_t	max;				// cycles
+	uint64_t	total;
+} TIMING_Stats_t;
+
+#ifdef ENABLE_CYCLE_TIMING
+#define TIMING_START() uint32_t timing_start = TIMING_GetCycles()
+#define TIMING_END(point) TIMING_Add(point, timing_start)
+#else
+#define TIMING_START()
+#define TIMING_END(point)
+#endif
+
+// HCLK cycles since boot, wraps every 67 s at 64 MHz
+uint32_t TIMING_GetCycles(void);
+void TIMING_Add(uint32_t point, uint32_t start);
+void TIMING_GetStats(uint32_t point, TIMING_Stats_t* stats);
+
+#endif /* SENSOR_TIMING_H_ */
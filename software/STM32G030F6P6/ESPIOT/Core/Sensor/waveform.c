@@ -0,0 +1,96 @@
+/*
+ * waveform.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#include "waveform.h"
+#include "sensor.h"
+#include "sampling.h"
+
+#define WAVE_IDLE 0
+#define WAVE_ARMED 1			// waiting for a rising edge
+#define WAVE_CAPTURING 2
+#define WAVE_DONE 3				// the buffer is frozen
+
+static uint16_t capture_buf[WAVE_CAPTURE_PAIRS * 2];
+static volatile uint32_t state = WAVE_IDLE;
+static uint32_t decimation;		// one pair out of decimation is kept
+static uint32_t skip;
+static uint32_t target_pairs;
+static volatile uint32_t captured_pairs;
+static uint32_t armed_tick;
+static uint32_t last_voltage;
+
+void WAVE_ProcessSamples(const uint16_t* buf, uint32_t len)
+{
+	if (state != WAVE_ARMED && state != WAVE_CAPTURING) return;
+
+	for (uint32_t i = 0; i + 1 < len; i += 2)
+	{
+		uint32_t voltage = buf[i + SENS_VOLTAGE_OFFSET];
+		if (state == WAVE_ARMED)
+		{
+			// the voltage channel is 0 in the negative half-cycles (see sensor.h)
+			bool edge = last_voltage <= SENS_ZERO_CROSSING_THRESHOLD && voltage > SENS_ZERO_CROSSING_THRESHOLD;
+			last_voltage = voltage;
+			if (!edge && uwTick - armed_tick < WAVE_TRIGGER_TIMEOUT_MS)
+				continue;
+			state = WAVE_CAPTURING;
+		}
+
+		if (skip > 0)
+		{
+			skip--;
+			continue;
+		}
+		skip = decimation - 1;
+
+		capture_buf[captured_pairs * 2 + SENS_CURRENT_OFFSET] = buf[i + SENS_CURRENT_OFFSET];
+		capture_buf[captured_pairs * 2 + SENS_VOLTAGE_OFFSET] = voltage;
+		if (++captured_pairs >= target_pairs)
+		{
+			state = WAVE_DONE;
+			return;
+		}
+	}
+}
+
+bool WAVE_Capture(uint32_t cycles, WAVE_Capture_t* capture)
+{
+	if (capture == NULL) return false;
+	if (cycles == 0) cycles = 1;
+	if (cycles > WAVE_MAX_CYCLES) cycles = WAVE_MAX_CYCLES;
+
+	const SamplingProfile_t* profile = &sampling_profiles[SAMPLING_GetProfile()];
+	uint32_t pairs = (uint64_t)cycles * 1000000000 / ((uint64_t)MAINS_FREQUENCY_HZ * profile->pair_period_ns) + 1;
+
+	// the DMA callbacks must see a complete configuration
+	__disable_irq();
+	decimation = (pairs + WAVE_CAPTURE_PAIRS - 1) / WAVE_CAPTURE_PAIRS;
+	target_pairs = (pairs + decimation - 1) / decimation;
+	captured_pairs = 0;
+	skip = 0;
+	last_voltage = 0xFFFF;		// no edge on the first pair
+	armed_tick = uwTick;
+	state = WAVE_ARMED;
+	__enable_irq();
+
+	// trigger timeout + capture + one callback period of the slowest profile
+	uint32_t timeout = WAVE_TRIGGER_TIMEOUT_MS + cycles * 1000 / MAINS_FREQUENCY_HZ + 100;
+	uint32_t start = uwTick;
+	while (state != WAVE_DONE)
+	{
+		if (uwTick - start > timeout)
+		{
+			state = WAVE_IDLE;
+			return false;
+		}
+	}
+
+	capture->samples = capture_buf;
+	capture->pairs = captured_pairs;
+	capture->period_ns = profile->pair_period_ns * decimation;
+	return true;
+}
@@ -0,0 +1,38 @@
+/*
+ * waveform.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Kikkiu
+ */
+
+#ifndef SENSOR_WAVEFORM_H_
+#define SENSOR_WAVEFORM_H_
+
+#include "stm32g0xx_hal.h"
+#include "../settings.h"
+
+/**
+ * Raw capture of the ADC samples, for the waveform command.
+ * The pairs are copied from the ADC DMA callbacks, starting from a rising edge of the voltage
+ * channel, into a buffer that is frozen until the next capture: the measurements keep running
+ * while it's sent. The layout is the same as adc_buf (see sensor.h).
+ */
+#define WAVE_CAPTURE_SIZE (WAVE_CAPTURE_PAIRS * 2 * sizeof(uint16_t))
+
+typedef struct
+{
+	const uint16_t*	samples;		// interleaved current/voltage, raw ADC counts
+	uint32_t		pairs;
+	uint32_t		period_ns;		// time between two captured pairs
+} WAVE_Capture_t;
+
+/*
+Captures cycles mains cycles (at most WAVE_MAX_CYCLES), blocking until the buffer is full.
+Returns false on timeout (ADC not running).
+*/
+bool WAVE_Capture(uint32_t cycles, WAVE_Capture_t* capture);
+
+// called from the ADC DMA callbacks with the half of adc_buf that is stable
+void WAVE_ProcessSamples(const uint16_t* buf, uint32_t len);
+
+#endif /* SENSOR_WAVEFORM_H_ */
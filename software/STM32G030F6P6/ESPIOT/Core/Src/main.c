@@ -34,6 +34,12 @@
 #include "../ESP8266/esp8266.h"
 #include "../wifihandler/wifihandler.h"
 #include "../Flash/flash.h"
+#include "../Sensor/sensor.h"
+#include "../Sensor/sampling.h"
+#include "../Sensor/waveform.h"
+#include "../Sensor/history.h"
+#include "../Sensor/alarm.h"
+#include "../Sensor/timing.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -55,87 +61,26 @@
 
 /* USER CODE BEGIN PV */
 uint16_t adc_buf[ADC_BUF_LEN];
-uint32_t previous_voltage = 0;
 
 WIFI_t wifi;
 Connection_t conn;
+
+static uint32_t energy_save_timestamp = 0;
+
+_Static_assert(sizeof(adc_buf) + UART_BUFFER_SIZE + sizeof(Connection_t) + sizeof(WIFI_t)
+		+ WAVE_CAPTURE_SIZE + HIST_SIZE <= BUFFERS_RAM_BUDGET, "buffers exceed BUFFERS_RAM_BUDGET, check BUFFERS SIZES in settings.h");
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 /* USER CODE BEGIN PFP */
+static void MAIN_Housekeeping(void);
+static void MAIN_SaveIP(void);
 
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
-float SENS_GetCurrent()
-{
-	float max = 0, min = 4096;
-	// 12-bit ADC must be used
-	for (uint32_t i = 0; i < ADC_BUF_LEN; i+=2)
-	{
-		if (adc_buf[i] > max)
-			max = adc_buf[i];
-		if (adc_buf[i] < min)
-			min = adc_buf[i];
-	}
-
-	max = max / 4096.0 * 3.3;
-	min = min / 4096.0 * 3.3;
-
-	/*
-	 * Irms = measured_amplitude * divider_ratio / 2 / ACS712_sensitivity / √2
-	 * where
-	 * masured_amplitude = fabsf(max - min)
-	 * divider_ratio = 1.37 (voltage divider ratio)
-	 * division by two is used to get only one side of the sine wave
-	 * ACS712_sensitivity = 0.185 mV/A
-	 * division by √2 is used to get RMS value
-	 *
-	 * the numbers below are obtained by doing these multiplications and division in advance
-	 */
-
-	// adjust_value == 1.37 * 1.9145
-	float adjust_value = 2.62286;
-	float abs_amplitude = fabsf(max - min);
-	// used with this particular ACS sensor, since its reading is not linear under 0.6A
-	if (abs_amplitude < 0.25)
-		adjust_value = 2.09;
-
-	// abs_amplitude * 1.37 * 1.9145
-	float Irms = abs_amplitude * adjust_value * CURRENT_CALIB_VALUE;
-
-	if (Irms <= CURRENT_DEAD_ZONE) return 0;
-	else return Irms;
-}
-
-
-uint32_t SENS_GetVoltage()
-{
-	// 12-bit ADC must be used
-	uint32_t voltage_mean = 0, voltage = 0;
-	for (uint32_t i = 1; i < ADC_BUF_LEN; i+=2)
-		voltage_mean += adc_buf[i];
-
-	/*
-	 * 0.001745 = 3.3 / (4096 * 1024) * 2255
-	 * 2255 is a calibration value. the voltage output of the operational amplifier
-	 * has to be multiplied by this value to get the value of the mains voltage
-	 * 256x, 8-BIT SHIFT OVERSAMPLER IS REQUIRED!
-	 */
-
-	voltage = (float)voltage_mean * 0.001731;
-	if (voltage > 250)
-		return 230;
-
-	voltage = (voltage + previous_voltage) / 2;
-		previous_voltage = voltage;
-
-	return voltage * VOLTAGE_CALIB_VALUE;
-}
-
-
 HAL_StatusTypeDef ESP_SendRawValue(uint32_t value, uint32_t received_byte)
 {
 	uint8_t send_buffer[11];
@@ -189,63 +134,80 @@ int main(void)
   MX_USART1_UART_Init();
   MX_TIM3_Init();
   /* USER CODE BEGIN 2 */
-  if (ESP8266_Init() == TIMEOUT)
-  {
-	  while (1)
-		  __NOP();
-  }
+  ESP8266_Init();
 
 #ifdef ENABLE_SAVE_TO_FLASH
   FLASH_ReadSaveData();
   if (WIFI_SetName(&wifi, savedata.name) == ERR)
     WIFI_SetName(&wifi, (char*)ESP_NAME); // happens when there is nothing saved to FLASH, so set default name
-  WIFI_SetIP(&wifi, savedata.ip);         // if there is nothing saved to FLASH, this function does nothing
+  if (savedata.magic == SAVEDATA_MAGIC)
+    SENS_SetEnergy(savedata.energy);      // continue counting from the energy saved before the last reset
+  if (savedata.alarm_magic == ALARMDATA_MAGIC)
+  {
+    ALARM_SetThreshold(ALARM_CURRENT, savedata.alarm_current);
+    ALARM_SetThreshold(ALARM_VOLTAGE, savedata.alarm_voltage);
+  }
+  savedata.magic = SAVEDATA_MAGIC;
 #else
   WIFI_SetName(&wifi, (char*)ESP_NAME);
 #endif
 
+  // the measurements start before the network, which takes seconds after a cold boot
+  SAMPLING_Start(adc_buf, ADC_BUF_LEN);
+  energy_save_timestamp = uwTick;
+
   memcpy(wifi.SSID, ssid, strlen(ssid));
   memcpy(wifi.pw, password, strlen(password));
   HAL_GPIO_WritePin(STATUS_Port, STATUS_Pin, 1);
-  uint32_t connect_status = WIFI_Connect(&wifi);
-  if (connect_status == FAIL || connect_status == ERROR)
+#ifdef ENABLE_WARM_BOOT
+  // after a reset of the STM32 alone the ESP is still connected and serving
+  Response_t boot_status = WIFI_WarmStart(&wifi, SERVER_PORT);
+#else
+  Response_t boot_status = ERR;
+#endif
+  if (boot_status != OK)
   {
-    // try again
-    NVIC_SystemReset();
+    if (ESP8266_ResetWaitReady() == TIMEOUT)
+    {
+      while (1)
+        __NOP();
+    }
+#ifdef ENABLE_SAVE_TO_FLASH
+    WIFI_SetIP(&wifi, savedata.ip);         // if there is nothing saved to FLASH, this function does nothing
+#endif
+    // without WiFi the device keeps measuring offline, the supervisor connects it later
+    boot_status = WIFI_Connect(&wifi);
+    WIFI_EnableNTPServer(&wifi, 0);
+
+    /*
+    The first time the ESP connects to WiFi, the gateway assigns an IP to it, which now gets saved to FLASH.
+    The next time the ESP connects, the gateway could assign a different IP; to prevent this, the function
+    WIFI_SetIP(&wifi, savedata.ip); loads the IP previously saved on FLASH so that the ESP tries to connect
+    and get this IP
+    */
+    if (boot_status == OK)
+      MAIN_SaveIP();
+
+    WIFI_StartServer(&wifi, SERVER_PORT);
   }
+  WIFI_StartSupervisor(&wifi, boot_status == OK);
   HAL_GPIO_WritePin(STATUS_Port, STATUS_Pin, 0);
-  WIFI_EnableNTPServer(&wifi, 0);
-
-  /*
-  The first time the ESP connects to WiFi, the gateway assigns an IP to it, which now gets saved to FLASH.
-  The next time the ESP connects, the gateway could assign a different IP; to prevent this, the function
-  WIFI_SetIP(&wifi, savedata.ip); loads the IP previously saved on FLASH so that the ESP tries to connect
-  and get this IP
-  */
-  strncpy(savedata.ip, wifi.IP, 15);
-  FLASH_WriteSaveData();
-
-  WIFI_StartServer(&wifi, SERVER_PORT);
-
-  HAL_ADCEx_Calibration_Start(&hadc1);
-  HAL_ADC_Start_DMA(&hadc1, (uint32_t*)&adc_buf, ADC_BUF_LEN);
-  HAL_TIM_Base_Start(&htim3);
   /* USER CODE END 2 */
 
   /* Infinite loop */
   /* USER CODE BEGIN WHILE */
   Response_t wifistatus = WAITING;
   HAL_GPIO_WritePin(GPIOB, GPIO_PIN_0, 1);
-  //uint32_t reconnection_timestamp = 0;
   while (1)
   {
-	  /*if (uwTick - reconnection_timestamp > RECONNECTION_DELAY_MILLIS)
-	  {
-		  // check every RECONNECTION_DELAY_MINS if this device is connected to wifi. if it is, get
-		  // latest connection info, otherwise connect
-		  WIFI_Connect(&wifi);
-		  reconnection_timestamp = uwTick;
-	  }*/
+	  MAIN_Housekeeping();
+	  // AT commands queued without waiting for them
+	  ESP8266_Process();
+
+	  // reconnects WiFi in the background; the IP is read again when it comes back, it's new if the boot
+	  // was offline
+	  if (WIFI_Supervise() && WIFI_GetConnectionInfo(&wifi) == OK)
+		  MAIN_SaveIP();
 
 	  wifistatus = WAITING;
 	  // HANDLE WIFI CONNECTION
@@ -258,23 +220,67 @@ int main(void)
 		  if ((key_ptr = WIFI_RequestHasKey(&conn, "wifi")))
 			  WIFIHANDLER_HandleWiFiRequest(&conn, key_ptr);
 
+		  else if ((key_ptr = WIFI_RequestHasKey(&conn, "sampling")))
+			  WIFIHANDLER_HandleSamplingRequest(&conn, key_ptr);
+
+		  else if ((key_ptr = WIFI_RequestHasKey(&conn, "calibration")))
+			  WIFIHANDLER_HandleCalibrationRequest(&conn, key_ptr);
+
+		  else if ((key_ptr = WIFI_RequestHasKey(&conn, "alarm")))
+			  WIFIHANDLER_HandleAlarmRequest(&conn, key_ptr);
+
 		  else if (conn.request_type == GET)
 		  {
 			  if ((key_ptr = WIFI_RequestHasKey(&conn, "features")))
 			  {
 				  feature_voltage = SENS_GetVoltage();
-				  float current = SENS_GetCurrent();
-				  if (current < CURRENT_THRESHOLD)
-					  current = 0.0f;
-				  feature_current_integer_part = current;
-				  feature_current_decimal_part = current * 100 - feature_current_integer_part * 100;
-				  float power = feature_voltage * current;
-				  feature_power_integer_part = power;
-				  feature_power_decimal_part = power * 100 - feature_power_integer_part * 100;
+				  // the readings are in thousandths, two decimals are shown
+				  uint32_t current = SENS_GetCurrent();
+				  if (current < SENS_CURRENT_THRESHOLD_MA)
+					  current = 0;
+				  feature_current_integer_part = current / 1000;
+				  feature_current_decimal_part = current % 1000 / 10;
+				  SENS_Power_t power;
+				  SENS_GetPower(&power);
+				  feature_power_integer_part = power.real_power / 1000;
+				  feature_power_decimal_part = power.real_power % 1000 / 10;
+				  feature_apparent_power_integer_part = power.apparent_power / 1000;
+				  feature_apparent_power_decimal_part = power.apparent_power % 1000 / 10;
+				  feature_reactive_power_integer_part = power.reactive_power / 1000;
+				  feature_reactive_power_decimal_part = power.reactive_power % 1000 / 10;
+				  uint32_t power_factor = (power.power_factor * 100 + 16384) >> 15;	// Q15, rounded to 2 decimals
+				  feature_power_factor_integer_part = power_factor / 100;
+				  feature_power_factor_decimal_part = power_factor % 100;
+				  uint32_t frequency = SENS_GetFrequency();
+				  feature_frequency_integer_part = frequency / 1000;
+				  feature_frequency_decimal_part = frequency % 1000 / 10;
+				  uint64_t energy = SENS_GetEnergy();	// microjoules, 1 Wh = 3600 J
+				  feature_energy_integer_part = energy / 3600000000ULL;
+				  feature_energy_decimal_part = (energy % 3600000000ULL) / 36000000;
+				  SENS_Harmonics_t harmonics;
+				  SENS_GetHarmonics(&harmonics);
+				  feature_current_thd_integer_part = harmonics.current_thd / 100;
+				  feature_current_thd_decimal_part = harmonics.current_thd % 100 / 10;
+				  feature_voltage_thd_integer_part = harmonics.voltage_thd / 100;
+				  feature_voltage_thd_decimal_part = harmonics.voltage_thd % 100 / 10;
+				  for (uint32_t i = 0; i < HARM_COUNT; i++)
+				  {
+					  feature_current_harmonics[i] = harmonics.current[i];
+					  feature_voltage_harmonics_integer_part[i] = harmonics.voltage[i] / 1000;
+					  feature_voltage_harmonics_decimal_part[i] = harmonics.voltage[i] % 1000 / 100;
+				  }
 				  WIFIHANDLER_HandleFeaturePacket(&conn, (char*)FEATURES_TEMPLATE);
 			  }
 			  else if ((key_ptr = WIFI_RequestHasKey(&conn, "notification")))
 				  WIFIHANDLER_HandleNotificationRequest(&conn, key_ptr);
+			  else if ((key_ptr = WIFI_RequestHasKey(&conn, "waveform")))
+				  WIFIHANDLER_HandleWaveformRequest(&conn, key_ptr);
+			  else if ((key_ptr = WIFI_RequestHasKey(&conn, "events")))
+				  WIFIHANDLER_HandleEventsRequest(&conn, key_ptr);
+			  else if ((key_ptr = WIFI_RequestHasKey(&conn, "history")))
+				  WIFIHANDLER_HandleHistoryRequest(&conn, key_ptr);
+			  else if ((key_ptr = WIFI_RequestHasKey(&conn, "quality")))
+				  WIFIHANDLER_HandleQualityRequest(&conn, key_ptr);
 			  // other GET requests code here...
 
 			  else WIFI_SendResponse(&conn, "404 Not Found", "Unknown command", 15);
@@ -390,25 +396,85 @@ void SystemClock_Config(void)
     HAL_UART_Receive_DMA(&huart1, usart_buf, 16);
 }*/
 
-/*void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc)
+void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef *hadc)
 {
-}*/
+	// the DMA is now writing the second half of adc_buf, the first one is stable
+	TIMING_START();
+	SENS_ProcessSamples(adc_buf, ADC_BUF_LEN / 2);
+	WAVE_ProcessSamples(adc_buf, ADC_BUF_LEN / 2);
+	ALARM_ProcessSamples(adc_buf, ADC_BUF_LEN / 2);
+	TIMING_END(TIMING_ADC_CALLBACK);
+}
+
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc)
+{
+	// the DMA wrapped around and is writing the first half of adc_buf
+	TIMING_START();
+	SENS_ProcessSamples(adc_buf + ADC_BUF_LEN / 2, ADC_BUF_LEN / 2);
+	WAVE_ProcessSamples(adc_buf + ADC_BUF_LEN / 2, ADC_BUF_LEN / 2);
+	ALARM_ProcessSamples(adc_buf + ADC_BUF_LEN / 2, ADC_BUF_LEN / 2);
+	TIMING_END(TIMING_ADC_CALLBACK);
+}
 
-/*void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef *hadc)
+void HAL_ADC_LevelOutOfWindowCallback(ADC_HandleTypeDef *hadc)
 {
-	uint32_t maxx = 0, minn = 4096;
-	// 12-bit ADC must be used
-	for (uint32_t i = 0; i < ADC_BUF_LEN; i+=2)
+	// analog watchdog 1, current channel
+	ALARM_Trigger(ALARM_CURRENT);
+}
+
+void HAL_ADCEx_LevelOutOfWindow2Callback(ADC_HandleTypeDef *hadc)
+{
+	// analog watchdog 2, voltage channel
+	ALARM_Trigger(ALARM_VOLTAGE);
+}
+
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size)
+{
+	// idle line or half/full buffer: parse the new bytes of the ESP responses
+	if (huart == &STM_UART)
+		ESP8266_RxEvent(HAL_UARTEx_GetRxEventType(huart) != HAL_UART_RXEVENT_IDLE);
+}
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+	// a part of an AT command or of a response was transmitted by the DMA
+	if (huart == &STM_UART)
+		ESP8266_TxEvent();
+}
+
+/*
+Everything the main loop does besides serving the requests. Only called from the top of the main loop, never
+in the middle of an AT command wait: erasing the FLASH page stalls the CPU for tens of milliseconds and
+ALARM_Update stops the ADC for about 1 ms. It waits while a request is served
+*/
+static void MAIN_Housekeeping(void)
+{
+#ifdef ENABLE_SAVE_TO_FLASH
+	if (uwTick - energy_save_timestamp > ENERGY_SAVE_PERIOD_MS)
 	{
-		if (adc_buf[i] > maxx)
-			maxx = adc_buf[i];
-		if (adc_buf[i] < minn)
-			minn = adc_buf[i];
+		// the energy is also saved on every other FLASH write (name change, new IP)
+		FLASH_WriteSaveData();
+		energy_save_timestamp = uwTick;
 	}
+#endif
 
-	max = (float)maxx;
-	min = (float)minn;
-}*/
+	// the watchdog interrupts only latch the alarms, they're notified here
+	uint32_t alarms = ALARM_Update();
+	if (alarms & (1 << ALARM_CURRENT))
+		NOTIFICATION_Set("Allarme sovracorrente", 21);
+	if (alarms & (1 << ALARM_VOLTAGE))
+		NOTIFICATION_Set("Allarme sovratensione", 21);
+}
+
+// the IP of the ESP is asked again to the gateway at the next boot (see WIFI_SetIP)
+static void MAIN_SaveIP(void)
+{
+#ifdef ENABLE_SAVE_TO_FLASH
+	if (strncmp(savedata.ip, wifi.IP, 15) == 0) return;
+	strncpy(savedata.ip, wifi.IP, 15);
+	FLASH_WriteSaveData();
+#endif
+}
 
 /* USER CODE END 4 */
 
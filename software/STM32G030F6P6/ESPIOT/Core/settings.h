@@ -15,6 +15,8 @@ typedef uint8_t bool;
 // CHANGE THESE SETTINGS ACCORDING TO YOUR SETUP!!!
 #define STM_UART huart1
 #define UART_DMA_CHANNEL DMA1_Channel2
+// half and full buffer flags of UART_DMA_CHANNEL not served yet
+#define UART_DMA_PENDING_EVENTS() (LL_DMA_IsActiveFlag_HT2(DMA1) + LL_DMA_IsActiveFlag_TC2(DMA1))
 #define ESP_RST_PORT ESPRST_GPIO_Port
 #define ESP_RST_PIN ESPRST_Pin
 
@@ -23,6 +25,15 @@ typedef uint8_t bool;
 
 #define START_ATTEMPTS -1
 
+/**
+ * ENABLE_WARM_BOOT
+ *
+ * at boot the ESP is probed with AT, AT+CWSTATE? and AT+CIPSERVER? before resetting it: after a reset of the
+ * STM32 alone it's still connected and serving, so it's reused as it is (see WIFI_WarmStart). comment it out to
+ * always reset and configure the ESP
+ */
+#define ENABLE_WARM_BOOT
+
 // ==========================================================================================
 // 										USER DEFINES
 // ==========================================================================================
@@ -31,7 +42,68 @@ typedef uint8_t bool;
 #define STROBE_DELAY 4000
 #define STROBE_DURATION 12
 #define CURRENT_THRESHOLD 0.05 // amperes
-#define ADC_BUF_LEN 2048
+/*
+ * adc_buf is a ping-pong buffer: the DMA fills one half while SENS_ProcessSamples consumes the other
+ * one. the measurements are running sums, so a short buffer only means more frequent callbacks
+ * (64 pairs = one callback every ~58 ms). 512 pairs per half is the old 4 KB buffer
+ */
+#define ADC_BUF_PAIRS 64					// V/I pairs per half of adc_buf
+#define ADC_BUF_LEN (ADC_BUF_PAIRS * 2 * 2)
+
+/**
+ * ENABLE_CYCLE_TIMING
+ *
+ * the CPU cycles taken by the ADC DMA callbacks and by HARM_AddPair are measured with SysTick and shown by
+ * GET sampling (see timing.h). every measurement costs a few tens of cycles, uncomment it to profile the
+ * measurement code
+ */
+//#define ENABLE_CYCLE_TIMING
+
+#define MAINS_FREQUENCY_HZ 50
+#define SENS_WINDOW_CYCLES 4				// whole mains cycles integrated for every published reading
+#define SENS_WINDOW_SAMPLES 1024			// longest window (max 1024), used when no mains voltage is detected
+#define SENS_ZERO_CROSSING_THRESHOLD 16		// ADC counts of the voltage channel (~13 V of mains) seen as 0 V
+#define SENS_RATE_PERIOD_MS 10000			// the ADC sample rate is measured over this period
+#define SENS_OFFSET_AVERAGE_WINDOWS 16		// time constant (in windows) of the current offset average
+#define SENS_VOLTAGE_TIME_CONSTANT_MS 2000	// of the voltage reading (exponential average), 0 to disable
+/*
+ * 6 hours, the flash page can be erased ~10000 times. the energy counted since the last save is lost
+ * on a power cut: there is no reset path that saves it first (Error_Handler halts, nothing calls
+ * NVIC_SystemReset), so up to ENERGY_SAVE_PERIOD_MS of energy can be missing after a restart
+ */
+#define ENERGY_SAVE_PERIOD_MS 21600000
+#define WAVE_CAPTURE_PAIRS 128				// V/I pairs kept by the waveform command (4 bytes each)
+#define WAVE_MAX_CYCLES 10					// longer captures are decimated to fit WAVE_CAPTURE_PAIRS
+#define WAVE_TRIGGER_TIMEOUT_MS 100			// without a rising edge, the capture starts anyway
+#define EVT_RING_SIZE 16					// events kept for the events command (12 bytes each)
+#define EVT_STEP_MIN_MA 30					// smallest current change seen as an event
+#define EVT_STEP_PERCENT 10					// changes smaller than this percentage of the current are drift
+#define EVT_SETTLE_CYCLES 5					// stable mains cycles that end a transient
+#define EVT_MAX_TRANSIENT_MS 10000			// a transient longer than this is closed anyway
+#define HIST_SECONDS 8						// records kept by the history command (16 bytes each)
+#define HIST_MINUTES 40					// the quarters cover the rest of the hour
+#define HIST_QUARTERS 12					// 15 minutes records, 3 hours
+#define HIST_PAGE_SIZE 60					// largest number of records in a history response
+#define ALARM_CURRENT_DEFAULT 0				// mA (RMS), overcurrent alarm threshold. 0 disables the alarm
+#define ALARM_VOLTAGE_DEFAULT 253			// V (RMS), overvoltage alarm threshold, 230 V + 10%
+#define ALARM_REARM_MS 1000					// an alarm ends after this time below the threshold
+#define ALARM_OFFSET_INTERVAL_MS 60000		// the current watchdog follows the offset at most once a minute
+#define PQ_NOMINAL_VOLTAGE 230				// V, the power quality thresholds are percentages of this
+#define PQ_SAG_PERCENT 90
+#define PQ_SWELL_PERCENT 110
+#define PQ_INTERRUPTION_PERCENT 5
+#define PQ_HYSTERESIS_PERCENT 2				// an event ends this much inside the threshold
+#define PQ_LOG_SIZE 8						// last power quality events kept
+#define PQ_DAYS 7							// days of power quality counters
+
+/**
+ * sampling profiles (see sampling.c): fast = 16x oversampling, a pair every 100 us;
+ * balanced = 64x, 250 us; precision = 256x, 900.75 us (MX_ADC1_Init and MX_TIM3_Init)
+ * less oversampling means more noise, so the current dead zone depends on the profile
+ */
+#define SAMPLING_DEFAULT_PROFILE SAMPLING_PRECISION
+#define CURRENT_DEAD_ZONE_16X 0.06
+#define CURRENT_DEAD_ZONE_64X 0.04
 #define CURRENT_DEAD_ZONE 0.025		// 0.095 without OVERSAMPLING; 0.025 for 256x, 8-bit shift
 #define CURRENT_CALIB_VALUE 1.030
 #define VOLTAGE_CALIB_VALUE	0.957
@@ -66,55 +138,103 @@ static const char ESP_HOSTNAME[] = "ESPDEVICE001"; // template: ESPDEVICExxx
 #define AT_SHORT_TIMEOUT 250
 #define AT_MEDIUM_TIMEOUT 500
 #define AT_LONG_TIMEOUT 1250
+#define CIPSEND_MAX_SIZE 2048		// largest AT+CIPSEND accepted by the ESP AT firmware
+#define ESP_QUEUE_SIZE 2			// AT commands waiting to be sent by ESP8266_Process
+
+/**
+ * ENABLE_HTTP_RESPONSES
+ *
+ * the requests with an HTTP/1.x request line (curl, browsers, scrapers) are answered with an HTTP/1.1 status
+ * line, headers and Content-Length, and the link is kept alive for the next requests. the others always get the
+ * legacy "STATUS\nBODY\r\n" frame. comment it out to answer every request with the legacy frame (for the Android
+ * app versions which send an HTTP request line but parse the legacy frame)
+ */
+#define ENABLE_HTTP_RESPONSES
+
+#define WIFI_MAX_LINKS 5			// AT+CIPSERVERMAXCONN, the link IDs are 0-4
+#define LINK_IDLE_TIMEOUT_S 30		// AT+CIPSTO: the ESP closes a link without traffic for this long
+#define LINK_REQUEST_TIMEOUT_MS 2000	// a request still not served after this is dropped and its link closed
 
 // BUFFERS SIZES (in RAM)
 
 /**
  * RESPONSE_MAX_SIZE
  *
- * this buffer will contain the data to be sent FROM THIS device to the connected device
- * this could correspond to sizeof(FEATURES_TEMPLATE), because it's usually the biggest response
- * this device will send. set this according to your needs
+ * largest response sent FROM THIS device to the connected device with WIFI_SendResponse (at most
+ * CIPSEND_MAX_SIZE). this could correspond to sizeof(FEATURES_TEMPLATE), because it's usually the
+ * biggest response this device will send. it's not a buffer: status and body are sent from where they
+ * are, larger responses are streamed with WIFI_SendStream
  */
-#define RESPONSE_MAX_SIZE 512
+#define RESPONSE_MAX_SIZE 1024
 
 /**
  * REQUEST_MAX_SIZE
  *
  * if you don't expect big requests from the remote device, this buffer can be small (usually 128 bytes or less)
  */
-#define REQUEST_MAX_SIZE 64
+#define REQUEST_MAX_SIZE 192
+
+/**
+ * RECV_CHUNK_SIZE
+ *
+ * the data of the clients is pulled from the ESP with AT+CIPRECVDATA at most RECV_CHUNK_SIZE bytes at a time:
+ * a request can be longer than UART_BUFFER_SIZE (its headers must fit in WIFI_BUF_MAX_SIZE, the body is
+ * read by the handler). it's also the size of Connection_t.carry
+ */
+#define RECV_CHUNK_SIZE 128
 
 /**
  * WIFI_BUF_MAX_SIZE
  *
  * contains short commands to be sent to the ESP, for example to connect it to WiFi, to get the current IP...
  * (check esp8266.c)
+ * it also holds the formatted FEATURES_TEMPLATE, so it must be larger than the features response
  * if you don't use it directly, it can be left at the default value.
  * NOTE: this can contain the network SSID and PASSWORD, so if those strings are larger than this buffer,
  * the network name and/or its password will be truncated, resulting in no WiFi connection!
  */
-#define WIFI_BUF_MAX_SIZE 128
+#define WIFI_BUF_MAX_SIZE 768
 
 /**
  * UART_BUFFER_SIZE
  *
  * if you have to retrieve large amounts of data (i.e. from an API), set this to the minimum size of the response
  * otherwise, it can be smaller.
- * if you don't have these requirements, you can set it to a minimum of
- * REQUEST_MAX_SIZE + some headroom to avoid receiving only partial messages
  * if you encounter weird behaviors at runtime, try increasing this buffer size
+ * it's a ring: a response is lost (see GET wifi=rx) if the ESP sends UART_BUFFER_SIZE more bytes before it's
+ * read. the requests are pulled RECV_CHUNK_SIZE bytes at a time, so it must be larger than that plus the
+ * "+CIPRECVDATA" header and the "OK" that follow
  */
-#define UART_BUFFER_SIZE 128
+#define UART_BUFFER_SIZE 256
+
+/**
+ * BUFFERS_RAM_BUDGET
+ *
+ * adc_buf, uart_buffer, Connection_t, WIFI_t, the waveform capture and the history are the largest objects
+ * in RAM, their total size is checked at compile time (see main.c). the rest is left for the HAL handles and
+ * the other modules. the whole RAM is checked after the link (cmake/ram_check.cmake): the static RAM, the
+ * heap (512 bytes) and the stack (1 KB, see ESPIOT.ioc) must fit in the 8 KB of the STM32G030
+ */
+#define BUFFERS_RAM_BUDGET 4096
 
 #define HOSTNAME_MAX_SIZE 32		// ESPDEVICExxx
 #define NAME_MAX_SIZE 32			// human-readable name
 
 #define UART_TX_TIMEOUT 500			// ms
+
+/**
+ * ENABLE_UART_TX_DMA
+ *
+ * the AT commands and the responses are transmitted by the DMA, the CPU is free while they are sent.
+ * comment it out to transmit them with HAL_UART_Transmit (the CPU time of both is shown by GET wifi=tx)
+ */
+#define ENABLE_UART_TX_DMA
 #define UART_RX_IDLE_TIMEOUT 3000	// ms
 
-#define RECONNECTION_DELAY_MINS 1	// minutes
-#define RECONNECTION_DELAY_MILLIS RECONNECTION_DELAY_MINS * 60000
+// see WIFI_Supervise: after a disconnection AT+CWJAP is retried with a backoff doubled at every failure
+#define WIFI_BACKOFF_MIN_MS 2000
+#define WIFI_BACKOFF_MAX_MS 300000	// 5 minutes
+#define WIFI_JOIN_TIMEOUT 20000		// ms, AT+CWJAP
 
 typedef struct notif
 {
@@ -137,8 +257,16 @@ typedef struct sdata
 {
 	char name[NAME_MAX_SIZE];
 	char ip[15 + 1];
+	uint32_t magic;			// SAVEDATA_MAGIC if the fields below have been written
+	uint64_t energy;		// microjoules (see SENS_GetEnergy)
+	uint32_t alarm_magic;	// ALARMDATA_MAGIC if the thresholds below have been written
+	uint32_t alarm_current;	// mA (see alarm.h)
+	uint32_t alarm_voltage;	// V
 } SaveData_t;
 
+#define SAVEDATA_MAGIC 0x45535031
+#define ALARMDATA_MAGIC 0x414C4D31
+
 extern SaveData_t savedata;
 #endif
 
@@ -186,12 +314,46 @@ extern uint32_t feature_current_integer_part;
 extern uint32_t feature_current_decimal_part;
 extern uint32_t feature_power_integer_part;
 extern uint32_t feature_power_decimal_part;
+extern uint32_t feature_apparent_power_integer_part;
+extern uint32_t feature_apparent_power_decimal_part;
+extern uint32_t feature_reactive_power_integer_part;
+extern uint32_t feature_reactive_power_decimal_part;
+extern uint32_t feature_power_factor_integer_part;
+extern uint32_t feature_power_factor_decimal_part;
+extern uint32_t feature_frequency_integer_part;
+extern uint32_t feature_frequency_decimal_part;
+extern uint32_t feature_energy_integer_part;
+extern uint32_t feature_energy_decimal_part;
+extern uint32_t feature_current_thd_integer_part;
+extern uint32_t feature_current_thd_decimal_part;
+extern uint32_t feature_voltage_thd_integer_part;
+extern uint32_t feature_voltage_thd_decimal_part;
+extern uint32_t feature_current_harmonics[];						// mA, see HARM_ORDER
+extern uint32_t feature_voltage_harmonics_integer_part[];
+extern uint32_t feature_voltage_harmonics_decimal_part[];
 
 static const char FEATURES_TEMPLATE[] =
 {
 		"sensor1$Tensione$%d V;"
-		"sensor2$Corrente$%d.%d A;"
-		"sensor3$Potenza$%d.%d W;"
+		"sensor2$Corrente$%d.%02d A;"
+		"sensor3$Potenza$%d.%02d W;"
+		"sensor4$Potenza apparente$%d.%02d VA;"
+		"sensor5$Potenza reattiva$%d.%02d var;"
+		"sensor6$Fattore di potenza$%d.%02d;"
+		"sensor7$Frequenza$%d.%02d Hz;"
+		"sensor8$Energia$%d.%02d Wh;"
+		"sensor9$THD corrente$%d.%d %%;"
+		"sensor10$THD tensione$%d.%d %%;"
+		"sensor11$Corrente H1$%d mA;"
+		"sensor12$Corrente H3$%d mA;"
+		"sensor13$Corrente H5$%d mA;"
+		"sensor14$Corrente H7$%d mA;"
+		"sensor15$Corrente H9$%d mA;"
+		"sensor16$Tensione H1$%d.%d V;"
+		"sensor17$Tensione H3$%d.%d V;"
+		"sensor18$Tensione H5$%d.%d V;"
+		"sensor19$Tensione H7$%d.%d V;"
+		"sensor20$Tensione H9$%d.%d V;"
 		"external1$1;"
 		"timestamp1$Tempo CPU$%d;"
 };
@@ -7,6 +7,15 @@
 
 #include "wifihandler.h"
 #include "../Flash/flash.h"
+#include "../Sensor/sensor.h"
+#include "../Sensor/sampling.h"
+#include "../Sensor/waveform.h"
+#include "../Sensor/calibration.h"
+#include "../Sensor/events.h"
+#include "../Sensor/history.h"
+#include "../Sensor/alarm.h"
+#include "../Sensor/quality.h"
+#include "../Sensor/timing.h"
 
 Notification_t notification;
 
@@ -35,6 +44,463 @@ Response_t WIFIHANDLER_HandleNotificationRequest(Connection_t* conn, char* key_p
 	return WIFI_SendResponse(conn, "400 Bad Request", "Sono supportate solo richieste NOTIFICATION GET", 47);
 }
 
+Response_t WIFIHANDLER_HandleSamplingRequest(Connection_t* conn, char* key_ptr)
+{
+	if (conn->request_type == POST)
+	{
+		uint32_t name_size = 0;
+		char* name_ptr = WIFI_GetKeyValue(conn, key_ptr, &name_size);
+		if (name_ptr == NULL)
+			return WIFI_SendResponse(conn, "400 Bad Request", "Profilo non trovato", 19);
+
+		uint32_t profile = SAMPLING_FindProfile(name_ptr, name_size);
+		if (profile == SAMPLING_PROFILES)
+			return WIFI_SendResponse(conn, "400 Bad Request", "Profilo non riconosciuto. "
+					"Profili: fast, balanced, precision", 60);
+
+		SAMPLING_SetProfile(profile);
+		return WIFI_SendResponse(conn, "200 OK", "Profilo cambiato", 16);
+	}
+	else if (conn->request_type == GET)
+	{
+		const SamplingProfile_t* profile = &sampling_profiles[SAMPLING_GetProfile()];
+		// nominal timing of the profile, the measured sample rate is in the window snapshot
+		uint32_t length = sprintf(conn->wifi->buf, "%s\nperiodo coppia: %" PRIu32 " ns\nprofili: fast, balanced, precision",
+				profile->name, profile->pair_period_ns);
+#ifdef ENABLE_CYCLE_TIMING
+		// CPU cycles of a callback (ADC_BUF_PAIRS pairs) and of the harmonic filters of a pair, since boot
+		static const char* const timing_names[TIMING_POINTS] = { "callback ADC", "HARM_AddPair" };
+		for (uint32_t i = 0; i < TIMING_POINTS; i++)
+		{
+			TIMING_Stats_t stats;
+			TIMING_GetStats(i, &stats);
+			if (stats.count > 0)
+				length += sprintf(conn->wifi->buf + length, "\n%s: media %" PRIu32 " cicli, max %" PRIu32 " cicli",
+						timing_names[i], (uint32_t)(stats.total / stats.count), stats.max);
+		}
+#endif
+		return WIFI_SendResponse(conn, "200 OK", conn->wifi->buf, length);
+	}
+
+	return ERR;
+}
+
+typedef struct
+{
+	const WAVE_Capture_t*	capture;
+	bool					csv;
+	bool					header_sent;
+	uint32_t				next;		// bin: byte of the samples, csv: pair
+} WIFIHANDLER_WaveformStream_t;
+
+/*
+ * header line, then the samples
+ * bin: little endian uint16_t current, voltage for every pair
+ * csv: a "current,voltage" line for every pair
+ */
+static int32_t WIFIHANDLER_WaveformGenerator(char* buf, uint32_t size, void* context)
+{
+	WIFIHANDLER_WaveformStream_t* stream = (WIFIHANDLER_WaveformStream_t*)context;
+	const WAVE_Capture_t* capture = stream->capture;
+	if (!stream->header_sent)
+	{
+		stream->header_sent = true;
+		return sprintf(buf, "coppie=%" PRIu32 " periodo_ns=%" PRIu32 " formato=%s\n",
+				capture->pairs, capture->period_ns, stream->csv ? "csv" : "bin");
+	}
+
+	uint32_t written = 0;
+	if (!stream->csv)
+	{
+		uint32_t total = capture->pairs * 2 * sizeof(uint16_t);
+		written = (total - stream->next < size) ? total - stream->next : size;
+		memcpy(buf, (const uint8_t*)capture->samples + stream->next, written);
+		stream->next += written;
+	}
+	else
+	{
+		// a line is at most "4095,4095\n"
+		for (; stream->next < capture->pairs && written + 11 <= size; stream->next++)
+		{
+			written += sprintf(buf + written, "%u,%u\n", capture->samples[stream->next * 2 + SENS_CURRENT_OFFSET],
+					capture->samples[stream->next * 2 + SENS_VOLTAGE_OFFSET]);
+		}
+	}
+	return written;
+}
+
+Response_t WIFIHANDLER_HandleWaveformRequest(Connection_t* conn, char* key_ptr)
+{
+	if (conn->request_type != GET)
+		return WIFI_SendResponse(conn, "400 Bad Request", "Sono supportate solo richieste WAVEFORM GET", 43);
+
+	bool csv = WIFI_RequestKeyHasValue(conn, key_ptr, "csv") != NULL;
+	if (!csv && WIFI_RequestKeyHasValue(conn, key_ptr, "bin") == NULL)
+		return WIFI_SendResponse(conn, "400 Bad Request", "Formato non riconosciuto. Formati: bin, csv", 43);
+
+	int32_t cycles = 1;
+	char* cycles_ptr = WIFI_RequestHasKey(conn, "cycles");
+	if (cycles_ptr != NULL)
+	{
+		uint32_t cycles_size = 0;
+		cycles_ptr = WIFI_GetKeyValue(conn, cycles_ptr, &cycles_size);
+		cycles = bufferToInt(cycles_ptr, cycles_size);
+		if (cycles < 1 || cycles > WAVE_MAX_CYCLES)
+			return WIFI_SendResponse(conn, "400 Bad Request", "Numero di cicli non valido", 26);
+	}
+
+	WAVE_Capture_t capture;
+	if (!WAVE_Capture(cycles, &capture))
+		return WIFI_SendResponse(conn, "500 Internal server error", "ADC fermo", 9);
+
+	// the capture can be larger than RESPONSE_MAX_SIZE, so it's streamed
+	WIFIHANDLER_WaveformStream_t stream = { &capture, csv, false, 0 };
+	return WIFI_SendStream(conn, "200 OK", WIFIHANDLER_WaveformGenerator, &stream);
+}
+
+// body of calibration=points: "current=<raw>,<mA>&voltage=<raw>,<mV>&..."
+static Response_t WIFIHANDLER_AddCalibrationPoint(const char* key, const char* value, void* context)
+{
+	bool* cleared = (bool*)context;
+	uint32_t channel;
+	if (strcmp(key, "current") == 0) channel = CAL_CURRENT;
+	else if (strcmp(key, "voltage") == 0) channel = CAL_VOLTAGE;
+	else return ERR;
+
+	const char* comma = strchr(value, ',');
+	if (comma == NULL) return ERR;
+	int32_t raw = bufferToInt((char*)value, comma - value);
+	int32_t reference = bufferToInt((char*)comma + 1, strlen(comma + 1));
+	if (raw <= 0 || reference <= 0) return ERR;
+
+	// the uploaded points replace the whole table of their channel
+	if (!cleared[channel])
+	{
+		CAL_Reset(channel);
+		cleared[channel] = true;
+	}
+	CAL_AddPoint(channel, raw, (channel == CAL_CURRENT) ? (uint32_t)reference * 1000 : (uint32_t)reference);
+	return OK;
+}
+
+Response_t WIFIHANDLER_HandleCalibrationRequest(Connection_t* conn, char* key_ptr)
+{
+	if (conn->request_type == POST)
+	{
+		if (WIFI_RequestKeyHasValue(conn, key_ptr, "resetcurrent"))
+			CAL_Reset(CAL_CURRENT);
+		else if (WIFI_RequestKeyHasValue(conn, key_ptr, "resetvoltage"))
+			CAL_Reset(CAL_VOLTAGE);
+		else if (WIFI_RequestKeyHasValue(conn, key_ptr, "points"))
+		{
+			// the points are streamed from the body, it can be longer than the receive buffer
+			bool cleared[CAL_CHANNELS] = { false };
+			Response_t status = WIFI_ParseBody(conn, WIFIHANDLER_AddCalibrationPoint, cleared);
+			if (status == TIMEOUT) return status;
+			if (status != OK)
+				return WIFI_SendResponse(conn, "400 Bad Request", "Punti di calibrazione non validi", 32);
+			if (!cleared[CAL_CURRENT] && !cleared[CAL_VOLTAGE])
+				return WIFI_SendResponse(conn, "400 Bad Request", "Nessun punto", 12);
+		}
+		else
+		{
+			// the load connected now is known to draw reference mA (current) or to be at reference mV (voltage)
+			uint32_t channel;
+			uint32_t raw;
+			if (WIFI_RequestKeyHasValue(conn, key_ptr, "current"))
+			{
+				channel = CAL_CURRENT;
+				raw = SENS_GetRawCurrent();
+			}
+			else if (WIFI_RequestKeyHasValue(conn, key_ptr, "voltage"))
+			{
+				channel = CAL_VOLTAGE;
+				raw = SENS_GetRawVoltage();
+			}
+			else return WIFI_SendResponse(conn, "400 Bad Request", "Comando di calibrazione non riconosciuto. "
+					"Comandi: current, voltage, points, resetcurrent, resetvoltage", 103);
+
+			char* reference_ptr = WIFI_RequestHasKey(conn, "reference");
+			uint32_t reference_size = 0;
+			reference_ptr = WIFI_GetKeyValue(conn, reference_ptr, &reference_size);
+			int32_t reference = bufferToInt(reference_ptr, reference_size);
+			if (reference <= 0)
+				return WIFI_SendResponse(conn, "400 Bad Request", "Chiave \"reference\" non valida", 29);
+			if (raw == 0)
+				return WIFI_SendResponse(conn, "400 Bad Request", "Nessuna lettura", 15);
+
+			// current points are in uA
+			CAL_AddPoint(channel, raw, (channel == CAL_CURRENT) ? (uint32_t)reference * 1000 : (uint32_t)reference);
+		}
+#ifdef ENABLE_SAVE_TO_FLASH
+		FLASH_WriteSaveData();	// save calibration
+#endif
+		return WIFI_SendResponse(conn, "200 OK", "Calibrazione salvata", 20);
+	}
+	else if (conn->request_type == GET)
+	{
+		// raw reading and scale (x10000) of every point
+		uint32_t size = 0;
+		for (uint32_t channel = 0; channel < CAL_CHANNELS; channel++)
+		{
+			const CAL_Table_t* table = CAL_GetTable(channel);
+			size += sprintf(conn->wifi->buf + size, "%s%s\n", (channel == CAL_CURRENT) ? "corrente uA" : "tensione mV",
+					table->recorded ? "" : " (predefinita)");
+			for (uint32_t i = 0; i < table->count; i++)
+			{
+				size += sprintf(conn->wifi->buf + size, "%" PRIu32 " %" PRIu32 "\n", table->points[i].raw,
+						(uint32_t)(((uint64_t)table->points[i].scale * 10000 + 32768) >> 16));
+			}
+		}
+		return WIFI_SendResponse(conn, "200 OK", conn->wifi->buf, size);
+	}
+
+	return ERR;
+}
+
+Response_t WIFIHANDLER_HandleEventsRequest(Connection_t* conn, char* key_ptr)
+{
+	if (conn->request_type != GET)
+		return WIFI_SendResponse(conn, "400 Bad Request", "Sono supportate solo richieste EVENTS GET", 41);
+
+	// events=<sequence>: the events from this sequence number on (the "next" of the previous response)
+	uint32_t sequence = 0;
+	uint32_t sequence_size = 0;
+	char* sequence_ptr = WIFI_GetKeyValue(conn, key_ptr, &sequence_size);
+	if (sequence_ptr != NULL && sequence_size > 0)
+	{
+		int32_t value = bufferToInt(sequence_ptr, sequence_size);
+		if (value < 0)
+			return WIFI_SendResponse(conn, "400 Bad Request", "Numero di sequenza non valido", 29);
+		sequence = value;
+	}
+
+	// local time at uwTick = last_time_read, to convert the ticks of the events
+	WIFI_GetTime(conn->wifi);
+
+	char* buf = conn->wifi->buf;
+	uint32_t size = sprintf(buf, "tick=%" PRIu32 " ora=%s\n", (uint32_t)conn->wifi->last_time_read, conn->wifi->time);
+	// a sequence past the next one was given before a reset of the device: all the events kept are new
+	if ((int32_t)(sequence - EVT_GetNextSequence()) > 0)
+		sequence = 0;
+
+	uint32_t lost = 0;
+	EVT_Event_t event;
+	uint32_t status;
+	// a line is at most 47 characters, the last line is the next sequence number
+	while (size < WIFI_BUF_MAX_SIZE - 2 * 48 && (status = EVT_Read(sequence, &event)) != EVT_READ_EMPTY)
+	{
+		if (status == EVT_READ_LOST)
+		{
+			// the overwritten events are skipped at once, up to the oldest one kept
+			uint32_t oldest = EVT_GetNextSequence() - EVT_RING_SIZE;
+			lost += oldest - sequence;
+			sequence = oldest;
+			continue;
+		}
+		// sequence tick type mA mA ms
+		size += sprintf(buf + size, "%" PRIu32 " %" PRIu32 " %s %u %u %u\n", sequence, event.tick,
+				EVT_GetTypeName(event.type), event.value, event.previous, event.duration);
+		sequence++;
+	}
+	size += sprintf(buf + size, "next=%" PRIu32 " persi=%" PRIu32, sequence, lost);
+
+	return WIFI_SendResponse(conn, "200 OK", buf, size);
+}
+
+Response_t WIFIHANDLER_HandleQualityRequest(Connection_t* conn, char* key_ptr)
+{
+	if (conn->request_type != GET)
+		return WIFI_SendResponse(conn, "400 Bad Request", "Sono supportate solo richieste QUALITY GET", 42);
+
+	// local time at uwTick = last_time_read, to convert the ticks of the days and of the events
+	WIFI_GetTime(conn->wifi);
+
+	char* buf = conn->wifi->buf;
+	uint32_t size = sprintf(buf, "tick=%" PRIu32 " ora=%s inizio_giorno=%" PRIu32 "\n",
+			(uint32_t)conn->wifi->last_time_read, conn->wifi->time, PQ_GetDayStart());
+
+	// counters from today backwards
+	size += sprintf(buf + size, "giorni (buchi sovratensioni interruzioni):");
+	for (uint32_t day = 0; day < PQ_DAYS; day++)
+	{
+		size += sprintf(buf + size, "%s %" PRIu32 " %" PRIu32 " %" PRIu32, (day == 0) ? "" : ",",
+				PQ_GetCount(day, PQ_SAG), PQ_GetCount(day, PQ_SWELL), PQ_GetCount(day, PQ_INTERRUPTION));
+	}
+
+	// the ongoing event first, then the last ones from the newest
+	size += sprintf(buf + size, "\neventi (tick tipo durata_ms V):\n");
+	PQ_Event_t event;
+	bool ongoing = PQ_GetOngoing(&event);
+	for (uint32_t age = 0; ongoing || PQ_GetEvent(age, &event); )
+	{
+		size += sprintf(buf + size, "%" PRIu32 " %s %" PRIu32 " %" PRIu32 ".%" PRIu32 "%s\n", event.tick,
+				PQ_GetTypeName(event.type), event.duration, event.extreme / 1000, event.extreme % 1000 / 100,
+				ongoing ? " in corso" : "");
+		if (ongoing) ongoing = false;
+		else age++;
+	}
+
+	return WIFI_SendResponse(conn, "200 OK", buf, size);
+}
+
+Response_t WIFIHANDLER_HandleAlarmRequest(Connection_t* conn, char* key_ptr)
+{
+	if (conn->request_type == POST)
+	{
+		if (WIFI_RequestKeyHasValue(conn, key_ptr, "clear"))
+		{
+			ALARM_Clear();
+			NOTIFICATION_Reset();
+			return WIFI_SendResponse(conn, "200 OK", "Allarmi azzerati", 16);
+		}
+
+		// alarm=current&value=<mA> or alarm=voltage&value=<V>, RMS values. 0 disables the alarm
+		uint32_t type;
+		if (WIFI_RequestKeyHasValue(conn, key_ptr, "current"))
+			type = ALARM_CURRENT;
+		else if (WIFI_RequestKeyHasValue(conn, key_ptr, "voltage"))
+			type = ALARM_VOLTAGE;
+		else return WIFI_SendResponse(conn, "400 Bad Request", "Comando di allarme non riconosciuto. "
+				"Comandi: current, voltage, clear", 69);
+
+		char* value_ptr = WIFI_RequestHasKey(conn, "value");
+		uint32_t value_size = 0;
+		value_ptr = WIFI_GetKeyValue(conn, value_ptr, &value_size);
+		int32_t value = bufferToInt(value_ptr, value_size);
+		if (value < 0)
+			return WIFI_SendResponse(conn, "400 Bad Request", "Chiave \"value\" non valida", 25);
+
+		ALARM_SetThreshold(type, value);	// written to the ADC by ALARM_Update
+#ifdef ENABLE_SAVE_TO_FLASH
+		FLASH_WriteSaveData();	// save thresholds
+#endif
+		return WIFI_SendResponse(conn, "200 OK", "Soglia cambiata", 15);
+	}
+	else if (conn->request_type == GET)
+	{
+		// local time at uwTick = last_time_read, to convert the ticks of the alarms
+		WIFI_GetTime(conn->wifi);
+
+		char* buf = conn->wifi->buf;
+		uint32_t size = sprintf(buf, "tick=%" PRIu32 " ora=%s\n", (uint32_t)conn->wifi->last_time_read, conn->wifi->time);
+		for (uint32_t type = 0; type < ALARM_TYPES; type++)
+		{
+			const char* unit = (type == ALARM_CURRENT) ? "mA" : "V";
+			ALARM_Alarm_t alarm;
+			size += sprintf(buf + size, "%s: soglia %" PRIu32 " %s", (type == ALARM_CURRENT) ? "corrente" : "tensione",
+					ALARM_GetThreshold(type), unit);
+			if (ALARM_Get(type, &alarm))
+			{
+				// last alarm: start, peak and duration, which is known when the alarm ends
+				size += sprintf(buf + size, ", allarmi %" PRIu32 ", ultimo tick %" PRIu32 ", picco %" PRIu32 " %s",
+						alarm.count, alarm.tick, alarm.peak, unit);
+				if (alarm.active)
+					size += sprintf(buf + size, ", in corso");
+				else
+					size += sprintf(buf + size, ", durata %" PRIu32 " ms", alarm.duration);
+			}
+			size += sprintf(buf + size, "\n");
+		}
+		return WIFI_SendResponse(conn, "200 OK", buf, size);
+	}
+
+	return ERR;
+}
+
+typedef struct
+{
+	WIFI_t*		wifi;
+	uint32_t	resolution;
+	uint32_t	available;
+	int32_t		count;
+	int32_t		offset;
+	int32_t		age;		// of the next record
+	bool		header_sent;
+} WIFIHANDLER_HistoryStream_t;
+
+/*
+ * header line, then a line for every record from the oldest to the newest
+ * tick at the end of the record,readings,mA min,avg,max,W min,avg,max,V min,avg,max
+ */
+static int32_t WIFIHANDLER_HistoryGenerator(char* buf, uint32_t size, void* context)
+{
+	WIFIHANDLER_HistoryStream_t* stream = (WIFIHANDLER_HistoryStream_t*)context;
+	if (!stream->header_sent)
+	{
+		stream->header_sent = true;
+		return sprintf(buf, "tick=%" PRIu32 " ora=%s periodo_ms=%" PRIu32 " totale=%" PRIu32 " record=%" PRIu32 "\n",
+				(uint32_t)stream->wifi->last_time_read, stream->wifi->time, HIST_GetPeriod(stream->resolution),
+				stream->available, (uint32_t)stream->count);
+	}
+
+	uint32_t written = 0;
+	HIST_Record_t record;
+	// a line is at most 66 characters
+	for (; stream->age >= stream->offset && written + 67 <= size; stream->age--)
+	{
+		uint32_t tick = HIST_Read(stream->resolution, stream->age, &record);
+		written += sprintf(buf + written, "%" PRIu32 ",%u,%u,%u,%u,%u.%u,%u.%u,%u.%u,%u,%u,%u\n", tick, record.samples,
+				record.current_min, record.current_avg, record.current_max,
+				record.power_min / 10, record.power_min % 10, record.power_avg / 10, record.power_avg % 10,
+				record.power_max / 10, record.power_max % 10,
+				record.voltage_min, record.voltage_avg, record.voltage_max);
+	}
+	return written;
+}
+
+Response_t WIFIHANDLER_HandleHistoryRequest(Connection_t* conn, char* key_ptr)
+{
+	if (conn->request_type != GET)
+		return WIFI_SendResponse(conn, "400 Bad Request", "Sono supportate solo richieste HISTORY GET", 42);
+
+	uint32_t resolution;
+	if (WIFI_RequestKeyHasValue(conn, key_ptr, "s"))
+		resolution = HIST_SECOND;
+	else if (WIFI_RequestKeyHasValue(conn, key_ptr, "m"))
+		resolution = HIST_MINUTE;
+	else if (WIFI_RequestKeyHasValue(conn, key_ptr, "q"))
+		resolution = HIST_QUARTER;
+	else
+		return WIFI_SendResponse(conn, "400 Bad Request", "Risoluzione non riconosciuta. Risoluzioni: s, m, q", 50);
+
+	// offset=<records to skip from the newest one>&count=<records>, at most HIST_PAGE_SIZE per request
+	int32_t offset = 0;
+	char* offset_ptr = WIFI_RequestHasKey(conn, "offset");
+	if (offset_ptr != NULL)
+	{
+		uint32_t offset_size = 0;
+		offset_ptr = WIFI_GetKeyValue(conn, offset_ptr, &offset_size);
+		offset = bufferToInt(offset_ptr, offset_size);
+		if (offset < 0)
+			return WIFI_SendResponse(conn, "400 Bad Request", "Offset non valido", 17);
+	}
+
+	int32_t count = HIST_PAGE_SIZE;
+	char* count_ptr = WIFI_RequestHasKey(conn, "count");
+	if (count_ptr != NULL)
+	{
+		uint32_t count_size = 0;
+		count_ptr = WIFI_GetKeyValue(conn, count_ptr, &count_size);
+		count = bufferToInt(count_ptr, count_size);
+		if (count < 1 || count > HIST_PAGE_SIZE)
+			return WIFI_SendResponse(conn, "400 Bad Request", "Numero di record non valido", 27);
+	}
+
+	uint32_t available = HIST_GetCount(resolution);
+	if ((uint32_t)offset >= available)
+		count = 0;
+	else if ((uint32_t)(offset + count) > available)
+		count = available - offset;
+
+	// local time at uwTick = last_time_read, to convert the ticks of the records
+	WIFI_GetTime(conn->wifi);
+
+	// a page can be larger than RESPONSE_MAX_SIZE, so it's streamed like the waveform
+	WIFIHANDLER_HistoryStream_t stream = { conn->wifi, resolution, available, count, offset, offset + count - 1, false };
+	return WIFI_SendStream(conn, "200 OK", WIFIHANDLER_HistoryGenerator, &stream);
+}
+
 Response_t WIFIHANDLER_HandleWiFiRequest(Connection_t* conn, char* command_ptr)
 {
 	if (conn->request_type == POST)
@@ -61,6 +527,14 @@ Response_t WIFIHANDLER_HandleWiFiRequest(Connection_t* conn, char* command_ptr)
 			}
 
 		}
+		else if (WIFI_RequestKeyHasValue(conn, command_ptr, "resetenergy"))
+		{
+			SENS_SetEnergy(0);
+#ifdef ENABLE_SAVE_TO_FLASH
+			FLASH_WriteSaveData();	// save energy
+#endif
+			return WIFI_SendResponse(conn, "200 OK", "Energia azzerata", 16);
+		}
 		else return WIFI_SendResponse(conn, "400 Bad Request", "Comando POST WiFi non riconosciuto. "
 			"Scrivi wifi=help per una lista di comandi", 77);
 	}
@@ -99,6 +573,69 @@ Response_t WIFIHANDLER_HandleWiFiRequest(Connection_t* conn, char* command_ptr)
 					"\nrequest: %s", conn->connection_number, conn->request_size, conn->request);
 			return WIFI_SendResponse(conn, "200 OK", conn->wifi->buf, strlen(conn->wifi->buf));
 		}
+		else if (WIFI_RequestKeyHasValue(conn, command_ptr, "at"))
+		{
+			// latency of the AT commands, from the start of the transmission to the end of the response
+			ESP8266_Latency_t latency;
+			ESP8266_GetLatency(&latency);
+			uint32_t completed = latency.commands - latency.timeouts;
+			uint32_t size = sprintf(conn->wifi->buf, "comandi=%" PRIu32 " timeout=%" PRIu32 " ultimo_us=%" PRIu32
+					" max_us=%" PRIu32 " medio_us=%" PRIu32, latency.commands, latency.timeouts, latency.last_us,
+					latency.max_us, (completed > 0) ? (uint32_t)(latency.total_us / completed) : 0);
+			return WIFI_SendResponse(conn, "200 OK", conn->wifi->buf, size);
+		}
+		else if (WIFI_RequestKeyHasValue(conn, command_ptr, "rx"))
+		{
+			// UART ring of the ESP responses
+			ESP8266_RxStats_t stats;
+			ESP8266_GetRxStats(&stats);
+			uint32_t size = sprintf(conn->wifi->buf, "ricevuti=%" PRIu32 " giri=%" PRIu32 " persi=%" PRIu32,
+					stats.received, stats.wraps, stats.overruns);
+			return WIFI_SendResponse(conn, "200 OK", conn->wifi->buf, size);
+		}
+		else if (WIFI_RequestKeyHasValue(conn, command_ptr, "links"))
+		{
+			// clients connected to the server, one character per link: 1 connected, 0 free
+			WIFI_LinkStats_t stats;
+			WIFI_GetLinkStats(&stats);
+			char links[WIFI_MAX_LINKS + 1];
+			for (uint32_t i = 0; i < WIFI_MAX_LINKS; i++)
+				links[i] = (stats.open & (1 << i)) ? '1' : '0';
+			links[WIFI_MAX_LINKS] = '\0';
+			uint32_t size = sprintf(conn->wifi->buf, "link=%s attuale=%d in_attesa=%d scaduti=%" PRIu32,
+					links, conn->connection_number, stats.waiting, stats.expired);
+			return WIFI_SendResponse(conn, "200 OK", conn->wifi->buf, size);
+		}
+		else if (WIFI_RequestKeyHasValue(conn, command_ptr, "tx"))
+		{
+			// CPU time per response (AT+CIPSEND and data), see ENABLE_UART_TX_DMA. this response is not counted yet
+			ESP8266_TxStats_t stats;
+			ESP8266_GetTxStats(&stats);
+			uint32_t size = sprintf(conn->wifi->buf, "risposte=%" PRIu32 " ultimo_us=%" PRIu32 " max_us=%" PRIu32
+					" medio_us=%" PRIu32, stats.responses, stats.last_cpu_us, stats.max_cpu_us,
+					(stats.responses > 0) ? (uint32_t)(stats.total_cpu_us / stats.responses) : 0);
+			return WIFI_SendResponse(conn, "200 OK", conn->wifi->buf, size);
+		}
+		else if (WIFI_RequestKeyHasValue(conn, command_ptr, "boot"))
+		{
+			// ms from the boot: samples are measured before the network is ready (see ENABLE_WARM_BOOT)
+			WIFI_BootStats_t stats;
+			WIFI_GetBootStats(&stats);
+			uint32_t size = sprintf(conn->wifi->buf, "avvio=%s campione_ms=%" PRIu32 " rete_ms=%" PRIu32
+					" risposta_ms=%" PRIu32, stats.warm ? "caldo" : "freddo", SENS_GetFirstSampleTick(),
+					stats.network_ms, stats.first_response_ms);
+			return WIFI_SendResponse(conn, "200 OK", conn->wifi->buf, size);
+		}
+		else if (WIFI_RequestKeyHasValue(conn, command_ptr, "health"))
+		{
+			// the measurements go on while offline, the outages are only seen here
+			WIFI_HealthStats_t stats;
+			WIFI_GetHealthStats(&stats);
+			uint32_t size = sprintf(conn->wifi->buf, "connesso=%d riconnessioni=%" PRIu32 " tentativi=%" PRIu32
+					" offline_ms=%" PRIu32 " prossimo_ms=%" PRIu32, stats.online, stats.reconnects, stats.attempts,
+					stats.downtime_ms, stats.next_attempt_ms);
+			return WIFI_SendResponse(conn, "200 OK", conn->wifi->buf, size);
+		}
 		else return WIFI_SendResponse(conn, "400 Bad Request", "Comando GET WiFi non riconosciuto. "
 				"Scrivi wifi=help per una lista di comandi", 76);
 	}
@@ -111,14 +648,45 @@ uint32_t feature_current_integer_part;
 uint32_t feature_current_decimal_part;
 uint32_t feature_power_integer_part;
 uint32_t feature_power_decimal_part;
+uint32_t feature_apparent_power_integer_part;
+uint32_t feature_apparent_power_decimal_part;
+uint32_t feature_reactive_power_integer_part;
+uint32_t feature_reactive_power_decimal_part;
+uint32_t feature_power_factor_integer_part;
+uint32_t feature_power_factor_decimal_part;
+uint32_t feature_frequency_integer_part;
+uint32_t feature_frequency_decimal_part;
+uint32_t feature_energy_integer_part;
+uint32_t feature_energy_decimal_part;
+uint32_t feature_current_thd_integer_part;
+uint32_t feature_current_thd_decimal_part;
+uint32_t feature_voltage_thd_integer_part;
+uint32_t feature_voltage_thd_decimal_part;
+uint32_t feature_current_harmonics[HARM_COUNT];
+uint32_t feature_voltage_harmonics_integer_part[HARM_COUNT];
+uint32_t feature_voltage_harmonics_decimal_part[HARM_COUNT];
 
 Response_t WIFIHANDLER_HandleFeaturePacket(Connection_t* conn, char* features_template)
 {
 	memset(conn->wifi->buf, 0, WIFI_BUF_MAX_SIZE);
-	sprintf(conn->wifi->buf, features_template,
+	snprintf(conn->wifi->buf, WIFI_BUF_MAX_SIZE, features_template,
 			feature_voltage,
 			feature_current_integer_part, feature_current_decimal_part,
 			feature_power_integer_part, feature_power_decimal_part,
+			feature_apparent_power_integer_part, feature_apparent_power_decimal_part,
+			feature_reactive_power_integer_part, feature_reactive_power_decimal_part,
+			feature_power_factor_integer_part, feature_power_factor_decimal_part,
+			feature_frequency_integer_part, feature_frequency_decimal_part,
+			feature_energy_integer_part, feature_energy_decimal_part,
+			feature_current_thd_integer_part, feature_current_thd_decimal_part,
+			feature_voltage_thd_integer_part, feature_voltage_thd_decimal_part,
+			feature_current_harmonics[0], feature_current_harmonics[1], feature_current_harmonics[2],
+			feature_current_harmonics[3], feature_current_harmonics[4],
+			feature_voltage_harmonics_integer_part[0], feature_voltage_harmonics_decimal_part[0],
+			feature_voltage_harmonics_integer_part[1], feature_voltage_harmonics_decimal_part[1],
+			feature_voltage_harmonics_integer_part[2], feature_voltage_harmonics_decimal_part[2],
+			feature_voltage_harmonics_integer_part[3], feature_voltage_harmonics_decimal_part[3],
+			feature_voltage_harmonics_integer_part[4], feature_voltage_harmonics_decimal_part[4],
 			uwTick);
 	return WIFI_SendResponse(conn, "200 OK", conn->wifi->buf, strlen(conn->wifi->buf));
 }
@@ -18,6 +18,13 @@
 Response_t WIFIHANDLER_HandleWiFiRequest(Connection_t* conn, char* command_ptr);
 Response_t WIFIHANDLER_HandleFeaturePacket(Connection_t* conn, char* features_template);
 Response_t WIFIHANDLER_HandleNotificationRequest(Connection_t* conn, char* key_ptr);
+Response_t WIFIHANDLER_HandleSamplingRequest(Connection_t* conn, char* key_ptr);
+Response_t WIFIHANDLER_HandleWaveformRequest(Connection_t* conn, char* key_ptr);
+Response_t WIFIHANDLER_HandleCalibrationRequest(Connection_t* conn, char* key_ptr);
+Response_t WIFIHANDLER_HandleEventsRequest(Connection_t* conn, char* key_ptr);
+Response_t WIFIHANDLER_HandleHistoryRequest(Connection_t* conn, char* key_ptr);
+Response_t WIFIHANDLER_HandleAlarmRequest(Connection_t* conn, char* key_ptr);
+Response_t WIFIHANDLER_HandleQualityRequest(Connection_t* conn, char* key_ptr);
 
 void NOTIFICATION_Reset();
 void NOTIFICATION_Set(char* text, uint8_t size);
@@ -0,0 +1,25 @@
+# Post-link RAM check, run with cmake -P (see CMakeLists.txt): ELF is the linked firmware, NM the
+# arm-none-eabi-nm to read it with. The static RAM (.data and .bss), the heap and the stack reserved by the
+# linker script must fit below _estack, otherwise the build fails with the figures
+execute_process(COMMAND ${NM} ${ELF} OUTPUT_VARIABLE symbols RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "ram_check: ${NM} ${ELF} failed")
+endif()
+
+foreach(name _sdata _ebss _estack _Min_Heap_Size _Min_Stack_Size)
+    if(NOT symbols MATCHES "([0-9a-fA-F]+) [A-Za-z] ${name}\n")
+        message(FATAL_ERROR "ram_check: ${name} not found in ${ELF}, check the linker script")
+    endif()
+    math(EXPR ${name} "0x${CMAKE_MATCH_1}")
+endforeach()
+
+math(EXPR ram "${_estack} - ${_sdata}")
+math(EXPR static_ram "${_ebss} - ${_sdata}")
+math(EXPR total "${static_ram} + ${_Min_Heap_Size} + ${_Min_Stack_Size}")
+math(EXPR free "${ram} - ${total}")
+
+set(usage "static ${static_ram} + heap ${_Min_Heap_Size} + stack ${_Min_Stack_Size} = ${total} of ${ram} bytes")
+if(free LESS 0)
+    message(FATAL_ERROR "ram_check: RAM overflowed, ${usage}. Check BUFFERS SIZES in Core/settings.h")
+endif()
+message("RAM: ${usage}, ${free} free")
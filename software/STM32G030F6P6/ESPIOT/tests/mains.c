@@ -0,0 +1,171 @@
+/*
+ * mains.c
+ *
+ * see mains.h
+ */
+
+#include "mains.h"
+#include "sensor.h"
+#include "sampling.h"
+#include <math.h>
+#include <string.h>
+
+#define MAINS_PI 3.14159265358979
+#define MAINS_APERTURE_STEPS 8		// points averaged for every oversampled conversion
+#define MAINS_RMS_STEPS 20000
+
+// conversion durations of the profiles, in the order of sampling_profiles (see sampling.c)
+static const double conversion_ns[SAMPLING_PROFILES][2] =
+{
+	{ 8000, 46000 },
+	{ 32000, 184000 },
+	{ 128000, 736000 },
+};
+
+static MAINS_Signal_t mains;
+static uint32_t mains_profile;
+static double mains_time;			// s, start of the next pair
+static double mains_tick_time;		// s, time of the last uwTick increment
+static double counts_per_ampere;
+static uint32_t noise_state = 12345;
+static uint16_t adc_buf[ADC_BUF_LEN];
+
+static double MAINS_Current(double t)
+{
+	double w = 2 * MAINS_PI * mains.frequency;
+	double i = sin(w * t - mains.current_phase);
+	for (uint32_t h = 1; h < MAINS_HARMONICS; h++)
+		i += mains.current_harmonics[h] * sin(MAINS_HARMONIC_ORDER[h] * (w * t - mains.current_phase) + mains.current_harmonic_phase[h]);
+	i *= mains.current * sqrt(2);
+
+	if (mains.current_clip > 0 && i > mains.current_clip) i = mains.current_clip;
+	if (mains.current_clip > 0 && i < -mains.current_clip) i = -mains.current_clip;
+	return i;
+}
+
+static double MAINS_Voltage(double t)
+{
+	double w = 2 * MAINS_PI * mains.frequency;
+	double v = sin(w * t);
+	for (uint32_t h = 1; h < MAINS_HARMONICS; h++)
+		v += mains.voltage_harmonics[h] * sin(MAINS_HARMONIC_ORDER[h] * w * t);
+	return v * mains.voltage * sqrt(2);
+}
+
+static double MAINS_Noise(void)
+{
+	noise_state = noise_state * 1103515245 + 12345;
+	return ((double)(noise_state >> 8) / (1 << 24) * 2 - 1) * mains.noise;
+}
+
+static uint16_t MAINS_Quantize(double counts)
+{
+	counts = floor(counts + MAINS_Noise() + 0.5);
+	if (counts < 0) return 0;
+	if (counts > 4095) return 4095;
+	return counts;
+}
+
+// mean over [start, start + duration] of the current or the voltage, like an oversampled conversion
+static double MAINS_Convert(double (*signal)(double), double start, double duration)
+{
+	double sum = 0;
+	for (uint32_t i = 0; i < MAINS_APERTURE_STEPS; i++)
+		sum += signal(start + duration * (i + 0.5) / MAINS_APERTURE_STEPS);
+	return sum / MAINS_APERTURE_STEPS;
+}
+
+double MAINS_GetCountsPerAmpere(double rms)
+{
+	// nominal A per count of the RMS value (SENS_CURRENT_GAIN), scaled by the default table
+	double nominal = 3.3 / 4096.0 * 2.828427 * 2.62286;
+	double scale = (rms / CURRENT_CALIB_VALUE >= 0.25 * 2.62286) ? CURRENT_CALIB_VALUE : 2.09 / 2.62286 * CURRENT_CALIB_VALUE;
+	return 1 / (nominal * scale);
+}
+
+double MAINS_GetCountsPerVolt(void)
+{
+	return 1 / (0.797934 * VOLTAGE_CALIB_VALUE);
+}
+
+void MAINS_Fill(uint16_t* buf, uint32_t pairs)
+{
+	double pair_s = sampling_profiles[mains_profile].pair_period_ns / 1e9;
+	double current_s = conversion_ns[mains_profile][0] / 1e9;
+	double voltage_s = conversion_ns[mains_profile][1] / 1e9;
+	double offset = (mains.current_offset > 0) ? mains.current_offset : 2048;
+
+	for (uint32_t i = 0; i < pairs; i++)
+	{
+		// the current is converted first, the voltage right after it
+		double current = MAINS_Convert(MAINS_Current, mains_time, current_s);
+		double voltage = MAINS_Convert(MAINS_Voltage, mains_time + current_s, voltage_s);
+		buf[2 * i + SENS_CURRENT_OFFSET] = MAINS_Quantize(offset + current * counts_per_ampere);
+		// single supply operational amplifier: the negative half-cycles read 0
+		buf[2 * i + SENS_VOLTAGE_OFFSET] = MAINS_Quantize((voltage > 0) ? voltage * MAINS_GetCountsPerVolt() : 0);
+		mains_time += pair_s;
+	}
+}
+
+void MAINS_Start(const MAINS_Signal_t* signal, uint32_t profile)
+{
+	mains = *signal;
+	if (mains.frequency == 0)
+		mains.frequency = MAINS_FREQUENCY_HZ;
+	mains_profile = profile;
+	counts_per_ampere = MAINS_GetCountsPerAmpere(MAINS_GetCurrentRMS());
+
+	noise_state = noise_state * 1103515245 + 12345;
+	mains_time = (double)(noise_state >> 8) / (1 << 24) / mains.frequency;
+	mains_tick_time = mains_time;
+	SENS_Init(&sampling_profiles[profile]);
+}
+
+void MAINS_Run(uint32_t ms)
+{
+	double end = mains_time + ms / 1000.0;
+	uint32_t half = 0;
+
+	while (mains_time < end)
+	{
+		uint16_t* buf = adc_buf + half * ADC_BUF_LEN / 2;
+		MAINS_Fill(buf, ADC_BUF_PAIRS);
+		while (mains_time - mains_tick_time >= 0.001)
+		{
+			uwTick++;
+			mains_tick_time += 0.001;
+		}
+		SENS_ProcessSamples(buf, ADC_BUF_LEN / 2);
+		half ^= 1;
+	}
+}
+
+static double MAINS_Mean(double (*f)(double, double))
+{
+	double sum = 0;
+	for (uint32_t i = 0; i < MAINS_RMS_STEPS; i++)
+	{
+		double t = (i + 0.5) / MAINS_RMS_STEPS / mains.frequency;
+		sum += f(MAINS_Current(t), MAINS_Voltage(t));
+	}
+	return sum / MAINS_RMS_STEPS;
+}
+
+static double MAINS_CurrentSquare(double i, double v) { (void)v; return i * i; }
+static double MAINS_VoltageSquare(double i, double v) { (void)i; return v * v; }
+static double MAINS_Product(double i, double v) { return i * v; }
+
+double MAINS_GetCurrentRMS(void)
+{
+	return sqrt(MAINS_Mean(MAINS_CurrentSquare));
+}
+
+double MAINS_GetVoltageRMS(void)
+{
+	return sqrt(MAINS_Mean(MAINS_VoltageSquare));
+}
+
+double MAINS_GetRealPower(void)
+{
+	return MAINS_Mean(MAINS_Product);
+}
@@ -0,0 +1,58 @@
+/*
+ * mains.h
+ *
+ * synthetic mains for the host tests: plays the part of the ACS712, the operational amplifier, the
+ * oversampling ADC and the DMA, and feeds adc_buf to the measurement code one half at a time
+ */
+
+#ifndef TESTS_MAINS_H_
+#define TESTS_MAINS_H_
+
+#include <stdint.h>
+
+#define MAINS_HARMONICS 5				// fundamental, 3rd, 5th, 7th and 9th harmonic
+
+static const uint8_t MAINS_HARMONIC_ORDER[MAINS_HARMONICS] = { 1, 3, 5, 7, 9 };
+
+typedef struct
+{
+	double	frequency;							// Hz, MAINS_FREQUENCY_HZ if 0
+	double	voltage;							// V RMS of the fundamental
+	double	voltage_harmonics[MAINS_HARMONICS];	// relative to the fundamental, orders in MAINS_HARMONIC_ORDER (index 0 unused)
+	double	current;							// A RMS of the fundamental
+	double	current_phase;						// rad, the current lags the voltage by this (negative: leads)
+	double	current_harmonics[MAINS_HARMONICS];	// relative to the fundamental
+	double	current_harmonic_phase[MAINS_HARMONICS];	// rad, of every harmonic relative to the fundamental
+	double	current_clip;						// A, the current is limited to +- this, 0 for no clipping
+	double	current_offset;						// counts, ACS712 output at 0 A, 2048 if 0
+	double	noise;								// counts, peak of the uniform noise added to every conversion
+} MAINS_Signal_t;
+
+/*
+Resets the measurements with SENS_Init for the given sampling profile (SAMPLING_x) and starts the
+signal at a random phase. uwTick keeps running.
+*/
+void MAINS_Start(const MAINS_Signal_t* signal, uint32_t profile);
+
+// feeds ms of samples to SENS_ProcessSamples, half of adc_buf at a time, and advances uwTick
+void MAINS_Run(uint32_t ms);
+
+// continues the signal into buf (pairs V/I pairs) without processing it, for the reference methods
+void MAINS_Fill(uint16_t* buf, uint32_t pairs);
+
+// exact values of the signal, computed over one cycle of the continuous waveforms
+double MAINS_GetCurrentRMS(void);		// A
+double MAINS_GetVoltageRMS(void);		// V
+double MAINS_GetRealPower(void);		// W
+
+/*
+ADC counts per ampere of the simulated ACS712: the default calibration tables (calibration.c) are exact
+for it. The scale changes with the RMS current, tests should stay away from 0.54 A - 0.68 A where the
+two sides of the table overlap
+*/
+double MAINS_GetCountsPerAmpere(double rms);
+
+// ADC counts per volt of the mains (peak), for the default voltage calibration
+double MAINS_GetCountsPerVolt(void);
+
+#endif /* TESTS_MAINS_H_ */
@@ -0,0 +1,5 @@
+#ifndef TESTS_STUBS_ADC_H_
+#define TESTS_STUBS_ADC_H_
+#include "stm32g0xx_hal.h"
+extern ADC_HandleTypeDef hadc1;
+#endif
@@ -0,0 +1,129 @@
+/*
+ * hal_stubs.c
+ *
+ * peripherals of the host stand-in for the HAL (see stm32g0xx_hal.h)
+ */
+
+#include "stm32g0xx_hal.h"
+#include "adc.h"
+#include "tim.h"
+#include "usart.h"
+
+volatile uint32_t uwTick;
+static SysTick_Type systick = { 63999, 63999 };
+SysTick_Type* SysTick = &systick;
+uint32_t SystemCoreClock = 64000000;
+GPIO_TypeDef gpio_a, gpio_b;
+DMA_Channel_TypeDef dma1_channel2;
+DMA_TypeDef dma1;
+
+static ADC_TypeDef adc1;
+ADC_HandleTypeDef hadc1 = { &adc1, { ENABLE, { ADC_OVERSAMPLING_RATIO_256, ADC_RIGHTBITSHIFT_8 } } };
+ADC_Stub_t adc_stub;
+TIM_HandleTypeDef htim3;
+
+static USART_TypeDef usart1;
+static DMA_HandleTypeDef hdma_usart1_rx = { DMA1_Channel2 };
+UART_HandleTypeDef huart1 = { &usart1, &hdma_usart1_rx };
+
+void HAL_Delay(uint32_t delay)
+{
+	uwTick += delay;
+}
+
+void Error_Handler(void)
+{
+}
+
+HAL_StatusTypeDef HAL_ADC_Init(ADC_HandleTypeDef* hadc)
+{
+	(void)hadc;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADCEx_Calibration_Start(ADC_HandleTypeDef* hadc)
+{
+	(void)hadc;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_Start_DMA(ADC_HandleTypeDef* hadc, uint32_t* data, uint32_t length)
+{
+	(void)hadc; (void)data; (void)length;
+	adc_stub.converting = 1;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_Stop_DMA(ADC_HandleTypeDef* hadc)
+{
+	(void)hadc;
+	adc_stub.converting = 0;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_AnalogWDGConfig(ADC_HandleTypeDef* hadc, ADC_AnalogWDGConfTypeDef* config)
+{
+	(void)hadc;
+	adc_stub.low[config->WatchdogNumber] = config->LowThreshold;
+	adc_stub.high[config->WatchdogNumber] = config->HighThreshold;
+	adc_stub.interrupt[config->WatchdogNumber] = config->ITMode;
+	return HAL_OK;
+}
+
+void LL_ADC_ConfigAnalogWDThresholds(ADC_TypeDef* adc, uint32_t watchdog, uint32_t high, uint32_t low)
+{
+	(void)adc;
+	adc_stub.low[watchdog] = low;
+	adc_stub.high[watchdog] = high;
+}
+
+void LL_ADC_ClearFlag_AWD1(ADC_TypeDef* adc) { (void)adc; }
+void LL_ADC_ClearFlag_AWD2(ADC_TypeDef* adc) { (void)adc; }
+void LL_ADC_EnableIT_AWD1(ADC_TypeDef* adc) { (void)adc; adc_stub.interrupt[1] = 1; }
+void LL_ADC_EnableIT_AWD2(ADC_TypeDef* adc) { (void)adc; adc_stub.interrupt[2] = 1; }
+void LL_ADC_DisableIT_AWD1(ADC_TypeDef* adc) { (void)adc; adc_stub.interrupt[1] = 0; }
+void LL_ADC_DisableIT_AWD2(ADC_TypeDef* adc) { (void)adc; adc_stub.interrupt[2] = 0; }
+
+uint32_t LL_ADC_REG_ReadConversionData12(ADC_TypeDef* adc)
+{
+	(void)adc;
+	return adc_stub.data;
+}
+
+uint32_t LL_ADC_REG_IsConversionOngoing(ADC_TypeDef* adc)
+{
+	(void)adc;
+	return adc_stub.converting;
+}
+
+void LL_ADC_REG_StopConversion(ADC_TypeDef* adc)
+{
+	(void)adc;
+	adc_stub.converting = 0;
+	adc_stub.stops++;
+}
+
+uint32_t LL_ADC_REG_IsStopConversionOngoing(ADC_TypeDef* adc)
+{
+	(void)adc;
+	return 0;
+}
+
+void LL_ADC_REG_StartConversion(ADC_TypeDef* adc)
+{
+	(void)adc;
+	adc_stub.converting = 1;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef* htim)
+{
+	htim->running = 1;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Stop(TIM_HandleTypeDef* htim)
+{
+	htim->running = 0;
+	htim->stops++;
+	return HAL_OK;
+}
@@ -0,0 +1,154 @@
+/*
+ * stm32g0xx_hal.h
+ *
+ * host stand-in for the HAL: only the types, registers and functions used by the modules under test.
+ * the peripherals are plain variables (see hal_stubs.c), the tests play the part of the hardware
+ */
+
+#ifndef TESTS_STUBS_STM32G0XX_HAL_H_
+#define TESTS_STUBS_STM32G0XX_HAL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum
+{
+	HAL_OK		= 0x00,
+	HAL_ERROR	= 0x01,
+	HAL_BUSY	= 0x02,
+	HAL_TIMEOUT	= 0x03,
+} HAL_StatusTypeDef;
+
+#define ENABLE 1
+#define DISABLE 0
+#define HAL_MAX_DELAY 0xFFFFFFFFU
+
+extern volatile uint32_t uwTick;
+
+// the interrupts are not simulated: the tests call the callbacks themselves
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+static inline void __NOP(void) {}
+void __WFI(void);		// defined by the tests that wait for the ESP
+
+typedef struct
+{
+	volatile uint32_t LOAD;
+	volatile uint32_t VAL;
+} SysTick_Type;
+extern SysTick_Type* SysTick;
+extern uint32_t SystemCoreClock;
+
+// GPIO
+typedef struct { uint32_t BSRR, BRR; } GPIO_TypeDef;
+extern GPIO_TypeDef gpio_a, gpio_b;
+#define GPIOA (&gpio_a)
+#define GPIOB (&gpio_b)
+#define GPIO_PIN_0 0x0001
+#define GPIO_PIN_7 0x0080
+#define ESPRST_GPIO_Port GPIOA
+#define ESPRST_Pin GPIO_PIN_0
+static inline void HAL_GPIO_WritePin(GPIO_TypeDef* port, uint16_t pin, int state) { (void)port; (void)pin; (void)state; }
+static inline void HAL_GPIO_TogglePin(GPIO_TypeDef* port, uint16_t pin) { (void)port; (void)pin; }
+
+void HAL_Delay(uint32_t delay);		// advances uwTick
+
+// DMA
+typedef struct { volatile uint32_t CNDTR; } DMA_Channel_TypeDef;
+typedef struct { DMA_Channel_TypeDef* Instance; } DMA_HandleTypeDef;
+extern DMA_Channel_TypeDef dma1_channel2;
+#define DMA1_Channel2 (&dma1_channel2)
+typedef struct { volatile uint32_t ISR; } DMA_TypeDef;
+extern DMA_TypeDef dma1;
+#define DMA1 (&dma1)
+#define DMA_ISR_TCIF2 0x0020
+#define DMA_ISR_HTIF2 0x0040
+
+// UART, the tests that use the ESP define the functions and play the part of the ESP
+typedef struct { uint32_t CR3; } USART_TypeDef;
+typedef struct
+{
+	USART_TypeDef*		Instance;
+	DMA_HandleTypeDef*	hdmarx;
+} UART_HandleTypeDef;
+#define USART_CR3_EIE 0x0001
+#define ATOMIC_CLEAR_BIT(reg, bit) ((reg) &= ~(bit))
+#define __HAL_UART_CLEAR_OREFLAG(huart) ((void)(huart))
+#define __HAL_UART_CLEAR_NEFLAG(huart) ((void)(huart))
+#define __HAL_UART_CLEAR_FEFLAG(huart) ((void)(huart))
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef* huart, const uint8_t* data, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef* huart, const uint8_t* data, uint16_t size);
+HAL_StatusTypeDef HAL_UART_AbortTransmit(UART_HandleTypeDef* huart);
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef* huart, uint8_t* data, uint16_t size);
+
+// ADC
+typedef struct { uint32_t dummy; } ADC_TypeDef;
+typedef struct
+{
+	ADC_TypeDef* Instance;
+	struct
+	{
+		uint32_t OversamplingMode;
+		struct { uint32_t Ratio, RightBitShift; } Oversampling;
+	} Init;
+} ADC_HandleTypeDef;
+typedef struct
+{
+	uint32_t WatchdogNumber, WatchdogMode, Channel, ITMode, HighThreshold, LowThreshold;
+} ADC_AnalogWDGConfTypeDef;
+
+#define ADC_ANALOGWATCHDOG_SINGLE_REG 1
+#define ADC_ANALOGWATCHDOG_1 1
+#define ADC_ANALOGWATCHDOG_2 2
+#define ADC_CHANNEL_4 4
+#define ADC_CHANNEL_5 5
+#define LL_ADC_AWD1 1
+#define LL_ADC_AWD2 2
+#define ADC_OVERSAMPLING_RATIO_16 3
+#define ADC_OVERSAMPLING_RATIO_64 5
+#define ADC_OVERSAMPLING_RATIO_256 7
+#define ADC_RIGHTBITSHIFT_4 4
+#define ADC_RIGHTBITSHIFT_6 6
+#define ADC_RIGHTBITSHIFT_8 8
+
+// state of the simulated ADC: watchdog windows and interrupts (index = watchdog number), converting
+typedef struct
+{
+	uint32_t	low[3];
+	uint32_t	high[3];
+	uint32_t	interrupt[3];
+	uint32_t	data;
+	uint32_t	converting;
+	uint32_t	stops;			// LL_ADC_REG_StopConversion calls
+} ADC_Stub_t;
+extern ADC_Stub_t adc_stub;
+
+HAL_StatusTypeDef HAL_ADC_Init(ADC_HandleTypeDef* hadc);
+HAL_StatusTypeDef HAL_ADCEx_Calibration_Start(ADC_HandleTypeDef* hadc);
+HAL_StatusTypeDef HAL_ADC_Start_DMA(ADC_HandleTypeDef* hadc, uint32_t* data, uint32_t length);
+HAL_StatusTypeDef HAL_ADC_Stop_DMA(ADC_HandleTypeDef* hadc);
+HAL_StatusTypeDef HAL_ADC_AnalogWDGConfig(ADC_HandleTypeDef* hadc, ADC_AnalogWDGConfTypeDef* config);
+void LL_ADC_ConfigAnalogWDThresholds(ADC_TypeDef* adc, uint32_t watchdog, uint32_t high, uint32_t low);
+void LL_ADC_ClearFlag_AWD1(ADC_TypeDef* adc);
+void LL_ADC_ClearFlag_AWD2(ADC_TypeDef* adc);
+void LL_ADC_EnableIT_AWD1(ADC_TypeDef* adc);
+void LL_ADC_EnableIT_AWD2(ADC_TypeDef* adc);
+void LL_ADC_DisableIT_AWD1(ADC_TypeDef* adc);
+void LL_ADC_DisableIT_AWD2(ADC_TypeDef* adc);
+uint32_t LL_ADC_REG_ReadConversionData12(ADC_TypeDef* adc);
+uint32_t LL_ADC_REG_IsConversionOngoing(ADC_TypeDef* adc);
+void LL_ADC_REG_StopConversion(ADC_TypeDef* adc);
+uint32_t LL_ADC_REG_IsStopConversionOngoing(ADC_TypeDef* adc);
+void LL_ADC_REG_StartConversion(ADC_TypeDef* adc);
+
+// TIM
+typedef struct { uint32_t running; uint32_t period; uint32_t stops; } TIM_HandleTypeDef;
+#define __HAL_TIM_SET_AUTORELOAD(htim, value) ((htim)->period = (value))
+#define __HAL_TIM_SET_COUNTER(htim, value) ((void)(value))
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef* htim);
+HAL_StatusTypeDef HAL_TIM_Base_Stop(TIM_HandleTypeDef* htim);
+
+void Error_Handler(void);
+
+#endif /* TESTS_STUBS_STM32G0XX_HAL_H_ */
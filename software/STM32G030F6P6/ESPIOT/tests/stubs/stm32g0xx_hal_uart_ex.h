@@ -0,0 +1,4 @@
+#ifndef TESTS_STUBS_STM32G0XX_HAL_UART_EX_H_
+#define TESTS_STUBS_STM32G0XX_HAL_UART_EX_H_
+#include "stm32g0xx_hal.h"
+#endif
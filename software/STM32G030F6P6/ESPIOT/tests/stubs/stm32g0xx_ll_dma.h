@@ -0,0 +1,6 @@
+#ifndef TESTS_STUBS_STM32G0XX_LL_DMA_H_
+#define TESTS_STUBS_STM32G0XX_LL_DMA_H_
+#include "stm32g0xx_hal.h"
+static inline uint32_t LL_DMA_IsActiveFlag_TC2(const DMA_TypeDef* dma) { return (dma->ISR & DMA_ISR_TCIF2) != 0; }
+static inline uint32_t LL_DMA_IsActiveFlag_HT2(const DMA_TypeDef* dma) { return (dma->ISR & DMA_ISR_HTIF2) != 0; }
+#endif
@@ -0,0 +1,5 @@
+#ifndef TESTS_STUBS_TIM_H_
+#define TESTS_STUBS_TIM_H_
+#include "stm32g0xx_hal.h"
+extern TIM_HandleTypeDef htim3;
+#endif
@@ -0,0 +1,5 @@
+#ifndef TESTS_STUBS_USART_H_
+#define TESTS_STUBS_USART_H_
+#include "stm32g0xx_hal.h"
+extern UART_HandleTypeDef huart1;
+#endif
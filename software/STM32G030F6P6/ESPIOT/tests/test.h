@@ -0,0 +1,31 @@
+/*
+ * test.h
+ *
+ * minimal checks for the host tests: a failed check is printed and counted, TEST_END returns the
+ * exit code for ctest
+ */
+
+#ifndef TESTS_TEST_H_
+#define TESTS_TEST_H_
+
+#include <stdio.h>
+#include <math.h>
+
+extern int test_failures;
+
+#define TEST_DEFINE_FAILURES int test_failures = 0
+
+#define CHECK(condition) do { if (!(condition)) { test_failures++; \
+	printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); } } while (0)
+
+// |actual - expected| <= tolerance
+#define CHECK_NEAR(actual, expected, tolerance) do { double a_ = (actual), e_ = (expected); \
+	if (!(fabs(a_ - e_) <= (tolerance))) { test_failures++; \
+	printf("%s:%d: %s = %g, expected %g +- %g\n", __FILE__, __LINE__, #actual, a_, e_, (double)(tolerance)); } } while (0)
+
+// relative error within tolerance (0.01 = 1%)
+#define CHECK_REL(actual, expected, tolerance) CHECK_NEAR(actual, expected, fabs(expected) * (tolerance))
+
+#define TEST_END() (printf("%s\n", test_failures ? "FAILED" : "OK"), test_failures ? 1 : 0)
+
+#endif /* TESTS_TEST_H_ */
@@ -0,0 +1,95 @@
+/*
+ * test_alarm.c
+ *
+ * when ALARM_Update stops the ADC to rewrite the watchdog registers: right away for a new threshold,
+ * only for an offset drift over the dead band and at most every ALARM_OFFSET_INTERVAL_MS. and the alarms
+ * it returns to the main loop for the notifications
+ */
+
+#include "test.h"
+#include "mains.h"
+#include "alarm.h"
+#include "sensor.h"
+#include "sampling.h"
+#include "adc.h"
+#include "tim.h"
+
+TEST_DEFINE_FAILURES;
+
+// ADC stops over the given time, with ALARM_Update called every 100 ms like the main loop does
+static uint32_t RunUpdates(uint32_t ms)
+{
+	uint32_t stops = htim3.stops;
+	for (uint32_t t = 0; t < ms; t += 100)
+	{
+		MAINS_Run(100);
+		ALARM_Update();
+	}
+	return htim3.stops - stops;
+}
+
+// uwTick of the first ADC stop within the given time, 0 if none
+static uint32_t FirstUpdate(uint32_t ms)
+{
+	uint32_t stops = htim3.stops;
+	for (uint32_t t = 0; t < ms; t += 100)
+	{
+		MAINS_Run(100);
+		ALARM_Update();
+		if (htim3.stops != stops) return uwTick;
+	}
+	return 0;
+}
+
+// restarts the signal with another offset and lets the long term average settle, without updates
+static void MoveOffset(MAINS_Signal_t* signal, double offset)
+{
+	signal->current_offset = offset;
+	MAINS_Start(signal, SAMPLING_PRECISION);
+	MAINS_Run(10000);
+	printf("offset %.1f: SENS_GetCurrentOffset %lu\n", offset, (unsigned long)SENS_GetCurrentOffset());
+}
+
+int main(void)
+{
+	MAINS_Signal_t signal = { .voltage = 230, .current = 1, .noise = 0.5 };
+	MoveOffset(&signal, 2048);
+	adc_stub.converting = 1;		// as after SAMPLING_Configure
+	uint32_t step = 1 << ((hadc1.Init.OversamplingMode == ENABLE) ? 4 : 0);
+
+	// nothing to follow while the alarm is disabled
+	CHECK(RunUpdates(1000) == 0);
+
+	// a new threshold is written on the next call, the interval does not apply
+	ALARM_SetThreshold(ALARM_CURRENT, 5000);
+	ALARM_Update();
+	CHECK(htim3.stops == 1);
+	CHECK(adc_stub.converting == 1 && htim3.running == 1);
+
+	// noise and a drift of one step stay in the dead band
+	CHECK(RunUpdates(2 * ALARM_OFFSET_INTERVAL_MS) == 0);
+	MoveOffset(&signal, 2048 + step);
+	CHECK(RunUpdates(2 * ALARM_OFFSET_INTERVAL_MS) == 0);
+
+	// a real drift is followed
+	MoveOffset(&signal, 2048 + 4 * step);
+	uint32_t first = FirstUpdate(ALARM_OFFSET_INTERVAL_MS);
+	CHECK(first != 0);
+	uint32_t written = first;
+
+	// another drift right after is followed no sooner than the interval after the last write
+	MoveOffset(&signal, 2048);
+	first = FirstUpdate(2 * ALARM_OFFSET_INTERVAL_MS);
+	printf("second drift followed %lu ms after the first\n", (unsigned long)(first - written));
+	CHECK(first != 0 && first - written >= ALARM_OFFSET_INTERVAL_MS);
+	CHECK(RunUpdates(2 * ALARM_OFFSET_INTERVAL_MS) == 0);
+
+	// an alarm started by the watchdog interrupt is returned once, by the next call
+	ALARM_Trigger(ALARM_VOLTAGE);
+	CHECK(ALARM_Update() == (1 << ALARM_VOLTAGE));
+	CHECK(ALARM_Update() == 0);
+	ALARM_Alarm_t alarm;
+	CHECK(ALARM_Get(ALARM_VOLTAGE, &alarm) && alarm.active && alarm.count == 1);
+
+	return TEST_END();
+}
@@ -0,0 +1,839 @@
+/*
+ * test_esp_ring.c
+ *
+ * the UART ring and the AT response parser of esp8266.c fed with the output of a simulated ESP, cut in
+ * chunks of random size: the circular DMA fills uart_buffer one byte at a time, the half and full buffer
+ * events call ESP8266_RxEvent right away, the idle line events only at the end of some chunks.
+ * then the interrupts are held off while the DMA goes around the ring: the parser must count an overrun
+ * and go on from the DMA position
+ */
+
+#include "test.h"
+#include "esp8266.h"
+#include <stdlib.h>
+#include <string.h>
+
+TEST_DEFINE_FAILURES;
+
+SaveData_t savedata;
+
+#define SEEDS 200
+
+static volatile uint8_t* ring;				// uart_buffer, given to HAL_UARTEx_ReceiveToIdle_DMA
+static char wire[1 << 16];					// everything the ESP sent since the start of a seed
+static uint32_t wire_size, wire_pos;		// wire_pos: bytes already written by the DMA
+static uint32_t chunk_max;					// largest chunk received between two idle events
+static bool held;							// the UART interrupts can't run, the DMA flags stay set in DMA1->ISR
+
+// what the ESP does with the commands
+static bool esp_error, esp_mute;
+static char command[256];
+static uint32_t command_size;
+static uint32_t send_left;					// data of the AT+CIPSEND still to be received
+static char sent[4096];
+static uint32_t sent_size;
+static bool tx_busy;
+static int32_t closed_link;					// of the last AT+CIPCLOSE
+static bool ipd_in_response;				// a request is announced in the middle of AT+CWSTATE?
+static char cipserver[64] = "+CIPSERVER:1,34677,\"TCP\",0\r\n\r\nOK\r\n";
+static bool old_format;						// +CIPRECVDATA,m:<data> of the older firmwares
+static bool ap_up;							// the access point accepts AT+CWJAP
+static char cwjap[128];						// the last AT+CWJAP
+static bool join_held;						// the OK of AT+CWJAP is pushed by the test
+
+// data of the clients kept by the ESP (passive receive mode)
+static char link_data[WIFI_MAX_LINKS][2048];
+static uint32_t link_size[WIFI_MAX_LINKS];
+
+static void Push(const char* data, uint32_t size)
+{
+	if (wire_size + size > sizeof(wire)) abort();
+	memcpy(wire + wire_size, data, size);
+	wire_size += size;
+}
+
+static void PushString(const char* str)
+{
+	Push(str, strlen(str));
+}
+
+// a client sends data to the link: the ESP keeps it and announces it with +IPD
+static void ClientSend(uint8_t link, const char* data)
+{
+	uint32_t size = strlen(data);
+	char header[32];
+	sprintf(header, "+IPD,%u,%u\r\n", link, (unsigned)size);
+	PushString(header);
+	if (link >= WIFI_MAX_LINKS) return;
+	memcpy(link_data[link] + link_size[link], data, size);
+	link_size[link] += size;
+}
+
+static void Reply(void)
+{
+	if (strncmp(command, "AT+CIPRECVDATA=", 15) == 0)
+	{
+		uint8_t link = atoi(command + 15);
+		uint32_t size = atoi(strchr(command, ',') + 1);
+		if (link_size[link] == 0)
+		{
+			PushString("\r\nERROR\r\n");
+			return;
+		}
+		if (size > link_size[link]) size = link_size[link];
+		char header[32];
+		sprintf(header, old_format ? "+CIPRECVDATA,%u:" : "+CIPRECVDATA:%u,", (unsigned)size);
+		PushString(header);
+		Push(link_data[link], size);
+		memmove(link_data[link], link_data[link] + size, link_size[link] - size);
+		link_size[link] -= size;
+		PushString("\r\nOK\r\n");
+	}
+	else if (strncmp(command, "AT+RST", 6) == 0)
+		PushString("\r\nOK\r\n\r\n ets Jan  8 2013,rst cause:2\r\n\r\nready\r\n");
+	else if (strncmp(command, "AT+CIPSEND=", 11) == 0)
+	{
+		send_left = atoi(strchr(command, ',') + 1);
+		PushString("\r\nOK\r\n\r\n> ");
+	}
+	else if (strncmp(command, "AT+CIPCLOSE=", 12) == 0)
+	{
+		char reply[32];
+		closed_link = atoi(command + 12);
+		if (closed_link == WIFI_MAX_LINKS)		// all of them
+		{
+			memset(link_size, 0, sizeof(link_size));
+			PushString("\r\nOK\r\n");
+			return;
+		}
+		link_size[closed_link] = 0;
+		sprintf(reply, "%d,CLOSED\r\n\r\nOK\r\n", (int)closed_link);
+		PushString(reply);
+	}
+	else if (strncmp(command, "AT+CWSTATE?", 11) == 0)
+	{
+		PushString("+CWSTATE:2,\"my network\"\r\n");
+		if (ipd_in_response)
+			ClientSend(0, "GET /?reset HTTP/1.1\r\nERROR\r\n\r\n");
+		PushString("\r\nOK\r\n");
+	}
+	else if (strncmp(command, "AT+CWJAP=", 9) == 0)
+	{
+		strcpy(cwjap, command);
+		if (join_held)
+			PushString("WIFI CONNECTED\r\nWIFI GOT IP\r\n");
+		else
+			PushString(ap_up ? "WIFI CONNECTED\r\nWIFI GOT IP\r\n\r\nOK\r\n" : "+CWJAP:3\r\n\r\nFAIL\r\n");
+	}
+	else if (strncmp(command, "AT+CIPSERVER?", 13) == 0)
+		PushString(cipserver);
+	else if (strncmp(command, "AT+CIFSR", 8) == 0)
+		PushString("+CIFSR:STAIP,\"192.168.1.20\"\r\n+CIFSR:STAMAC,\"aa:bb:cc:dd:ee:ff\"\r\n\r\nOK\r\n");
+	else if (strncmp(command, "AT+CWHOSTNAME?", 14) == 0)
+		PushString("+CWHOSTNAME:ESP-A0ADE6\r\n\r\nOK\r\n");
+	else
+		PushString(esp_error ? "\r\nERROR\r\n" : "\r\nOK\r\n");
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef* huart, const uint8_t* data, uint16_t size, uint32_t timeout)
+{
+	(void)huart;
+	(void)timeout;
+	if (send_left > 0)
+	{
+		memcpy(sent + sent_size, data, size);
+		sent_size += size;
+		send_left -= size;
+		if (send_left == 0)
+			PushString("\r\nRecv bytes\r\n\r\nSEND OK\r\n");
+		return HAL_OK;
+	}
+
+	memcpy(command + command_size, data, size);
+	command_size += size;
+	command[command_size] = '\0';
+	if (command[command_size - 1] != '\n') return HAL_OK;		// sent in parts
+	if (!esp_mute) Reply();
+	command_size = 0;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef* huart, const uint8_t* data, uint16_t size)
+{
+	if (tx_busy) return HAL_BUSY;
+	tx_busy = true;
+	return HAL_UART_Transmit(huart, data, size, 0);
+}
+
+HAL_StatusTypeDef HAL_UART_AbortTransmit(UART_HandleTypeDef* huart)
+{
+	(void)huart;
+	tx_busy = false;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef* huart, uint8_t* data, uint16_t size)
+{
+	(void)huart;
+	ring = data;
+	DMA1_Channel2->CNDTR = size;
+	return HAL_OK;
+}
+
+// the DMA writes size bytes of the wire, the half and full buffer events run right away unless held
+static void Receive(uint32_t size)
+{
+	for (uint32_t i = 0; i < size && wire_pos < wire_size; i++)
+	{
+		ring[UART_BUFFER_SIZE - DMA1_Channel2->CNDTR] = wire[wire_pos++];
+		if (--DMA1_Channel2->CNDTR == 0)
+			DMA1_Channel2->CNDTR = UART_BUFFER_SIZE;
+		bool half = (DMA1_Channel2->CNDTR == UART_BUFFER_SIZE / 2);
+		bool full = (DMA1_Channel2->CNDTR == UART_BUFFER_SIZE);
+		if (!half && !full) continue;
+		if (!held)
+			ESP8266_RxEvent(true);
+		else
+			DMA1->ISR |= half ? DMA_ISR_HTIF2 : DMA_ISR_TCIF2;
+	}
+}
+
+/*
+ * the interrupts run again: HAL_DMA_IRQHandler clears one flag and calls the callback, the half buffer first,
+ * then the idle line. an event that happened again while its flag was set is lost
+ */
+static void Release(void)
+{
+	held = false;
+	if (DMA1->ISR & DMA_ISR_HTIF2)
+	{
+		DMA1->ISR &= ~DMA_ISR_HTIF2;
+		ESP8266_RxEvent(true);
+	}
+	if (DMA1->ISR & DMA_ISR_TCIF2)
+	{
+		DMA1->ISR &= ~DMA_ISR_TCIF2;
+		ESP8266_RxEvent(true);
+	}
+	ESP8266_RxEvent(false);
+}
+
+// the next interrupt: the end of a transmission, a chunk of the ESP output or a SysTick tick
+void __WFI(void)
+{
+	if (tx_busy)
+	{
+		tx_busy = false;
+		ESP8266_TxEvent();
+		return;
+	}
+	if (wire_pos < wire_size)
+	{
+		Receive(1 + rand() % chunk_max);
+		SysTick->VAL = (SysTick->VAL > 4000) ? SysTick->VAL - 4000 : (uwTick++, SysTick->LOAD);
+		// consecutive chunks can be a single idle event, the end of the output can't
+		if (rand() % 4 != 0 || wire_pos == wire_size)
+			ESP8266_RxEvent(false);
+		return;
+	}
+	uwTick++;
+	SysTick->VAL = SysTick->LOAD;
+}
+
+// the ESP prints something nobody waits for: the parser must go through it and be left at a new position
+static void Noise(void)
+{
+	uint32_t lines = rand() % 20;
+	for (uint32_t i = 0; i < lines; i++)
+		PushString((rand() % 2) ? "busy p...\r\n" : "0,CONNECT\r\n");
+	while (wire_pos < wire_size) __WFI();
+}
+
+static void TestCommands(void)
+{
+	CHECK(ESP8266_CheckAT() == OK);
+	esp_error = true;
+	CHECK(ESP8266_CheckAT() == ERR);
+	esp_error = false;
+	esp_mute = true;
+	uint32_t start = uwTick;
+	CHECK(ESP8266_CheckAT() == TIMEOUT);
+	CHECK(uwTick - start >= AT_SHORT_TIMEOUT);
+	esp_mute = false;
+
+	// the lines of the response are read back from the ring, an unrelated line in between changes nothing
+	WIFI_t wifi = {0};
+	PushString("WIFI CONNECTED\r\n");
+	ipd_in_response = true;
+	CHECK(WIFI_GetConnectionInfo(&wifi) == OK);
+	ipd_in_response = false;
+	CHECK(strcmp(wifi.SSID, "my network") == 0);
+	CHECK(strcmp(wifi.IP, "192.168.1.20") == 0);
+	CHECK(strcmp(wifi.hostname, "ESP-A0ADE6") == 0);
+
+	// the request announced during AT+CWSTATE? is pulled, ERROR in its data didn't end the command
+	Connection_t conn;
+	CONN_Init(&conn);
+	CHECK(WIFI_ReceiveRequest(&wifi, &conn, 100) == OK);
+	CHECK(conn.connection_number == 0 && strcmp(conn.request, "reset") == 0);
+}
+
+static void TestTarget(void)
+{
+	// received before the wait starts, and received while waiting
+	ESP8266_ClearBuffer();
+	PushString("\r\nsome line\r\n");
+	while (wire_pos < wire_size) __WFI();
+	CHECK(ESP8266_WaitForString("some line\r\n", 100) == OK);
+
+	ESP8266_ClearBuffer();
+	PushString("some\r\nother line\r\n");
+	CHECK(ESP8266_WaitForString("other line\r\n", 100) == OK);
+	CHECK(ESP8266_WaitForString("missing line\r\n", 100) == TIMEOUT);
+}
+
+static void TestRequests(void)
+{
+	/*
+	 * the data of the clients is full of lines that end the AT commands: the +CIPRECVDATA payload is skipped
+	 * by the parser. the first request is larger than RECV_CHUNK_SIZE, so it's pulled in more parts
+	 */
+	WIFI_t wifi = {0};
+	Connection_t conn;
+	ClientSend(3, "GET /?wifi=at HTTP/1.1\r\nHost: 192.168.1.20\r\nX-Test: \r\nERROR\r\nOK\r\nSEND OK\r\n> \r\n"
+			"User-Agent: a rather long user agent, so that the request doesn't fit in a single chunk\r\n\r\n");
+	ClientSend(1, "GET /?status HTTP/1.1\r\nHost: 192.168.1.20\r\nFAIL\r\n\r\n");
+	// the links are served in turn, from the one after the link served last
+	uint32_t links = 0;
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		CONN_Init(&conn);
+		CHECK(WIFI_ReceiveRequest(&wifi, &conn, 100) == OK);
+		links |= 1 << conn.connection_number;
+		if (conn.connection_number == 3)
+			CHECK(strcmp(conn.request, "wifi=at") == 0);
+		else
+			CHECK(conn.connection_number == 1 && strcmp(conn.request, "status") == 0);
+
+		sent_size = 0;
+		CHECK(WIFI_SendResponse(&conn, "200 OK", "OK\r\nERROR", 9) == OK);
+		sent[sent_size] = '\0';
+		CHECK(strncmp(sent, "HTTP/1.1 200 OK", 15) == 0);
+		CHECK(sent_size > 9 && memcmp(sent + sent_size - 9, "OK\r\nERROR", 9) == 0);
+	}
+	CHECK(links == ((1 << 1) | (1 << 3)));
+	CHECK(WIFI_ReceiveRequest(&wifi, &conn, 10) == TIMEOUT);
+}
+
+static void TestLinks(void)
+{
+	WIFI_t wifi = {0};
+	Connection_t conn;
+	WIFI_LinkStats_t stats;
+
+	// link 2 pipelines two requests: the rest already pulled with the first one is served next, then link 4
+	CONN_Init(&conn);
+	ClientSend(1, "GET /?status HTTP/1.1\r\n\r\n");
+	CHECK(WIFI_ReceiveRequest(&wifi, &conn, 100) == OK && conn.connection_number == 1);
+	ClientSend(2, "GET /?first HTTP/1.1\r\n\r\n");
+	ClientSend(2, "GET /?second HTTP/1.1\r\n\r\n");
+	ClientSend(4, "GET /?status HTTP/1.1\r\n\r\n");
+	while (wire_pos < wire_size) __WFI();
+	static const uint8_t links[] = { 2, 2, 4 };
+	static const char* requests[] = { "first", "second", "status" };
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		CHECK(WIFI_ReceiveRequest(&wifi, &conn, 100) == OK);
+		CHECK(conn.connection_number == links[i] && strcmp(conn.request, requests[i]) == 0);
+	}
+
+	// the client went away: its data is dropped
+	ClientSend(3, "GET /?status HTTP/1.1\r\n\r\n");
+	link_size[3] = 0;
+	PushString("3,CLOSED\r\n");
+	while (wire_pos < wire_size) __WFI();
+	CHECK(WIFI_ReceiveRequest(&wifi, &conn, 10) == TIMEOUT);
+
+	// a link out of 0-4: ignored, and the parser goes on
+	ClientSend(7, "GET /?status HTTP/1.1\r\n\r\n");
+	CHECK(WIFI_ReceiveRequest(&wifi, &conn, 10) == TIMEOUT);
+	CHECK(ESP8266_CheckAT() == OK);
+
+	// not served in time: the link is closed
+	WIFI_GetLinkStats(&stats);
+	uint32_t expired = stats.expired;
+	ClientSend(1, "GET /?status HTTP/1.1\r\n\r\n");
+	while (wire_pos < wire_size) __WFI();
+	uwTick += LINK_REQUEST_TIMEOUT_MS + 1;
+	closed_link = -1;
+	CHECK(WIFI_ReceiveRequest(&wifi, &conn, 10) == TIMEOUT);
+	CHECK(closed_link == 1);
+	WIFI_GetLinkStats(&stats);
+	CHECK(stats.expired == expired + 1 && stats.waiting == 0);
+}
+
+// sends the response to the request and checks the bytes that reached the ESP
+static void Respond(Connection_t* conn, const char* expected)
+{
+	sent_size = 0;
+	CHECK(WIFI_SendResponse(conn, "200 OK", "1", 1) == OK);
+	sent[sent_size] = '\0';
+	CHECK(strcmp(sent, expected) == 0);
+}
+
+#define HTTP_OK "HTTP/1.1 200 OK\r\nContent-Type: text/plain; charset=utf-8\r\nContent-Length: 1\r\n"
+
+static void TestHttp(void)
+{
+	WIFI_t wifi = {0};
+	Connection_t conn;
+	CONN_Init(&conn);
+
+	// HTTP/1.1 keeps the link until the client closes it, what it sent after that is dropped
+	ClientSend(4, "GET /?a HTTP/1.1\r\n\r\nGET /?b HTTP/1.1\r\nHost: x\r\n\r\n"
+			"GET /?c HTTP/1.1\r\nConnection: close\r\n\r\nGET /?d HTTP/1.1\r\n\r\n");
+	static const char* requests[] = { "a", "b", "c" };
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		closed_link = -1;
+		CHECK(WIFI_ReceiveRequest(&wifi, &conn, 100) == OK && strcmp(conn.request, requests[i]) == 0);
+		Respond(&conn, (i < 2) ? HTTP_OK "Connection: keep-alive\r\n\r\n1" : HTTP_OK "Connection: close\r\n\r\n1");
+		CHECK(closed_link == ((i < 2) ? -1 : 4));
+	}
+	CHECK(WIFI_ReceiveRequest(&wifi, &conn, 10) == TIMEOUT);
+
+	// HTTP/1.0 only if the client asks for it
+	closed_link = -1;
+	ClientSend(4, "GET /?e HTTP/1.0\r\nConnection: keep-alive\r\n\r\n");
+	CHECK(WIFI_ReceiveRequest(&wifi, &conn, 100) == OK && strcmp(conn.request, "e") == 0);
+	Respond(&conn, HTTP_OK "Connection: keep-alive\r\n\r\n1");
+	CHECK(closed_link == -1);
+	ClientSend(4, "GET /?f HTTP/1.0\r\n\r\n");
+	CHECK(WIFI_ReceiveRequest(&wifi, &conn, 100) == OK && strcmp(conn.request, "f") == 0);
+	Respond(&conn, HTTP_OK "Connection: close\r\n\r\n1");
+	CHECK(closed_link == 4);
+
+	// no version: the frame of the Android app
+	closed_link = -1;
+	CONN_Init(&conn);
+	ClientSend(4, "GET ?g\r\n");
+	CHECK(WIFI_ReceiveRequest(&wifi, &conn, 100) == OK && strcmp(conn.request, "g") == 0);
+	Respond(&conn, "200 OK\n1\r\n");
+	CHECK(closed_link == -1);
+}
+
+typedef struct
+{
+	uint32_t	written;
+	uint32_t	size;		// of the body
+	uint32_t	fail_at;	// the generator fails when the body reaches it
+} Stream_t;
+
+static int32_t Generate(char* buf, uint32_t size, void* context)
+{
+	Stream_t* stream = context;
+	if (stream->written >= stream->fail_at) return -1;
+	uint32_t left = stream->size - stream->written;
+	uint32_t segment = 1 + rand() % 300;
+	if (segment > size) segment = size;
+	if (segment > left) segment = left;
+	for (uint32_t i = 0; i < segment; i++)
+		buf[i] = 'a' + (stream->written + i) % 26;
+	stream->written += segment;
+	return segment;
+}
+
+// receives a request with the version and streams a body of size bytes to it, returns what follows the headers
+static const char* Stream(const char* version, uint32_t size, uint32_t fail_at)
+{
+	static WIFI_t wifi;
+	static Connection_t conn;
+	char request[64];
+	sprintf(request, "GET /?stream%s\r\n\r\n", version);
+	CONN_Init(&conn);
+	ClientSend(4, request);
+	CHECK(WIFI_ReceiveRequest(&wifi, &conn, 100) == OK && strcmp(conn.request, "stream") == 0);
+	Stream_t stream = { 0, size, fail_at };
+	sent_size = 0;
+	closed_link = -1;
+	Response_t status = WIFI_SendStream(&conn, "200 OK", Generate, &stream);
+	CHECK(status == ((fail_at < size) ? ERR : OK));
+	sent[sent_size] = '\0';
+	if (version[0] == '\0')
+	{
+		CHECK(strncmp(sent, "200 OK\n", 7) == 0);
+		return sent + 7;
+	}
+	const char* body = strstr(sent, "\r\n\r\n");
+	CHECK(strncmp(sent, "HTTP/1.1 200 OK\r\n", 17) == 0 && body != NULL);
+	return (body != NULL) ? body + 4 : sent + sent_size;
+}
+
+static bool IsBody(const char* data, uint32_t size)
+{
+	for (uint32_t i = 0; i < size; i++)
+		if (data[i] != 'a' + i % 26) return false;
+	return true;
+}
+
+static void TestStream(void)
+{
+	// HTTP/1.1: the chunks put back together make the body, the link is kept
+	const char* data = Stream(" HTTP/1.1", 2000, UINT32_MAX);
+	CHECK(strstr(sent, "Transfer-Encoding: chunked\r\n") != NULL && closed_link == -1);
+	static char body[2048];
+	uint32_t body_size = 0;
+	while (1)
+	{
+		char* end;
+		uint32_t size = strtoul(data, &end, 16);
+		CHECK(end != data && strncmp(end, "\r\n", 2) == 0);
+		if (end == data || size == 0 || body_size + size > sizeof(body)) break;
+		memcpy(body + body_size, end + 2, size);
+		body_size += size;
+		data = end + 2 + size;
+		CHECK(strncmp(data, "\r\n", 2) == 0);
+		data += 2;
+	}
+	CHECK(body_size == 2000 && IsBody(body, body_size));
+	CHECK(strcmp(data, "0\r\n\r\n") == 0);
+
+	// HTTP/1.0: the body ends with the link
+	data = Stream(" HTTP/1.0", 2000, UINT32_MAX);
+	CHECK(strstr(sent, "Transfer-Encoding") == NULL && strstr(sent, "Connection: close\r\n") != NULL);
+	CHECK(strlen(data) == 2000 && IsBody(data, 2000) && closed_link == 4);
+
+	// legacy: the body ends with "\r\n"
+	data = Stream("", 2000, UINT32_MAX);
+	CHECK(strlen(data) == 2002 && IsBody(data, 2000) && strcmp(data + 2000, "\r\n") == 0 && closed_link == -1);
+
+	// a body that can't be completed: the link is closed, even if kept alive
+	Stream(" HTTP/1.1", 2000, 800);
+	CHECK(closed_link == 4);
+}
+
+#define BODY_PAIRS 150
+
+static uint32_t pairs;
+
+// the client sends the rest of the body while the first pairs are parsed
+static Response_t Pair(const char* key, const char* value, void* context)
+{
+	char expected[16];
+	sprintf(expected, "k%u", (unsigned)pairs);
+	CHECK(strcmp(key, expected) == 0 && (uint32_t)atoi(value) == pairs * 7);
+	if (++pairs == 10)
+		ClientSend(2, (const char*)context);
+	return OK;
+}
+
+static void TestBody(void)
+{
+	static char body[BODY_PAIRS * 16];
+	uint32_t size = 0;
+	for (uint32_t i = 0; i < BODY_PAIRS; i++)
+		size += sprintf(body + size, "%sk%u=%u", i ? "&" : "", (unsigned)i, (unsigned)(i * 7));
+
+	// about 1.5 KB of body, less than a half of it sent with the headers
+	char head[128];
+	sprintf(head, "POST /?calibration=points HTTP/1.1\r\nContent-Length: %u\r\n\r\n", (unsigned)size);
+	WIFI_t wifi = {0};
+	Connection_t conn;
+	CONN_Init(&conn);
+	ClientSend(2, head);
+	char first[512];
+	memcpy(first, body, 500);
+	first[500] = '\0';
+	ClientSend(2, first);
+	pairs = 0;
+	CHECK(WIFI_ReceiveRequest(&wifi, &conn, 100) == OK);
+	CHECK(conn.request_type == POST && strcmp(conn.request, "calibration=points") == 0 && conn.body_size == size);
+	CHECK(WIFI_ParseBody(&conn, Pair, body + 500) == OK);
+	CHECK(pairs == BODY_PAIRS && conn.body_size == 0);
+
+	// a body not read by the handler is dropped, the request after it is served
+	ClientSend(2, head);
+	ClientSend(2, body);
+	ClientSend(2, "GET /?next HTTP/1.1\r\n\r\n");
+	CHECK(WIFI_ReceiveRequest(&wifi, &conn, 100) == OK && strcmp(conn.request, "calibration=points") == 0);
+	CHECK(WIFI_ReceiveRequest(&wifi, &conn, 100) == OK && strcmp(conn.request, "next") == 0);
+	CHECK(WIFI_ReceiveRequest(&wifi, &conn, 10) == TIMEOUT);
+}
+
+static Response_t results[ESP_QUEUE_SIZE];
+static uint32_t results_count;
+
+static void Done(Response_t result, void* context)
+{
+	CHECK(context == &results[results_count]);		// in the order they were queued
+	results[results_count++] = result;
+}
+
+static void TestQueue(void)
+{
+	// the queue is run by the main loop, the commands end in order with their own result
+	results_count = 0;
+	for (uint32_t i = 0; i < ESP_QUEUE_SIZE; i++)
+		CHECK(ESP8266_QueueCommand("AT\r\n", 4, "OK", 100, Done, &results[i]) == OK);
+	CHECK(ESP8266_QueueCommand("AT\r\n", 4, "OK", 100, Done, NULL) == ERR);		// full
+	while (ESP8266_IsBusy())
+	{
+		if (!ESP8266_Process()) __WFI();
+		if (results_count == 1) esp_error = true;
+	}
+	esp_error = false;
+	CHECK(results_count == ESP_QUEUE_SIZE);
+	CHECK(results[0] == OK);
+	for (uint32_t i = 1; i < ESP_QUEUE_SIZE; i++)
+		CHECK(results[i] == ERR);
+}
+
+// the ESP left as it was before a reset of the STM32 is reused only if it's connected and serving on SERVER_PORT
+static void TestWarmStart(void)
+{
+	WIFI_t wifi = {0};
+	WIFI_BootStats_t stats;
+	static const char* refused[] =
+	{
+		"+CIPSERVER:0\r\n\r\nOK\r\n",
+		"\r\nERROR\r\n",
+		"+CIPSERVER:1,80,\"TCP\",0\r\n\r\nOK\r\n",
+	};
+	for (uint32_t i = 0; i < sizeof(refused) / sizeof(refused[0]); i++)
+	{
+		strcpy(cipserver, refused[i]);
+		CHECK(WIFI_WarmStart(&wifi, SERVER_PORT) == ERR);
+	}
+	strcpy(cipserver, "+CIPSERVER:1,34677,\"TCP\",0\r\n\r\nOK\r\n");
+	esp_mute = true;
+	CHECK(WIFI_WarmStart(&wifi, SERVER_PORT) == ERR);
+	esp_mute = false;
+	WIFI_GetBootStats(&stats);
+	CHECK(!stats.warm);
+
+	closed_link = -1;
+	CHECK(WIFI_WarmStart(&wifi, SERVER_PORT) == OK);
+	CHECK(strcmp(wifi.IP, "192.168.1.20") == 0 && closed_link == WIFI_MAX_LINKS);
+	WIFI_GetBootStats(&stats);
+	CHECK(stats.warm && stats.network_ms == uwTick);
+}
+
+/*
+ * the interrupts are held off while the ESP sends lines (sometimes the data of a +CIPRECVDATA) for size
+ * bytes in total. returns the overruns counted
+ */
+static uint32_t HoldOff(uint32_t size, bool data)
+{
+	ESP8266_RxStats_t before, after;
+	ESP8266_GetRxStats(&before);
+	held = true;
+	uint32_t end = wire_size + size;
+	if (data)
+	{
+		char header[32];
+		sprintf(header, "+CIPRECVDATA:%u,", (unsigned)(size / 2));
+		PushString(header);
+		while (wire_size < end - size / 2) PushString("OK\r\n");
+		wire_size = end - size / 2;
+	}
+	while (wire_size < end) PushString("busy p...\r\n");
+	wire_size = end;
+	PushString("\r\n");
+	while (wire_pos < wire_size) Receive(UART_BUFFER_SIZE);
+	Release();
+	ESP8266_GetRxStats(&after);
+	return after.overruns - before.overruns;
+}
+
+static void TestOverrun(void)
+{
+	// less than a ring behind: nothing is lost, even across the wrap
+	for (uint32_t size = 10; size < UART_BUFFER_SIZE - 20; size += 7)
+	{
+		CHECK(HoldOff(size, false) == 0);
+		CHECK(ESP8266_CheckAT() == OK);
+	}
+
+	/*
+	 * a ring or more: one overrun, the parser is in step again for the next command. the flags are one bit
+	 * each, so from one ring and a half behind the lap is only seen if the position tells it apart
+	 */
+	for (uint32_t size = UART_BUFFER_SIZE; size < 3 * UART_BUFFER_SIZE; size += 13)
+	{
+		uint32_t overruns = HoldOff(size, size % 2);
+		if (size + 2 <= UART_BUFFER_SIZE * 3 / 2)		// + the final "\r\n"
+			CHECK(overruns == 1);
+		else
+			CHECK(overruns <= 1);
+		CHECK(ESP8266_CheckAT() == OK);
+		WIFI_t wifi = {0};
+		CHECK(WIFI_GetConnectionInfo(&wifi) == OK && strcmp(wifi.SSID, "my network") == 0);
+	}
+
+	// and it isn't seen as lapped by the next rounds of the DMA
+	ESP8266_RxStats_t before, after;
+	ESP8266_GetRxStats(&before);
+	srand(0);
+	chunk_max = 64;
+	for (uint32_t i = 0; i < 20; i++)
+	{
+		Noise();
+		TestRequests();
+	}
+	ESP8266_GetRxStats(&after);
+	CHECK(after.overruns == before.overruns);
+	CHECK(after.wraps > before.wraps + 20);
+}
+
+// the main loop for ms, returns the times WIFI_Supervise saw the connection come back
+static uint32_t MainLoop(uint32_t ms)
+{
+	uint32_t reconnected = 0;
+	uint32_t end = uwTick + ms;
+	while ((int32_t)(uwTick - end) < 0)
+	{
+		reconnected += WIFI_Supervise();
+		if (!ESP8266_Process()) __WFI();
+	}
+	return reconnected;
+}
+
+static void TestSupervise(void)
+{
+	WIFI_t wifi = {0};
+	strcpy(wifi.SSID, "my network");
+	strcpy(wifi.pw, "secret");
+	WIFI_HealthStats_t stats;
+
+	// started offline: the first AT+CWJAP is sent right away
+	ap_up = false;
+	cwjap[0] = '\0';
+	WIFI_StartSupervisor(&wifi, false);
+	MainLoop(10);
+	CHECK(strcmp(cwjap, "AT+CWJAP=\"my network\",\"secret\"\r\n") == 0);
+	ap_up = true;
+	CHECK(MainLoop(WIFI_BACKOFF_MIN_MS * 2 + 10) == 1);
+	WIFI_GetHealthStats(&stats);
+	CHECK(stats.online && stats.attempts == 2 && stats.reconnects == 1);
+
+	// disconnected: the attempts are 2, 4, 8... s apart, up to WIFI_BACKOFF_MAX_MS
+	ap_up = false;
+	PushString("WIFI DISCONNECT\r\n");
+	uint32_t start = uwTick;
+	uint32_t attempts = stats.attempts;
+	uint32_t last = start;
+	uint32_t backoff = WIFI_BACKOFF_MIN_MS;
+	for (uint32_t i = 0; i < 10; i++)
+	{
+		do
+		{
+			MainLoop(1);
+			WIFI_GetHealthStats(&stats);
+		} while (stats.attempts == attempts && uwTick - last < WIFI_BACKOFF_MAX_MS + 100);
+		CHECK(stats.attempts == attempts + 1 && !stats.online);
+		CHECK(uwTick - last >= backoff && uwTick - last <= backoff + 10);
+		attempts = stats.attempts;
+		last = uwTick;
+		backoff = (backoff * 2 < WIFI_BACKOFF_MAX_MS) ? backoff * 2 : WIFI_BACKOFF_MAX_MS;
+	}
+	CHECK(backoff == WIFI_BACKOFF_MAX_MS);
+
+	// back with the next attempt: the outage is counted as downtime
+	ap_up = true;
+	uint32_t downtime = stats.downtime_ms;
+	CHECK(MainLoop(WIFI_BACKOFF_MAX_MS + 10) == 1);
+	WIFI_GetHealthStats(&stats);
+	CHECK(stats.online && stats.reconnects == 2 && stats.attempts == attempts + 1);
+	CHECK(stats.downtime_ms >= downtime && stats.downtime_ms - downtime <= WIFI_BACKOFF_MAX_MS + 10);
+
+	// the ESP reconnects by itself before the first attempt
+	PushString("WIFI DISCONNECT\r\n");
+	MainLoop(WIFI_BACKOFF_MIN_MS / 2);
+	PushString("WIFI GOT IP\r\n");
+	CHECK(MainLoop(10) == 1);
+	WIFI_GetHealthStats(&stats);
+	CHECK(stats.online && stats.reconnects == 3 && stats.attempts == attempts + 1 && stats.next_attempt_ms == 0);
+
+	// a slow join: the blocking functions don't wait behind it, the requests wait for it
+	join_held = true;
+	PushString("WIFI DISCONNECT\r\n");
+	MainLoop(WIFI_BACKOFF_MIN_MS + 10);
+	WIFI_GetHealthStats(&stats);
+	CHECK(stats.attempts == attempts + 2 && stats.next_attempt_ms == 0);
+	start = uwTick;
+	CHECK(ESP8266_CheckAT() == BUSY);
+	CHECK(WIFI_CloseLink(1) == BUSY);
+	CHECK(WIFI_GetConnectionInfo(&wifi) != OK);
+	CHECK(uwTick == start);
+	Connection_t conn;
+	CONN_Init(&conn);
+	ClientSend(1, "GET /?h HTTP/1.1\r\n\r\n");
+	CHECK(WIFI_ReceiveRequest(&wifi, &conn, 10) == TIMEOUT);
+	CHECK(MainLoop(100) == 0);						// "WIFI GOT IP" came, the OK didn't
+
+	join_held = false;
+	PushString("\r\nOK\r\n");
+	CHECK(MainLoop(10) == 1);
+	CHECK(WIFI_GetConnectionInfo(&wifi) == OK);
+	CHECK(WIFI_ReceiveRequest(&wifi, &conn, 100) == OK && strcmp(conn.request, "h") == 0);
+	WIFI_GetHealthStats(&stats);
+	CHECK(stats.online && stats.reconnects == 4);
+}
+
+int main(void)
+{
+	CHECK(ESP8266_Init() == OK);
+	uint32_t failures = 0;
+	uint32_t total = 0;
+	for (uint32_t seed = 0; seed < SEEDS; seed++)
+	{
+		srand(seed);
+		chunk_max = 1 + rand() % 64;
+		old_format = seed % 2;
+		total += wire_size;
+		wire_size = wire_pos = 0;
+		memset(link_size, 0, sizeof(link_size));
+
+		Noise();
+		TestCommands();
+		Noise();
+		TestTarget();
+		Noise();
+		TestRequests();
+		Noise();
+		TestLinks();
+		Noise();
+		TestBody();
+		Noise();
+		TestHttp();
+		Noise();
+		TestStream();
+		Noise();
+		TestQueue();
+		while (wire_pos < wire_size) __WFI();
+
+		// every byte was parsed once, nothing was overwritten before being read
+		ESP8266_RxStats_t stats;
+		ESP8266_GetRxStats(&stats);
+		CHECK(stats.overruns == 0);
+
+		if (test_failures != failures)
+		{
+			printf("seed %u, chunks up to %u bytes\n", seed, chunk_max);
+			failures = test_failures;
+		}
+	}
+
+	ESP8266_RxStats_t stats;
+	ESP8266_GetRxStats(&stats);
+	total += wire_size;
+	CHECK(stats.received == total);
+	printf("%u seeds: %u bytes received, %u times around uart_buffer\n", SEEDS, stats.received, stats.wraps);
+	CHECK(stats.wraps > SEEDS);
+
+	TestOverrun();
+	TestWarmStart();
+	TestSupervise();
+
+	return TEST_END();
+}
@@ -0,0 +1,232 @@
+/*
+ * test_fixedpoint.c
+ *
+ * fixed-point kernels against the same computations in double: FIX_Sqrt64 and the Q multiplies,
+ * the Goertzel filters of harmonics.c, and the conversion of a measurement window to the readings
+ * in sensor.c. The inputs are the same integers for both, so only the fixed-point error is measured
+ */
+
+#include "test.h"
+#include "mains.h"
+#include "sensor.h"
+#include "sampling.h"
+#include "harmonics.h"
+#include "fixedpoint.h"
+#include <stdlib.h>
+#include <string.h>
+
+TEST_DEFINE_FAILURES;
+
+#define PI 3.14159265358979
+
+static uint64_t random_state = 88172645463325252ULL;
+
+static uint64_t Random64(void)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+	return random_state;
+}
+
+// uniform in [low, high)
+static double RandomRange(double low, double high)
+{
+	return low + (high - low) * (Random64() >> 11) / 9007199254740992.0;
+}
+
+static void CheckSqrt(uint64_t x)
+{
+	unsigned __int128 root = FIX_Sqrt64(x);
+	if (!(root * root <= x && (root + 1) * (root + 1) > x))
+	{
+		test_failures++;
+		printf("FIX_Sqrt64(%llu) = %llu\n", (unsigned long long)x, (unsigned long long)root);
+	}
+}
+
+static void TestSqrt(void)
+{
+	for (uint64_t x = 0; x < 100000; x++)
+		CheckSqrt(x);
+	CheckSqrt(UINT64_MAX);
+	CHECK(FIX_Sqrt64(UINT64_MAX) == UINT32_MAX);
+
+	for (uint32_t i = 0; i < 200000; i++)
+	{
+		uint64_t x = Random64() >> (Random64() % 64);
+		CheckSqrt(x);
+		// perfect squares and their neighbours
+		uint64_t root = Random64() >> 32;
+		CheckSqrt(root * root);
+		CheckSqrt(root * root - 1);
+		CheckSqrt(root * root + 1);
+	}
+}
+
+static void TestMultiply(void)
+{
+	double max_q15 = 0, max_q31 = 0;
+	for (uint32_t i = 0; i < 100000; i++)
+	{
+		q15_t a15 = Random64(), b15 = Random64();
+		q31_t a31 = Random64(), b31 = Random64();
+		// the result is truncated, so it's always at most one LSB below the exact product
+		double e15 = (double)a15 * b15 / 32768 - FIX_MulQ15(a15, b15);
+		double e31 = (double)a31 * b31 / 2147483648.0 - FIX_MulQ31(a31, b31);
+		if (a15 != -32768 || b15 != -32768)
+			CHECK(e15 >= 0 && e15 < 1);
+		CHECK(e31 >= 0 && e31 < 1);
+		if (e15 > max_q15) max_q15 = e15;
+		if (e31 > max_q31) max_q31 = e31;
+	}
+	printf("FIX_MulQ15 max error %.4f LSB, FIX_MulQ31 max error %.4f LSB\n", max_q15, max_q31);
+
+	CHECK(FIX_Q(0.5, 15) == 16384);
+	CHECK(FIX_Q(-0.25, 16) == -16384);
+	CHECK(llabs(FIX_TWO_PI_Q30 - (long long)(2 * PI * (1 << 30))) <= 1);
+}
+
+/*
+ * Goertzel filters against a DFT in double of the same integer inputs, for windows of 4 cycles at
+ * the sample rates of the profiles and 45-55 Hz
+ */
+static void TestHarmonics(void)
+{
+	static const double pair_ns[] = { 100000, 250000, 900750 };
+	double max_error = 0;
+
+	for (uint32_t trial = 0; trial < 300; trial++)
+	{
+		double pair_s = pair_ns[trial % 3] / 1e9;
+		double frequency = RandomRange(45, 55);
+		double omega = 2 * PI * frequency * pair_s;
+		uint32_t pairs = (uint32_t)(SENS_WINDOW_CYCLES / (frequency * pair_s));
+
+		double amplitude[HARM_COUNT], phase[HARM_COUNT];
+		for (uint32_t h = 0; h < HARM_COUNT; h++)
+		{
+			amplitude[h] = (h == 0) ? RandomRange(10, 2000) : amplitude[0] * RandomRange(0, 0.4);
+			phase[h] = RandomRange(0, 2 * PI);
+		}
+
+		HARM_SetFundamental((uint32_t)(omega * (1 << 30) + 0.5));
+		HARM_Reset();
+		double re[2][HARM_COUNT] = { { 0 } }, im[2][HARM_COUNT] = { { 0 } };
+		for (uint32_t n = 0; n < pairs; n++)
+		{
+			double x = 0;
+			for (uint32_t h = 0; h < HARM_COUNT; h++)
+				x += amplitude[h] * sin(HARM_ORDER[h] * omega * n + phase[h]);
+			// counts without offset, HARM_INPUT_SHIFT fractional bits like SENS_AddPair
+			int32_t input[2] = { (int32_t)lround(x * (1 << HARM_INPUT_SHIFT)), (int32_t)lround(x * (1 << HARM_INPUT_SHIFT) / 2) };
+			HARM_AddPair(input[0], input[1]);
+			for (uint32_t c = 0; c < 2; c++)
+				for (uint32_t h = 0; h < HARM_COUNT; h++)
+				{
+					re[c][h] += input[c] * cos(HARM_ORDER[h] * omega * n);
+					im[c][h] -= input[c] * sin(HARM_ORDER[h] * omega * n);
+				}
+		}
+
+		uint32_t current[HARM_COUNT], voltage[HARM_COUNT];
+		HARM_GetAmplitudes(pairs * 256, current, voltage);
+		for (uint32_t h = 0; h < HARM_COUNT; h++)
+		{
+			if (HARM_ORDER[h] * omega >= PI)
+			{
+				CHECK(current[h] == 0);		// above half of the sample rate
+				continue;
+			}
+			// counts, the voltage channel gets half of the signal
+			double expected = 2 * hypot(re[0][h], im[0][h]) / pairs / (1 << HARM_INPUT_SHIFT);
+			double expected_voltage = 2 * hypot(re[1][h], im[1][h]) / pairs / (1 << HARM_INPUT_SHIFT);
+			double error = fabs(current[h] / 256.0 - expected);
+			// 1/256 count of output resolution, plus the Q29 coefficient over up to 1000 pairs
+			CHECK_NEAR(current[h] / 256.0, expected, 0.02 + expected * 1e-4);
+			CHECK_NEAR(voltage[h] / 256.0, expected_voltage, 0.02 + expected_voltage * 1e-4);
+			if (error > max_error) max_error = error;
+		}
+	}
+	printf("HARM amplitudes max error %.4f counts\n", max_error);
+}
+
+// the default calibration tables (calibration.c) in double
+static double CurrentScale(double raw_ua)
+{
+	return (raw_ua >= (uint32_t)(0.25 * 2.62286 * 1000000)) ? CURRENT_CALIB_VALUE : 2.09 / 2.62286 * CURRENT_CALIB_VALUE;
+}
+
+/*
+ * the readings of a window as the float code computed them, from the same sums
+ */
+static void TestWindowReadings(void)
+{
+	double max_current = 0, max_power = 0, max_pf = 0, max_voltage = 0;
+
+	for (uint32_t trial = 0; trial < 120; trial++)
+	{
+		uint32_t profile = trial % SAMPLING_PROFILES;
+		MAINS_Signal_t signal = { 0 };
+		signal.frequency = RandomRange(49, 51);
+		signal.voltage = RandomRange(200, 250);
+		signal.current = (trial % 4 == 0) ? RandomRange(0.06, 0.5) : RandomRange(0.7, 8);
+		signal.current_phase = RandomRange(-PI / 2, PI / 2);
+		signal.current_harmonics[1] = RandomRange(0, 0.3);
+		signal.current_harmonic_phase[1] = RandomRange(0, 2 * PI);
+		signal.current_offset = RandomRange(2000, 2100);
+		signal.noise = 1;
+		MAINS_Start(&signal, profile);
+		MAINS_Run(1500);
+
+		SENS_Window_t w;
+		SENS_GetSnapshot(&w);
+		SENS_Power_t power;
+		SENS_GetPower(&power);
+		double length = w.length;
+
+		// RMS in counts from the variance of the samples, the sums and length are x256
+		double variance = length * (double)w.current_sum_sq - (double)w.current_sum * w.current_sum;
+		double rms = sqrt(variance) / length;
+		double raw_ua = rms * 3.3 / 4096.0 * 2.828427 * 2.62286 * 1000000;
+		double current_ua = raw_ua * CurrentScale(raw_ua);
+		double dead_zone = sampling_profiles[profile].dead_zone;
+		double current_ma = (current_ua <= dead_zone) ? 0 : current_ua / 1000;
+
+		double raw_mv = w.voltage_sum / length * 1772.544;
+		double voltage_scale = VOLTAGE_CALIB_VALUE;
+		double vrms = sqrt(2 * (double)w.voltage_sum_sq / length) * 0.797934 * voltage_scale;		// V
+
+		double interpolation = sampling_profiles[profile].interpolation_correction / 65536.0;
+		double real_counts = (4 * (double)w.power_sum - (double)w.current_offset * w.voltage_sum) / length / 256;
+		double real = fabs(real_counts * 2 * 0.797934 * interpolation * voltage_scale
+				* 3.3 / 4096.0 * 2.828427 * 2.62286 * CurrentScale(raw_ua));		// W
+		double apparent = vrms * current_ua / 1000000;
+		if (real > apparent) real = apparent;
+
+		// the RMS value is Q8: one LSB is ~23 uA
+		CHECK_NEAR(SENS_GetRawCurrent(), raw_ua, 25 + raw_ua * 1e-4);
+		CHECK_NEAR(SENS_GetCurrent(), current_ma, 1);
+		CHECK_NEAR(SENS_GetRawVoltage(), raw_mv, 2);
+		CHECK_NEAR(power.apparent_power / 1000.0, apparent, 0.002 + apparent * 2e-4);
+		CHECK_NEAR(power.real_power / 1000.0, real, 0.002 + apparent * 2e-4);
+		CHECK_NEAR(power.power_factor / 32768.0, real / apparent, 2e-4);
+		CHECK_NEAR(SENS_GetFrequency(), (double)w.cycles * w.sample_rate * 256 / length, 1);
+
+		if (fabs(SENS_GetCurrent() - current_ma) > max_current) max_current = fabs(SENS_GetCurrent() - current_ma);
+		if (fabs(power.real_power / 1000.0 - real) / apparent > max_power) max_power = fabs(power.real_power / 1000.0 - real) / apparent;
+		if (fabs(power.power_factor / 32768.0 - real / apparent) > max_pf) max_pf = fabs(power.power_factor / 32768.0 - real / apparent);
+		if (fabs(SENS_GetRawVoltage() - raw_mv) > max_voltage) max_voltage = fabs(SENS_GetRawVoltage() - raw_mv);
+	}
+	printf("window readings max error: I %.2f mA, P %.1e of S, PF %.1e, raw V %.2f mV\n",
+			max_current, max_power, max_pf, max_voltage);
+}
+
+int main(void)
+{
+	TestSqrt();
+	TestMultiply();
+	TestHarmonics();
+	TestWindowReadings();
+	return TEST_END();
+}
@@ -0,0 +1,143 @@
+/*
+ * test_power.c
+ *
+ * real, apparent and reactive power and power factor (SENS_GetPower) against the exact values of the
+ * synthetic waveforms, the "only measures loads" rules of SENS_GetPower and the energy integration
+ */
+
+#include "test.h"
+#include "mains.h"
+#include "sensor.h"
+#include "sampling.h"
+#include <string.h>
+
+TEST_DEFINE_FAILURES;
+
+#define PI 3.14159265358979
+
+static void CheckPower(const char* name, const MAINS_Signal_t* signal, uint32_t profile, double tolerance)
+{
+	MAINS_Start(signal, profile);
+	MAINS_Run(10000);		// the current offset is a long term average
+
+	double real = fabs(MAINS_GetRealPower());
+	double apparent = MAINS_GetVoltageRMS() * MAINS_GetCurrentRMS();
+	double reactive = (real < apparent) ? sqrt(apparent * apparent - real * real) : 0;
+	SENS_Power_t power;
+	SENS_GetPower(&power);
+
+	printf("%-22s %-9s P %8.2f W (%8.2f)  S %8.2f VA (%8.2f)  Q %8.2f var (%8.2f)  PF %.4f (%.4f)\n", name,
+			sampling_profiles[profile].name, power.real_power / 1000.0, real, power.apparent_power / 1000.0, apparent,
+			power.reactive_power / 1000.0, reactive, power.power_factor / 32768.0, real / apparent);
+	CHECK_REL(power.real_power / 1000.0, real, tolerance);
+	CHECK_REL(power.apparent_power / 1000.0, apparent, 0.01);
+	// sqrt(S^2 - P^2) amplifies the errors near PF 1: 0.1% of S between S and P is 4.5% of S
+	CHECK_NEAR(power.reactive_power / 1000.0, reactive, apparent * 0.05);
+	CHECK_NEAR(power.power_factor / 32768.0, real / apparent, 0.01);
+	CHECK(power.real_power <= power.apparent_power);
+}
+
+static void TestLoads(void)
+{
+	MAINS_Signal_t signal = { .voltage = 230, .current = 2, .noise = 0.5 };
+
+	CheckPower("resistive 2 A", &signal, SAMPLING_PRECISION, 0.01);
+	CheckPower("resistive 2 A", &signal, SAMPLING_BALANCED, 0.01);
+	CheckPower("resistive 2 A", &signal, SAMPLING_FAST, 0.01);
+
+	// the current is sampled before the voltage, the skew compensation keeps the phase right
+	signal.current_phase = PI / 3;
+	CheckPower("inductive PF 0.5", &signal, SAMPLING_PRECISION, 0.01);
+	CheckPower("inductive PF 0.5", &signal, SAMPLING_FAST, 0.01);
+	signal.current_phase = -PI / 4;
+	CheckPower("capacitive PF 0.71", &signal, SAMPLING_PRECISION, 0.01);
+
+	// rectifier: only the fundamental carries real power, the harmonics are in the reactive part
+	signal.current_phase = 0;
+	signal.current = 1;
+	signal.current_harmonics[1] = 0.8;
+	signal.current_harmonics[2] = 0.6;
+	signal.current_harmonics[3] = 0.4;
+	signal.current_harmonics[4] = 0.2;
+	CheckPower("rectifier 1 A", &signal, SAMPLING_PRECISION, 0.01);
+
+	/*
+	 * distorted mains too, with an offset of the ACS712 away from the nominal one. the harmonics carry
+	 * real power now: at 1110 pairs per second the skew interpolation and the 736 us voltage aperture
+	 * attenuate the 3rd and 5th harmonic products by ~10% and ~25%, ~1% of P here
+	 */
+	signal.voltage_harmonics[1] = 0.05;
+	signal.voltage_harmonics[2] = 0.03;
+	signal.current_offset = 2030;
+	CheckPower("rectifier, 5% V3", &signal, SAMPLING_PRECISION, 0.015);
+	CheckPower("rectifier, 5% V3", &signal, SAMPLING_FAST, 0.01);
+}
+
+static void TestSign(void)
+{
+	MAINS_Signal_t signal = { .voltage = 230, .current = 2, .noise = 0.5 };
+	SENS_Power_t forward, reversed;
+
+	// the orientation of the ACS712 is not known: a reversed sensor reads the same |P|
+	MAINS_Start(&signal, SAMPLING_PRECISION);
+	MAINS_Run(2000);
+	SENS_GetPower(&forward);
+	signal.current_phase = PI;
+	MAINS_Start(&signal, SAMPLING_PRECISION);
+	MAINS_Run(2000);
+	SENS_GetPower(&reversed);
+	CHECK_REL(reversed.real_power, forward.real_power, 0.005);
+	CHECK_REL(reversed.apparent_power, forward.apparent_power, 0.005);
+	CHECK(reversed.power_factor > 32000);
+
+	/*
+	 * right after SENS_Init the current offset is still the nominal 2048 counts, far from the one of
+	 * this sensor: the offset error times the voltage mean is larger than V*I, and the real power
+	 * is clamped to the apparent power
+	 */
+	memset(&signal, 0, sizeof(signal));
+	signal.voltage = 230;
+	signal.current = 0.2;
+	signal.current_offset = 2100;
+	MAINS_Start(&signal, SAMPLING_PRECISION);
+	MAINS_Run(200);
+	SENS_Power_t power;
+	SENS_GetPower(&power);
+	CHECK(power.apparent_power > 0);
+	CHECK(power.real_power == power.apparent_power);
+	CHECK(power.reactive_power == 0);
+	CHECK(power.power_factor == 32768);
+
+	// under CURRENT_THRESHOLD there is no power at all
+	signal.current = 0.03;
+	signal.current_offset = 0;
+	MAINS_Start(&signal, SAMPLING_PRECISION);
+	MAINS_Run(2000);
+	SENS_GetPower(&power);
+	CHECK(power.real_power == 0 && power.apparent_power == 0 && power.reactive_power == 0);
+}
+
+static void TestEnergy(void)
+{
+	MAINS_Signal_t signal = { .voltage = 230, .current = 2, .current_phase = PI / 4, .noise = 0.5 };
+
+	// SENS_Init does not clear the energy, it's restored from FLASH
+	SENS_SetEnergy(1000000);
+	MAINS_Start(&signal, SAMPLING_PRECISION);
+	CHECK(SENS_GetEnergy() == 1000000);
+
+	// the samples before the first rising edge are not integrated
+	SENS_SetEnergy(0);
+	MAINS_Run(60000);
+	double expected = MAINS_GetRealPower() * 60 * 1e6;
+	printf("energy in 60 s: %.1f J (%.1f J)\n", SENS_GetEnergy() / 1e6, expected / 1e6);
+	CHECK_REL(SENS_GetEnergy(), expected, 0.01);
+}
+
+int main(void)
+{
+	TestLoads();
+	TestSign();
+	TestEnergy();
+	return TEST_END();
+}
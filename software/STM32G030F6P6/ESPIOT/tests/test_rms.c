@@ -0,0 +1,178 @@
+/*
+ * test_rms.c
+ *
+ * true-RMS current, mean-based voltage and frequency readings (SENS_GetCurrent, SENS_GetVoltage,
+ * SENS_GetFrequency) against the exact values of the synthetic waveforms, and against the peak to
+ * peak method they replaced
+ */
+
+#include "test.h"
+#include "mains.h"
+#include "sensor.h"
+#include "sampling.h"
+#include "calibration.h"
+#include <string.h>
+
+TEST_DEFINE_FAILURES;
+
+#define OLD_ADC_BUF_LEN 2048		// the old methods looked at the whole buffer, 1024 pairs
+
+static uint16_t old_buf[OLD_ADC_BUF_LEN];
+
+// peak to peak method, as it was in main.c (float, 256x oversampling only)
+static float OLD_GetCurrent(void)
+{
+	float max = 0, min = 4096;
+	for (uint32_t i = 0; i < OLD_ADC_BUF_LEN; i += 2)
+	{
+		if (old_buf[i] > max) max = old_buf[i];
+		if (old_buf[i] < min) min = old_buf[i];
+	}
+	max = max / 4096.0 * 3.3;
+	min = min / 4096.0 * 3.3;
+
+	float adjust_value = 2.62286;
+	float abs_amplitude = fabsf(max - min);
+	if (abs_amplitude < 0.25)
+		adjust_value = 2.09;
+
+	float Irms = abs_amplitude * adjust_value * CURRENT_CALIB_VALUE;
+	if (Irms <= CURRENT_DEAD_ZONE) return 0;
+	else return Irms;
+}
+
+// runs the signal for two seconds and checks the reading, returns the error of the old method
+static double CheckCurrent(const char* name, const MAINS_Signal_t* signal, uint32_t profile, double tolerance)
+{
+	MAINS_Start(signal, profile);
+	MAINS_Run(2000);
+	double expected = MAINS_GetCurrentRMS();
+	double current = SENS_GetCurrent() / 1000.0;
+
+	MAINS_Fill(old_buf, OLD_ADC_BUF_LEN / 2);
+	double old = OLD_GetCurrent();
+
+	printf("%-24s %-9s true %7.3f A  rms %7.3f A (%+6.2f%%)  p2p %7.3f A (%+6.2f%%)\n", name,
+			sampling_profiles[profile].name, expected, current, (current / expected - 1) * 100,
+			old, (old / expected - 1) * 100);
+	CHECK_REL(current, expected, tolerance);
+	return fabs(old / expected - 1);
+}
+
+static void TestCurrent(void)
+{
+	MAINS_Signal_t signal = { .voltage = 230, .current = 2, .noise = 0.5 };
+
+	// sine: both methods are right
+	double old_error = CheckCurrent("sine 2 A", &signal, SAMPLING_PRECISION, 0.01);
+	CHECK(old_error < 0.02);
+	signal.current = 8;		// ~ full scale of the ADC
+	CheckCurrent("sine 8 A", &signal, SAMPLING_PRECISION, 0.01);
+	signal.current = 0.3;
+	CheckCurrent("sine 0.3 A", &signal, SAMPLING_PRECISION, 0.02);
+
+	// the other profiles trade noise for sample rate, the RMS value does not depend on them
+	signal.current = 2;
+	CheckCurrent("sine 2 A", &signal, SAMPLING_BALANCED, 0.01);
+	CheckCurrent("sine 2 A", &signal, SAMPLING_FAST, 0.01);
+
+	// clipped at 60% of the peak: the peak to peak method reads the clipped sine as a smaller one
+	signal.current = 5;
+	signal.current_clip = 0.6 * 5 * sqrt(2);
+	old_error = CheckCurrent("clipped 5 A", &signal, SAMPLING_PRECISION, 0.01);
+	CHECK(old_error > 0.05);
+
+	// rectifier and capacitor load: peaky current, odd harmonics decreasing slowly
+	signal.current_clip = 0;
+	signal.current = 1;
+	signal.current_harmonics[1] = 0.8;
+	signal.current_harmonics[2] = 0.6;
+	signal.current_harmonics[3] = 0.4;
+	signal.current_harmonics[4] = 0.2;
+	old_error = CheckCurrent("rectifier 1 A", &signal, SAMPLING_PRECISION, 0.01);
+	CHECK(old_error > 0.05);
+
+	// flat top (3rd harmonic in phase with the fundamental)
+	signal.current = 2;
+	memset(signal.current_harmonics, 0, sizeof(signal.current_harmonics));
+	signal.current_harmonics[1] = 0.25;
+	old_error = CheckCurrent("flat top 2 A", &signal, SAMPLING_PRECISION, 0.01);
+	CHECK(old_error > 0.05);
+
+	// below the dead zone
+	memset(&signal, 0, sizeof(signal));
+	signal.voltage = 230;
+	signal.current = 0.01;
+	signal.noise = 0.5;
+	MAINS_Start(&signal, SAMPLING_PRECISION);
+	MAINS_Run(2000);
+	CHECK(SENS_GetCurrent() == 0);
+}
+
+static void TestVoltage(void)
+{
+	static const double voltages[] = { 230, 207, 253, 110 };
+	MAINS_Signal_t signal = { .current = 1, .noise = 0.5 };
+
+	for (uint32_t i = 0; i < sizeof(voltages) / sizeof(voltages[0]); i++)
+	{
+		signal.voltage = voltages[i];
+		MAINS_Start(&signal, SAMPLING_PRECISION);
+		// longer than the time constant of the voltage filter, which is not reset by SENS_Init
+		MAINS_Run(5 * SENS_VOLTAGE_TIME_CONSTANT_MS);
+		printf("voltage %3.0f V: %3u V\n", voltages[i], SENS_GetVoltage());
+		CHECK_NEAR(SENS_GetVoltage(), voltages[i], 1);
+		CHECK_NEAR(SENS_GetFrequency(), MAINS_FREQUENCY_HZ * 1000, 50);
+	}
+
+	// a step follows the time constant, however often the voltage is read
+	signal.voltage = 200;
+	MAINS_Start(&signal, SAMPLING_PRECISION);
+	MAINS_Run(5 * SENS_VOLTAGE_TIME_CONSTANT_MS);
+	signal.voltage = 240;
+	MAINS_Start(&signal, SAMPLING_PRECISION);
+	MAINS_Run(SENS_VOLTAGE_TIME_CONSTANT_MS);
+	CHECK_NEAR(SENS_GetVoltage(), 200 + 40 * (1 - exp(-1)), 2);
+	CHECK(SENS_GetVoltage() == SENS_GetVoltage());
+
+	// off nominal frequency: the windows still span whole cycles
+	signal.voltage = 230;
+	signal.frequency = 49.5;
+	MAINS_Start(&signal, SAMPLING_PRECISION);
+	MAINS_Run(11000);		// the sample rate is measured over SENS_RATE_PERIOD_MS
+	CHECK_NEAR(SENS_GetFrequency(), 49500, 50);
+	CHECK_REL(SENS_GetCurrent() / 1000.0, MAINS_GetCurrentRMS(), 0.01);
+
+	// no reading before the first window
+	MAINS_Start(&signal, SAMPLING_PRECISION);
+	CHECK(SENS_GetVoltage() == 0);
+	CHECK(SENS_GetCurrent() == 0);
+}
+
+// a point recorded against a reference load moves the readings to it, CAL_Reset restores the defaults
+static void TestCalibration(void)
+{
+	MAINS_Signal_t signal = { .voltage = 230, .current = 2, .noise = 0.5 };
+
+	MAINS_Start(&signal, SAMPLING_PRECISION);
+	MAINS_Run(2000);
+	CHECK(CAL_AddPoint(CAL_CURRENT, SENS_GetRawCurrent(), 2200 * 1000));
+	CHECK(CAL_AddPoint(CAL_VOLTAGE, SENS_GetRawVoltage(), 240 * 1000));
+	MAINS_Run(2000);
+	CHECK_REL(SENS_GetCurrent(), 2200, 0.01);
+	MAINS_Run(5 * SENS_VOLTAGE_TIME_CONSTANT_MS);
+	CHECK_NEAR(SENS_GetVoltage(), 240, 1);
+
+	CAL_Reset(CAL_CURRENT);
+	CAL_Reset(CAL_VOLTAGE);
+	MAINS_Run(2000);
+	CHECK_REL(SENS_GetCurrent(), 2000, 0.01);
+}
+
+int main(void)
+{
+	TestCurrent();
+	TestVoltage();
+	TestCalibration();
+	return TEST_END();
+}
@@ -0,0 +1,131 @@
+/*
+ * test_thd.c
+ *
+ * error budget of the harmonic analysis (SENS_GetHarmonics): the THD and the harmonics of current and
+ * voltage against the exact values of the synthetic waveforms, one error source at a time
+ */
+
+#include "test.h"
+#include "mains.h"
+#include "sensor.h"
+#include "sampling.h"
+#include <string.h>
+
+TEST_DEFINE_FAILURES;
+
+// THD of the harmonics set in the signal, in percent
+static double ExactTHD(const double* harmonics)
+{
+	double sum = 0;
+	for (uint32_t h = 1; h < HARM_COUNT; h++)
+		sum += harmonics[h] * harmonics[h];
+	return sqrt(sum) * 100;
+}
+
+/*
+ * runs the signal and checks the THD of both channels within the given percentage points, and every
+ * current harmonic within harmonic_tolerance of the fundamental
+ */
+static void CheckTHD(const char* name, const MAINS_Signal_t* signal, uint32_t profile,
+		double thd_tolerance, double harmonic_tolerance)
+{
+	MAINS_Start(signal, profile);
+	MAINS_Run(1000);
+	SENS_Harmonics_t harmonics;
+	SENS_GetHarmonics(&harmonics);
+
+	double current_thd = ExactTHD(signal->current_harmonics);
+	double voltage_thd = ExactTHD(signal->voltage_harmonics);
+	double worst = 0;
+	for (uint32_t h = 0; h < HARM_COUNT; h++)
+	{
+		// above half of the sample rate the harmonics are not measured
+		if (HARM_ORDER[h] * (signal->frequency ? signal->frequency : MAINS_FREQUENCY_HZ) * 2
+				>= 1e9 / sampling_profiles[profile].pair_period_ns)
+			continue;
+		double expected = signal->current * 1000 * (h == 0 ? 1 : signal->current_harmonics[h]);
+		double error = fabs(harmonics.current[h] - expected) / (signal->current * 1000);
+		if (error > worst) worst = error;
+		CHECK_NEAR(harmonics.current[h], expected, signal->current * 1000 * harmonic_tolerance);
+	}
+
+	printf("%-28s %-9s I THD %6.2f%% (%6.2f%%)  V THD %5.2f%% (%5.2f%%)  worst harmonic %.2f%% of I1\n", name,
+			sampling_profiles[profile].name, harmonics.current_thd / 100.0, current_thd,
+			harmonics.voltage_thd / 100.0, voltage_thd, worst * 100);
+	CHECK_NEAR(harmonics.current_thd / 100.0, current_thd, thd_tolerance);
+	CHECK_NEAR(harmonics.voltage_thd / 100.0, voltage_thd, thd_tolerance);
+	CHECK_REL(harmonics.voltage[0] / 1000.0, signal->voltage, 0.01);
+}
+
+static void TestBudget(void)
+{
+	MAINS_Signal_t signal = { .voltage = 230, .current = 2 };
+
+	/*
+	 * quantization only: the floor of the measurement. at 1110 pairs per second a window is only ~89
+	 * pairs, and the 9th harmonic (450 Hz) is close to half of the sample rate, where the aperture
+	 * correction of the voltage amplifies it by 17%: the precision profile reads ~0.25% (I) and ~0.35% (V)
+	 * of THD on a pure sine, the fast one less than 0.1%
+	 */
+	CheckTHD("sine, no noise", &signal, SAMPLING_PRECISION, 0.5, 0.002);
+	CheckTHD("sine, no noise", &signal, SAMPLING_FAST, 0.2, 0.002);
+
+	// ADC noise, +-2 counts before the oversampling
+	signal.noise = 2;
+	CheckTHD("sine, noise", &signal, SAMPLING_PRECISION, 0.5, 0.003);
+	CheckTHD("sine, noise", &signal, SAMPLING_FAST, 0.3, 0.003);
+
+	// the conversion aperture attenuates the harmonics, corrected by the profile (sampling.c)
+	signal.current_harmonics[1] = 0.3;
+	signal.current_harmonics[2] = 0.15;
+	signal.current_harmonics[3] = 0.08;
+	signal.current_harmonics[4] = 0.05;
+	signal.voltage_harmonics[1] = 0.04;
+	signal.voltage_harmonics[2] = 0.02;
+	CheckTHD("rectifier", &signal, SAMPLING_PRECISION, 0.5, 0.005);
+	CheckTHD("rectifier", &signal, SAMPLING_BALANCED, 0.5, 0.005);
+	CheckTHD("rectifier", &signal, SAMPLING_FAST, 0.5, 0.005);
+
+	// phase of the harmonics: the Goertzel amplitudes don't depend on it
+	for (uint32_t h = 1; h < HARM_COUNT; h++)
+		signal.current_harmonic_phase[h] = h * 1.1;
+	CheckTHD("rectifier, phases", &signal, SAMPLING_PRECISION, 0.5, 0.005);
+
+	/*
+	 * off nominal frequency: the filters are tuned on the cycle length measured in the previous window,
+	 * and the window spans whole cycles, so there is no leakage from the fundamental
+	 */
+	signal.frequency = 49.2;
+	CheckTHD("rectifier, 49.2 Hz", &signal, SAMPLING_PRECISION, 0.5, 0.005);
+	signal.frequency = 50.8;
+	CheckTHD("rectifier, 50.8 Hz", &signal, SAMPLING_FAST, 0.5, 0.005);
+
+	// low current: the quantization is a larger part of the signal
+	signal.frequency = 0;
+	signal.current = 0.3;
+	CheckTHD("rectifier, 0.3 A", &signal, SAMPLING_PRECISION, 1, 0.01);
+}
+
+static void TestFrequencyStep(void)
+{
+	// the first window after a frequency step uses the filters of the old frequency
+	MAINS_Signal_t signal = { .voltage = 230, .current = 2, .noise = 1 };
+	signal.current_harmonics[1] = 0.2;
+	MAINS_Start(&signal, SAMPLING_PRECISION);
+	MAINS_Run(1000);
+
+	signal.frequency = 50.5;
+	MAINS_Start(&signal, SAMPLING_PRECISION);
+	MAINS_Run(500);
+	SENS_Harmonics_t harmonics;
+	SENS_GetHarmonics(&harmonics);
+	printf("after a step to 50.5 Hz: I THD %.2f%% (20.00%%)\n", harmonics.current_thd / 100.0);
+	CHECK_NEAR(harmonics.current_thd / 100.0, 20, 0.5);
+}
+
+int main(void)
+{
+	TestBudget();
+	TestFrequencyStep();
+	return TEST_END();
+}